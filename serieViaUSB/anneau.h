@@ -0,0 +1,85 @@
+
+#ifndef _ANNEAU_H_
+#define _ANNEAU_H_
+
+/*
+ * Tampon circulaire sans verrou pour un seul producteur (le fil qui
+ * interroge le USB) et un seul consommateur (le fil qui formate et
+ * ecrit les octets).  Les indices avancent sans fin et sont ramenes
+ * dans le tableau par un masque: la taille doit etre une puissance de 2.
+ *
+ * Jerome Collin <jerome.collin@polymtl.ca>
+ *
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+
+#define TAILLE_ANNEAU   (1 << 16)
+
+struct Anneau
+{
+   unsigned char donnees[TAILLE_ANNEAU];
+   std::atomic<size_t> debut;   // avance uniquement par le consommateur
+   std::atomic<size_t> fin;     // avance uniquement par le producteur
+};
+
+inline void anneauInit ( Anneau *a )
+{
+   a->debut.store (0);
+   a->fin.store (0);
+}
+
+// nombre d'octets en attente dans l'anneau
+inline size_t anneauOccupe ( Anneau *a )
+{
+   return a->fin.load (std::memory_order_acquire) -
+          a->debut.load (std::memory_order_acquire);
+}
+
+// cote producteur: copie au plus n octets, retourne le nombre copie
+inline size_t anneauEcrire ( Anneau *a, const unsigned char *src, size_t n )
+{
+   size_t fin = a->fin.load (std::memory_order_relaxed);
+   size_t libre = TAILLE_ANNEAU -
+                  ( fin - a->debut.load (std::memory_order_acquire) );
+   size_t position = fin & ( TAILLE_ANNEAU - 1 );
+   size_t premier;
+
+   if ( n > libre )
+      n = libre;
+
+   // au plus deux morceaux, avant et apres le retour au debut du tableau
+   premier = TAILLE_ANNEAU - position;
+   if ( premier > n )
+      premier = n;
+   memcpy (a->donnees + position, src, premier);
+   memcpy (a->donnees, src + premier, n - premier);
+
+   a->fin.store (fin + n, std::memory_order_release);
+   return n;
+}
+
+// cote consommateur: retire au plus n octets, retourne le nombre retire
+inline size_t anneauLire ( Anneau *a, unsigned char *dst, size_t n )
+{
+   size_t debut = a->debut.load (std::memory_order_relaxed);
+   size_t occupe = a->fin.load (std::memory_order_acquire) - debut;
+   size_t position = debut & ( TAILLE_ANNEAU - 1 );
+   size_t premier;
+
+   if ( n > occupe )
+      n = occupe;
+
+   premier = TAILLE_ANNEAU - position;
+   if ( premier > n )
+      premier = n;
+   memcpy (dst, a->donnees + position, premier);
+   memcpy (dst + premier, a->donnees, n - premier);
+
+   a->debut.store (debut + n, std::memory_order_release);
+   return n;
+}
+
+#endif /* _ANNEAU_H_ */
@@ -0,0 +1,186 @@
+/*
+    bancFormatage: temps d'affichage de 1 Mo d'octets dans chaque mode,
+                   par les tables de formatage.cc et par l'ancien
+                   fprintf par octet (recopie ici tel qu'il etait dans
+                   serieViaUSB.cc).  Les deux textes doivent etre
+                   identiques.  make banc-formatage.
+
+    Jerome Collin
+    Modifications, banc du formatage
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <formatage.h>
+
+#define TAILLE  ( 1 << 20 )
+
+// octets remis a la fois, comme un bloc recu de la carte
+#define BLOC  256
+
+// meilleur de quelques passes, pour ecarter le bruit
+#define PASSES  5
+
+static ModesAffichage modeAffichage;
+static int nbSauts;
+
+// ---- l'ancien chemin, un fprintf par octet ----
+
+char* charToBin ( unsigned char c )
+{
+    static char bin[CHAR_BIT + 1] = {0};
+    int i;
+
+    for ( i = CHAR_BIT - 1; i >= 0; i-- )
+    {
+        bin[i] = (c % 2) + '0';
+        c /= 2;
+    }
+
+    return bin;
+}
+
+void afficherOctet ( FILE *fp, unsigned char octet )
+{
+   switch( modeAffichage )
+   {
+       case HEX:
+           fprintf(fp, "%#04x ", octet);
+           break;
+
+       case DEC:
+           fprintf(fp, "%#04d ", octet);
+           break;
+
+       case BIN:
+           fprintf(fp, "%s ", charToBin(octet));
+           break;
+
+       case BYTE:
+       default:
+           fputc (octet, fp);
+   }
+}
+
+void afficherOctetsAncien ( FILE *fp, const unsigned char *octets, int n,
+                            int position )
+{
+   int j;
+
+   for ( j = 0; j < n; j++ ) {
+      afficherOctet (fp, octets[j]);
+      position++;
+      if( nbSauts ) {
+         if( ( position % nbSauts) == 0 ) { fputc ('\n', fp); }
+      }
+   }
+}
+
+// ---- le banc ----
+
+typedef void (*Affichage)( FILE *fp, const unsigned char *octets, int n,
+                           int position );
+
+static void afficherTout ( Affichage afficher, FILE *fp,
+                           const unsigned char *octets )
+{
+  int i;
+
+  for ( i = 0; i < TAILLE; i += BLOC )
+    afficher (fp, octets + i, BLOC, i);
+  fflush (fp);
+}
+
+static double secondes ( void )
+{
+  struct timespec t;
+
+  clock_gettime (CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// meilleur temps, en ms, pour tout ecrire dans fp
+static double chronometrer ( Affichage afficher, FILE *fp,
+                             const unsigned char *octets )
+{
+  double debut, t, meilleur = 1e9;
+  int k;
+
+  for ( k = 0; k < PASSES; k++ ) {
+    debut = secondes ();
+    afficherTout (afficher, fp, octets);
+    t = ( secondes () - debut ) * 1000;
+    if ( t < meilleur )
+      meilleur = t;
+  }
+  return meilleur;
+}
+
+// vrai si les deux chemins donnent le meme texte
+static int comparer ( const unsigned char *octets )
+{
+  char *ancien, *nouveau;
+  size_t nAncien, nNouveau;
+  FILE *fp;
+  int identique;
+
+  fp = open_memstream (&ancien, &nAncien);
+  afficherTout (afficherOctetsAncien, fp, octets);
+  fclose (fp);
+  fp = open_memstream (&nouveau, &nNouveau);
+  afficherTout (afficherOctets, fp, octets);
+  fclose (fp);
+
+  identique = nAncien == nNouveau && memcmp (ancien, nouveau, nAncien) == 0;
+  free (ancien);
+  free (nouveau);
+  return identique;
+}
+
+int main ( void )
+{
+  static const ModesAffichage modes[] = { BYTE, HEX, DEC, BIN };
+  static const char *noms[] = { "BYTE", "HEX", "DEC", "BIN" };
+  static const int sauts[] = { 0, 16 };
+  unsigned char *octets;
+  double ancien, nouveau;
+  FILE *fp;
+  int m, s, i, identique, r = 0;
+
+  octets = (unsigned char *) malloc (TAILLE);
+  srand48 (1);
+  for ( i = 0; i < TAILLE; i++ )
+    octets[i] = lrand48 ();
+
+  fp = fopen ("/dev/null", "w");
+  if ( fp == NULL ) {
+    fprintf (stderr, "bancFormatage: incapable d'ouvrir /dev/null\n");
+    return -1;
+  }
+
+  for ( m = 0; m < 4; m++ ) {
+    for ( s = 0; s < 2; s++ ) {
+      modeAffichage = modes[m];
+      nbSauts = sauts[s];
+      formatageInit (modeAffichage, nbSauts);
+
+      ancien = chronometrer (afficherOctetsAncien, fp, octets);
+      nouveau = chronometrer (afficherOctets, fp, octets);
+      identique = comparer (octets);
+      printf ("banc: %-4s sauts %2d: fprintf %7.2f ms, tables %6.2f ms "
+              "(%5.1f fois), %s\n", noms[m], nbSauts, ancien, nouveau,
+              ancien / nouveau,
+              identique ? "identique" : "DIFFERENT");
+      if ( ! identique )
+        r = 1;
+    }
+  }
+
+  fclose (fp);
+  free (octets);
+  return r;
+}
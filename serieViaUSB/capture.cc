@@ -0,0 +1,169 @@
+/*
+    capture: ecriture et lecture du format de capture horodatee
+             (voir capture.h).
+
+    Jerome Collin
+    Modifications, capture horodatee
+
+*/
+
+#include <string.h>
+#include <capture.h>
+
+static void ecrire32 ( unsigned char *p, uint32_t v )
+{
+   int i;
+   for ( i = 0; i < 4; i++ )
+      p[i] = v >> ( 8 * i );
+}
+
+static void ecrire64 ( unsigned char *p, uint64_t v )
+{
+   int i;
+   for ( i = 0; i < 8; i++ )
+      p[i] = v >> ( 8 * i );
+}
+
+static uint32_t lire32 ( const unsigned char *p )
+{
+   return p[0] | ( p[1] << 8 ) | ( p[2] << 16 ) | ( (uint32_t) p[3] << 24 );
+}
+
+static uint64_t lire64 ( const unsigned char *p )
+{
+   uint64_t v = 0;
+   int i;
+   for ( i = 7; i >= 0; i-- )
+      v = ( v << 8 ) | p[i];
+   return v;
+}
+
+int captureOuvrir ( Capture *c, FILE *fp, uint64_t debutMural )
+{
+   unsigned char entete[CAPTURE_ENTETE];
+
+   c->fp = fp;
+   c->longueur = 0;
+   c->nPaquets = 0;
+   c->tempsBloc = 0;
+   c->tempsPrecedent = 0;
+
+   memset (entete, 0, sizeof (entete));
+   memcpy (entete, "SVUC", 4);
+   entete[4] = CAPTURE_VERSION;
+   ecrire64 (entete + 8, debutMural);
+   return fwrite (entete, 1, sizeof (entete), fp) == sizeof (entete);
+}
+
+void captureAjouter ( Capture *c, uint64_t temps,
+                      const unsigned char *octets, int n )
+{
+   unsigned char *p;
+   uint64_t ecart;
+
+   if ( c->longueur + CAPTURE_MAX_PAQUET > CAPTURE_TAILLE_BLOC )
+      captureVider (c);
+
+   // le premier paquet d'un bloc a un ecart nul: son temps est
+   // dans l'en-tete du bloc
+   if ( c->nPaquets == 0 ) {
+      c->tempsBloc = temps;
+      c->tempsPrecedent = temps;
+   }
+   ecart = temps - c->tempsPrecedent;
+   c->tempsPrecedent = temps;
+
+   p = c->bloc + CAPTURE_ENTETE_BLOC + c->longueur;
+   while ( ecart >= 0x80 ) {
+      *p++ = ( ecart & 0x7f ) | 0x80;
+      ecart >>= 7;
+   }
+   *p++ = ecart;
+   *p++ = n;
+   memcpy (p, octets, n);
+   p += n;
+
+   c->longueur = p - ( c->bloc + CAPTURE_ENTETE_BLOC );
+   c->nPaquets++;
+}
+
+void captureVider ( Capture *c )
+{
+   if ( c->nPaquets == 0 )
+      return;
+
+   // l'en-tete est place juste devant le corps: un seul fwrite par bloc
+   memcpy (c->bloc, "BLOC", 4);
+   ecrire32 (c->bloc + 4, c->longueur);
+   ecrire32 (c->bloc + 8, c->nPaquets);
+   ecrire64 (c->bloc + 12, c->tempsBloc);
+   fwrite (c->bloc, 1, CAPTURE_ENTETE_BLOC + c->longueur, c->fp);
+
+   c->longueur = 0;
+   c->nPaquets = 0;
+}
+
+int captureLireEntete ( LecteurCapture *l, FILE *fp )
+{
+   unsigned char entete[CAPTURE_ENTETE];
+
+   l->fp = fp;
+   l->longueur = 0;
+   l->position = 0;
+   l->restants = 0;
+   l->temps = 0;
+
+   if ( fread (entete, 1, sizeof (entete), fp) != sizeof (entete) ||
+        memcmp (entete, "SVUC", 4) != 0 || entete[4] != CAPTURE_VERSION )
+      return 0;
+
+   l->debutMural = lire64 (entete + 8);
+   return 1;
+}
+
+int captureLirePaquet ( LecteurCapture *l, uint64_t *temps,
+                        const unsigned char **octets )
+{
+   unsigned char entete[CAPTURE_ENTETE_BLOC];
+   uint64_t ecart = 0;
+   int decalage = 0;
+   int n;
+
+   // bloc suivant
+   if ( l->restants == 0 ) {
+      n = fread (entete, 1, sizeof (entete), l->fp);
+      if ( n == 0 )
+         return -1;
+      if ( n != sizeof (entete) || memcmp (entete, "BLOC", 4) != 0 )
+         return -2;
+      l->longueur = lire32 (entete + 4);
+      l->restants = lire32 (entete + 8);
+      l->temps = lire64 (entete + 12);
+      l->position = 0;
+      if ( l->longueur > CAPTURE_TAILLE_BLOC ||
+           fread (l->bloc, 1, l->longueur, l->fp) != l->longueur )
+         return -2;
+      if ( l->restants == 0 )
+         return captureLirePaquet (l, temps, octets);
+   }
+
+   do {
+      if ( l->position >= l->longueur || decalage > 63 )
+         return -2;
+      ecart |= (uint64_t) ( l->bloc[l->position] & 0x7f ) << decalage;
+      decalage += 7;
+   } while ( l->bloc[l->position++] & 0x80 );
+
+   if ( l->position >= l->longueur )
+      return -2;
+   n = l->bloc[l->position++];
+   if ( l->position + n > l->longueur )
+      return -2;
+
+   l->temps += ecart;
+   *temps = l->temps;
+   *octets = l->bloc + l->position;
+   l->position += n;
+   l->restants--;
+   return n;
+}
@@ -0,0 +1,83 @@
+
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+/*
+ * Format de capture horodatee des octets recus de la carte (option -t
+ * de serieViaUSB, relu par relireCapture).
+ *
+ * Le fichier commence par un en-tete de 16 octets:
+ *    "SVUC", version (1 octet), 3 octets reserves,
+ *    heure murale du debut de la capture en us depuis 1970 (8 octets)
+ *
+ * suivi de blocs, chacun avec un en-tete de 20 octets:
+ *    "BLOC", longueur du corps (4 octets), nombre de paquets (4 octets),
+ *    temps du premier paquet en us depuis le debut (8 octets)
+ *
+ * Le corps contient un enregistrement par paquet USB:
+ *    ecart en us avec le paquet precedent (entier de longueur variable,
+ *    7 bits par octet, bit 7 a 1 s'il en reste), nombre d'octets
+ *    (1 octet), puis les octets eux-memes.
+ *
+ * Tous les entiers sont petit-boutistes.  Un paquet de 7 octets ne
+ * coute ainsi que 2 ou 3 octets de plus que les donnees.
+ *
+ * Jerome Collin <jerome.collin@polymtl.ca>
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define CAPTURE_VERSION        1
+#define CAPTURE_ENTETE         16
+#define CAPTURE_ENTETE_BLOC    20
+
+// corps maximal d'un bloc: on ecrit un bloc a la fois, en un seul fwrite
+#define CAPTURE_TAILLE_BLOC    (1 << 16)
+
+// un paquet ne depasse jamais 255 octets, plus 10 octets d'ecart
+#define CAPTURE_MAX_PAQUET     ( 10 + 1 + 255 )
+
+struct Capture
+{
+   FILE *fp;
+   unsigned char bloc[CAPTURE_ENTETE_BLOC + CAPTURE_TAILLE_BLOC];
+   size_t longueur;           // octets deja dans le corps du bloc
+   uint32_t nPaquets;
+   uint64_t tempsBloc;
+   uint64_t tempsPrecedent;
+};
+
+struct LecteurCapture
+{
+   FILE *fp;
+   unsigned char bloc[CAPTURE_TAILLE_BLOC];
+   size_t longueur;
+   size_t position;
+   uint32_t restants;         // paquets restants dans le bloc
+   uint64_t temps;            // temps du dernier paquet lu
+   uint64_t debutMural;       // heure murale du debut, en us
+};
+
+// ecrit l'en-tete du fichier.  Retourne 0 en cas d'erreur d'ecriture.
+int captureOuvrir ( Capture *c, FILE *fp, uint64_t debutMural );
+
+// ajoute un paquet recu au temps us (depuis le debut de la capture)
+void captureAjouter ( Capture *c, uint64_t temps,
+                      const unsigned char *octets, int n );
+
+// ecrit le bloc en cours, s'il n'est pas vide
+void captureVider ( Capture *c );
+
+// lit et verifie l'en-tete du fichier.  Retourne 0 si ce n'est pas
+// une capture.
+int captureLireEntete ( LecteurCapture *l, FILE *fp );
+
+// paquet suivant: retourne le nombre d'octets (pointes par *octets,
+// valides jusqu'au prochain appel) et leur temps, -1 a la fin du
+// fichier et -2 si la capture est corrompue.
+int captureLirePaquet ( LecteurCapture *l, uint64_t *temps,
+                        const unsigned char **octets );
+
+#endif /* _CAPTURE_H_ */
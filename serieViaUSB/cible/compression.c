@@ -0,0 +1,166 @@
+/*
+ * compression.c - compression des envois de serieViaUSB -z
+ *
+ * Autor..........: Jerome Collin (jerome.collin@polymtl.ca)
+ * Description....: voir compression.h
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ */
+
+#include "compression.h"
+
+/* etats du decodage */
+#define JETON           0
+#define LITTERAL        1
+#define DISTANCE        2
+
+#if COMPRESSION_FENETRE != 256
+    #error "m_position compte modulo 256: COMPRESSION_FENETRE doit etre 256"
+#endif
+
+static void sortir( struct Decompression *d, uint8_t octet )
+{
+    d->m_historique[d->m_position++] = octet;
+    d->m_sortie(d->m_contexte, octet);
+}
+
+void decompression_init( struct Decompression *d,
+                         DecompressionSortie sortie, void *contexte )
+{
+    d->m_position = 0;
+    d->m_etat = JETON;
+    d->m_reste = 0;
+    d->m_sortie = sortie;
+    d->m_contexte = contexte;
+}
+
+/*
+ * decompression_recevoir_octet : traiter un octet du flot compresse
+ * Arguments:
+ *      struct Decompression *d     - l'etat du decodage
+ *      uint8_t octet               - l'octet recu
+ * Les octets decompresses sortent par m_sortie, au plus
+ * COMPRESSION_MAX a la fois.
+ */
+void decompression_recevoir_octet( struct Decompression *d, uint8_t octet )
+{
+    uint8_t source;
+
+    switch (d->m_etat)
+    {
+    case JETON:
+        if (octet < 0x80)
+        {
+            d->m_reste = octet + 1;
+            d->m_etat = LITTERAL;
+        }
+        else
+        {
+            d->m_reste = (octet & 0x7F) + COMPRESSION_MIN;
+            d->m_etat = DISTANCE;
+        }
+        break;
+
+    case LITTERAL:
+        sortir(d, octet);
+        if (--d->m_reste == 0)
+            d->m_etat = JETON;
+        break;
+
+    case DISTANCE:
+        /* octet + 1 en arriere; l'addition deborde au besoin modulo 256 */
+        source = d->m_position - octet - 1;
+        while (d->m_reste > 0)
+        {
+            sortir(d, d->m_historique[source++]);
+            d->m_reste--;
+        }
+        d->m_etat = JETON;
+        break;
+    }
+}
+
+static size_t litteraux( const uint8_t *source, size_t n,
+                         uint8_t *destination )
+{
+    size_t i;
+
+    destination[0] = n - 1;
+    for (i = 0; i < n; i++)
+        destination[i + 1] = source[i];
+    return n + 1;
+}
+
+/*
+ * compression_compresser : compression gloutonne, la plus longue copie
+ *                          (la plus proche a longueur egale) a chaque
+ *                          position.  Les fichiers de progmem font
+ *                          quelques Ko: une recherche directe dans les
+ *                          256 derniers octets suffit.
+ * Arguments:
+ *      const uint8_t *source       - les octets a compresser
+ *      size_t n                    - leur nombre
+ *      uint8_t *destination        - au moins COMPRESSION_BORNE(n) octets
+ * Retourne:
+ *      size_t                      - la taille du flot compresse
+ */
+size_t compression_compresser( const uint8_t *source, size_t n,
+                               uint8_t *destination )
+{
+    size_t i = 0;
+    size_t debut = 0;           /* premier litteral pas encore ecrit */
+    size_t m = 0;
+    size_t distance, maximum, longueur, meilleure, meilleureDistance;
+
+    while (i < n)
+    {
+        maximum = n - i;
+        if (maximum > COMPRESSION_MAX)
+            maximum = COMPRESSION_MAX;
+
+        meilleure = 0;
+        meilleureDistance = 0;
+        for (distance = 1; distance <= COMPRESSION_FENETRE && distance <= i;
+             distance++)
+        {
+            /* ne comparer au complet que si la copie peut etre plus
+               longue que la meilleure jusqu'ici (meilleure < maximum,
+               la recherche s'arrete sinon) */
+            if (source[i - distance + meilleure] != source[i + meilleure])
+                continue;
+            longueur = 0;
+            while (longueur < maximum &&
+                   source[i - distance + longueur] == source[i + longueur])
+                longueur++;
+            if (longueur > meilleure)
+            {
+                meilleure = longueur;
+                meilleureDistance = distance;
+                if (meilleure == maximum)
+                    break;
+            }
+        }
+
+        if (meilleure >= COMPRESSION_MIN)
+        {
+            if (i > debut)
+                m += litteraux(source + debut, i - debut, destination + m);
+            destination[m++] = 0x80 | (meilleure - COMPRESSION_MIN);
+            destination[m++] = meilleureDistance - 1;
+            i += meilleure;
+            debut = i;
+        }
+        else
+        {
+            i++;
+            if (i - debut == COMPRESSION_LITTERAUX)
+            {
+                m += litteraux(source + debut, i - debut, destination + m);
+                debut = i;
+            }
+        }
+    }
+    if (i > debut)
+        m += litteraux(source + debut, i - debut, destination + m);
+
+    return m;
+}
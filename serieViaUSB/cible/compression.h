@@ -0,0 +1,78 @@
+/*
+ * compression.h - compression des envois de serieViaUSB -z
+ *
+ * Autor..........: Jerome Collin (jerome.collin@polymtl.ca)
+ * Description....: compression de type LZ77 a jetons alignes sur les
+ *                  octets, pour les fichiers de progmem qui repetent
+ *                  sans cesse les memes paires instruction/operande.
+ *                  serieViaUSB compresse le fichier; la carte le
+ *                  decompresse au vol, un octet serie a la fois.
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ *
+ * Le flot est une suite de jetons:
+ *   0x00 a 0x7F : jeton + 1 octets suivent, tels quels (1 a 128)
+ *   0x80 a 0xFF : copie de (jeton & 0x7F) + COMPRESSION_MIN octets
+ *                 (3 a 130) deja sortis; l'octet suivant est la
+ *                 distance moins 1 (1 a 256 octets en arriere)
+ * Une copie peut chevaucher ce qu'elle produit (distance < longueur),
+ * ce qui donne les repetitions.  Il n'y a pas de fin de flot: la carte
+ * sait combien d'octets attendre par les deux premiers octets du
+ * fichier de progmem, une fois decompresses.
+ *
+ * Sur la carte:
+ *   - decompression_init() avec une fonction qui recoit chaque octet
+ *     decompresse (pour l'ecrire en memoire externe, par exemple);
+ *   - decompression_recevoir_octet() pour chaque octet lu de l'UART.
+ * En RAM: COMPRESSION_FENETRE + 8 octets environ, 264 octets.
+ */
+
+#ifndef __compression_h_included__
+#define __compression_h_included__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* fait partie du format: la distance tient dans un octet */
+#define COMPRESSION_FENETRE     256
+
+#define COMPRESSION_MIN         3
+#define COMPRESSION_MAX         ( 0x7F + COMPRESSION_MIN )
+#define COMPRESSION_LITTERAUX   128
+
+/* taille maximale du flot compresse pour n octets */
+#define COMPRESSION_BORNE(n)    ( (n) + (n) / COMPRESSION_LITTERAUX + 1 )
+
+/* recoit un octet decompresse */
+typedef void (*DecompressionSortie)( void *contexte, uint8_t octet );
+
+struct Decompression
+{
+    uint8_t m_historique[COMPRESSION_FENETRE];
+    uint8_t m_position;         /* avance modulo 256 avec le uint8_t */
+    uint8_t m_etat;
+    uint8_t m_reste;            /* litteraux ou octets de copie restants */
+
+    DecompressionSortie m_sortie;
+    void *m_contexte;
+};
+
+void decompression_init( struct Decompression *d,
+                         DecompressionSortie sortie, void *contexte );
+
+void decompression_recevoir_octet( struct Decompression *d, uint8_t octet );
+
+/* seulement sur le PC: compresse n octets dans destination, qui doit
+   avoir au moins COMPRESSION_BORNE(n) octets.  Retourne la taille
+   compressee. */
+size_t compression_compresser( const uint8_t *source, size_t n,
+                               uint8_t *destination );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __compression_h_included__ */
@@ -0,0 +1,292 @@
+/*
+ * trame.c - protocole de trames pour serieViaUSB -P
+ *
+ * Autor..........: Jerome Collin (jerome.collin@polymtl.ca)
+ * Description....: voir trame.h
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ */
+
+#include <string.h>
+#include "trame.h"
+
+/* etats du decodage */
+#define HORS_TRAME      0
+#define DANS_TRAME      1
+#define ECHAPPEMENT     2
+
+/* plus de numeros possibles que de trames dans la fenetre: un numero
+   hors de [m_base, m_prochaine] ne peut pas etre confondu */
+#if TRAME_FENETRE > 127
+    #error "TRAME_FENETRE doit etre au plus 127"
+#endif
+
+/*
+ * trame_crc : ajouter un octet au CRC-16 (polynome 0x1021 reflechi,
+ *             meme calcul que _crc_ccitt_update d'avr-libc)
+ * Arguments:
+ *      uint16_t crc        - le CRC jusqu'ici, 0xFFFF au depart
+ *      uint8_t octet       - l'octet a ajouter
+ * Retourne:
+ *      uint16_t            - le nouveau CRC
+ */
+uint16_t trame_crc( uint16_t crc, uint8_t octet )
+{
+    uint8_t i;
+
+    crc ^= octet;
+    for (i = 0; i < 8; i++)
+    {
+        if (crc & 1)
+            crc = (crc >> 1) ^ 0x8408;
+        else
+            crc >>= 1;
+    }
+    return crc;
+}
+
+static void envoyer_octet( struct Trame *trame, uint8_t octet )
+{
+    if (octet == TRAME_DRAPEAU || octet == TRAME_ECHAPPEMENT)
+    {
+        trame->m_envoyer(trame->m_contexte, TRAME_ECHAPPEMENT);
+        octet ^= 0x20;
+    }
+    trame->m_envoyer(trame->m_contexte, octet);
+}
+
+static void envoyer_trame( struct Trame *trame, uint8_t type,
+                           uint8_t numero, const uint8_t *donnees,
+                           uint8_t n )
+{
+    uint16_t crc = 0xFFFF;
+    uint8_t i;
+
+    trame->m_envoyer(trame->m_contexte, TRAME_DRAPEAU);
+
+    crc = trame_crc(crc, type);
+    envoyer_octet(trame, type);
+    crc = trame_crc(crc, numero);
+    envoyer_octet(trame, numero);
+    crc = trame_crc(crc, n);
+    envoyer_octet(trame, n);
+    for (i = 0; i < n; i++)
+    {
+        crc = trame_crc(crc, donnees[i]);
+        envoyer_octet(trame, donnees[i]);
+    }
+    envoyer_octet(trame, crc & 0xFF);
+    envoyer_octet(trame, crc >> 8);
+
+    trame->m_envoyer(trame->m_contexte, TRAME_DRAPEAU);
+}
+
+/* un seul NAK par trame attendue: les trames suivantes de la meme
+   fenetre arrivent toutes hors d'ordre et renverraient chacune toute la
+   fenetre.  Si ce NAK se perd, le delai de l'autre bout prend le relais. */
+static void demander( struct Trame *trame )
+{
+    if (!trame->m_nak)
+    {
+        envoyer_trame(trame, TRAME_NAK, trame->m_attendue, 0, 0);
+        trame->m_nak = 1;
+    }
+}
+
+/* renvoie toutes les trames non confirmees (Go-Back-N) */
+static void retransmettre( struct Trame *trame )
+{
+    uint8_t numero;
+    uint8_t k;
+
+    for (numero = trame->m_base; numero != trame->m_prochaine; numero++)
+    {
+        k = numero % TRAME_FENETRE;
+        envoyer_trame(trame, TRAME_DONNEES, numero,
+                      trame->m_donnees[k], trame->m_longueurs[k]);
+        if (trame->m_retransmissions != 0xFFFF)
+            trame->m_retransmissions++;
+    }
+    trame->m_attente = 0;
+}
+
+/* l'autre bout attend la trame numero: les precedentes sont confirmees */
+static void confirmer( struct Trame *trame, uint8_t numero )
+{
+    /* seulement un numero entre m_base et m_prochaine, sinon c'est
+       un vieux ACK */
+    if ((uint8_t)(numero - trame->m_base) <=
+        (uint8_t)(trame->m_prochaine - trame->m_base))
+    {
+        if (numero != trame->m_base)
+            trame->m_attente = 0;
+        trame->m_base = numero;
+    }
+}
+
+static void traiter_trame( struct Trame *trame )
+{
+    uint8_t *t = trame->m_recu;
+    uint8_t n = trame->m_nRecu;
+    uint16_t crc = 0xFFFF;
+    uint8_t i;
+
+    if (n < TRAME_ENTETE || t[2] != n - TRAME_ENTETE)
+    {
+        if (n > 0 && trame->m_erreurs != 0xFFFF)
+            trame->m_erreurs++;
+        return;
+    }
+    for (i = 0; i < n - 2; i++)
+        crc = trame_crc(crc, t[i]);
+    if (t[n - 2] != (crc & 0xFF) || t[n - 1] != (crc >> 8))
+    {
+        /* on ne peut pas croire le numero: redemander l'attendue */
+        if (trame->m_erreurs != 0xFFFF)
+            trame->m_erreurs++;
+        demander(trame);
+        return;
+    }
+
+    switch (t[0])
+    {
+    case TRAME_DONNEES:
+        if (t[1] == trame->m_attendue)
+        {
+            if (trame->m_livrer(trame->m_contexte, t + 3, t[2]))
+            {
+                trame->m_attendue++;
+                trame->m_nak = 0;
+            }
+            envoyer_trame(trame, TRAME_ACK, trame->m_attendue, 0, 0);
+        }
+        else if ((uint8_t)(t[1] - trame->m_attendue) < 128)
+        {
+            /* une trame manque avant celle-ci */
+            demander(trame);
+        }
+        else
+        {
+            /* deja recue: notre ACK s'est perdu */
+            envoyer_trame(trame, TRAME_ACK, trame->m_attendue, 0, 0);
+        }
+        break;
+
+    case TRAME_ACK:
+        confirmer(trame, t[1]);
+        break;
+
+    case TRAME_NAK:
+        confirmer(trame, t[1]);
+        retransmettre(trame);
+        break;
+    }
+}
+
+/*
+ * trame_init : initialiser un bout de la liaison
+ * Arguments:
+ *      struct Trame *trame         - l'etat du protocole
+ *      TrameEnvoyerOctet envoyer   - ecrit un octet sur la liaison
+ *      TrameLivrer livrer          - recoit les donnees en ordre
+ *      void *contexte              - passe tel quel a envoyer et livrer
+ */
+void trame_init( struct Trame *trame, TrameEnvoyerOctet envoyer,
+                 TrameLivrer livrer, void *contexte )
+{
+    memset(trame, 0, sizeof(struct Trame));
+    trame->m_delai = TRAME_DELAI;
+    trame->m_envoyer = envoyer;
+    trame->m_livrer = livrer;
+    trame->m_contexte = contexte;
+}
+
+/*
+ * trame_libre : nombre de trames qui peuvent partir sans attendre de ACK
+ */
+uint8_t trame_libre( const struct Trame *trame )
+{
+    return TRAME_FENETRE - (uint8_t)(trame->m_prochaine - trame->m_base);
+}
+
+/*
+ * trame_envoyer : envoyer des donnees dans une nouvelle trame
+ * Arguments:
+ *      struct Trame *trame     - l'etat du protocole
+ *      const uint8_t *donnees  - les donnees, copiees jusqu'au ACK
+ *      uint8_t n               - au plus TRAME_MAX_DONNEES
+ * Retourne:
+ *      uint8_t
+ *          1                   - Succes
+ *          0                   - Échec, fenetre pleine ou n trop grand
+ */
+uint8_t trame_envoyer( struct Trame *trame, const uint8_t *donnees,
+                       uint8_t n )
+{
+    uint8_t k = trame->m_prochaine % TRAME_FENETRE;
+
+    if (trame_libre(trame) == 0 || n > TRAME_MAX_DONNEES)
+        return 0;
+
+    if (trame->m_base == trame->m_prochaine)
+        trame->m_attente = 0;
+    memcpy(trame->m_donnees[k], donnees, n);
+    trame->m_longueurs[k] = n;
+    envoyer_trame(trame, TRAME_DONNEES, trame->m_prochaine, donnees, n);
+    trame->m_prochaine++;
+    return 1;
+}
+
+/*
+ * trame_recevoir_octet : traiter un octet recu de la liaison
+ */
+void trame_recevoir_octet( struct Trame *trame, uint8_t octet )
+{
+    if (octet == TRAME_DRAPEAU)
+    {
+        if (trame->m_etat != HORS_TRAME)
+            traiter_trame(trame);
+        trame->m_nRecu = 0;
+        trame->m_etat = DANS_TRAME;
+        return;
+    }
+
+    if (trame->m_etat == HORS_TRAME)
+        return;
+
+    if (octet == TRAME_ECHAPPEMENT)
+    {
+        trame->m_etat = ECHAPPEMENT;
+        return;
+    }
+    if (trame->m_etat == ECHAPPEMENT)
+    {
+        octet ^= 0x20;
+        trame->m_etat = DANS_TRAME;
+    }
+
+    /* trop long: ignorer le reste jusqu'au prochain drapeau */
+    if (trame->m_nRecu == sizeof(trame->m_recu))
+    {
+        trame->m_etat = HORS_TRAME;
+        if (trame->m_erreurs != 0xFFFF)
+            trame->m_erreurs++;
+        return;
+    }
+    trame->m_recu[trame->m_nRecu++] = octet;
+}
+
+/*
+ * trame_tic : faire avancer le temps pour les retransmissions
+ * Arguments:
+ *      struct Trame *trame     - l'etat du protocole
+ *      uint16_t ms             - temps ecoule depuis l'appel precedent
+ */
+void trame_tic( struct Trame *trame, uint16_t ms )
+{
+    if (trame->m_base == trame->m_prochaine)
+        return;
+
+    trame->m_attente += ms;
+    if (trame->m_attente >= trame->m_delai)
+        retransmettre(trame);
+}
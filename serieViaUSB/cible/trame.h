@@ -0,0 +1,117 @@
+/*
+ * trame.h - protocole de trames pour serieViaUSB -P
+ *
+ * Autor..........: Jerome Collin (jerome.collin@polymtl.ca)
+ * Description....: trames numerotees et verifiees par CRC-16, avec
+ *                  ACK/NAK et retransmission Go-Back-N, pour la liaison
+ *                  serie entre la carte et le PC a travers le USBasp.
+ *                  Le meme code tourne sur la carte (AVR) et dans
+ *                  serieViaUSB.
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ *
+ * Sur la carte:
+ *   - trame_init() avec une fonction qui ecrit un octet sur l'UART et
+ *     une fonction qui recoit les donnees, dans l'ordre et sans double;
+ *   - trame_recevoir_octet() pour chaque octet lu de l'UART;
+ *   - trame_tic() regulierement (par exemple a chaque ms) avec le
+ *     temps ecoule, pour les retransmissions;
+ *   - trame_envoyer() pour envoyer des donnees au PC.
+ *
+ * Une trame est delimitee par TRAME_DRAPEAU et contient, avec
+ * echappement HDLC (TRAME_ECHAPPEMENT puis l'octet ^ 0x20):
+ *   type, numero, longueur, donnees..., CRC-16 (octet bas, octet haut)
+ * Pour un ACK ou un NAK, le numero est celui de la prochaine trame
+ * attendue et il n'y a pas de donnees.
+ *
+ * En RAM: environ TRAME_FENETRE * (TRAME_MAX_DONNEES + 1) + 
+ * TRAME_MAX_DONNEES + 20 octets, 100 octets avec les valeurs par defaut.
+ */
+
+#ifndef __trame_h_included__
+#define __trame_h_included__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* donnees par trame et trames envoyees sans attendre de ACK; a
+   ajuster a la RAM de la carte, les deux bouts n'ont pas besoin des
+   memes valeurs */
+#ifndef TRAME_MAX_DONNEES
+    #define TRAME_MAX_DONNEES   32
+#endif
+
+#ifndef TRAME_FENETRE
+    #define TRAME_FENETRE       2
+#endif
+
+/* delai de retransmission par defaut, en ms */
+#ifndef TRAME_DELAI
+    #define TRAME_DELAI         100
+#endif
+
+#define TRAME_DRAPEAU       0x7E
+#define TRAME_ECHAPPEMENT   0x7D
+
+#define TRAME_DONNEES       0x01
+#define TRAME_ACK           0x02
+#define TRAME_NAK           0x03
+
+/* type, numero, longueur et CRC */
+#define TRAME_ENTETE        5
+
+/* ecrit un octet sur la liaison serie */
+typedef void (*TrameEnvoyerOctet)( void *contexte, uint8_t octet );
+
+/* donnees recues en ordre.  Retourne 0 si elles ne peuvent pas etre
+   prises maintenant: la trame n'est pas confirmee et reviendra. */
+typedef uint8_t (*TrameLivrer)( void *contexte, const uint8_t *donnees,
+                                uint8_t n );
+
+struct Trame
+{
+    /* emission */
+    uint8_t m_base;             /* plus ancienne trame non confirmee */
+    uint8_t m_prochaine;        /* numero de la prochaine nouvelle trame */
+    uint8_t m_donnees[TRAME_FENETRE][TRAME_MAX_DONNEES];
+    uint8_t m_longueurs[TRAME_FENETRE];
+    uint16_t m_attente;         /* ms depuis le dernier envoi ou ACK */
+    uint16_t m_delai;
+
+    /* reception */
+    uint8_t m_attendue;
+    uint8_t m_recu[TRAME_MAX_DONNEES + TRAME_ENTETE];
+    uint8_t m_nRecu;
+    uint8_t m_etat;
+    uint8_t m_nak;              /* NAK deja envoye pour m_attendue */
+
+    TrameEnvoyerOctet m_envoyer;
+    TrameLivrer m_livrer;
+    void *m_contexte;
+
+    /* statistiques, saturees a 0xFFFF */
+    uint16_t m_retransmissions;
+    uint16_t m_erreurs;
+};
+
+void trame_init( struct Trame *trame, TrameEnvoyerOctet envoyer,
+                 TrameLivrer livrer, void *contexte );
+
+uint8_t trame_envoyer( struct Trame *trame, const uint8_t *donnees,
+                       uint8_t n );
+
+uint8_t trame_libre( const struct Trame *trame );
+
+void trame_recevoir_octet( struct Trame *trame, uint8_t octet );
+
+void trame_tic( struct Trame *trame, uint16_t ms );
+
+uint16_t trame_crc( uint16_t crc, uint8_t octet );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __trame_h_included__ */
@@ -0,0 +1,137 @@
+/*
+    essaiDemon: deux clients du demon de serieViaUSB (-D), pour
+                l'essayer avec une carte bavarde simulee (voir
+                transportSimule.cc et make essai-demon).  Le client B
+                se branche et ne lit jamais; le client A lit pendant
+                quelques secondes et verifie que les lignes "simN k"
+                de la carte se suivent sans trou.  Le demon doit
+                deconnecter B sans jamais cesser de servir A.
+
+    Jerome Collin
+    Modifications, essai du demon
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// octets recus par A pendant chaque seconde
+#define MAX_SECONDES  60
+
+int connecter ( const char *chemin )
+{
+  struct sockaddr_un adresse;
+  int s;
+
+  s = socket (AF_UNIX, SOCK_STREAM, 0);
+  memset (&adresse, 0, sizeof (adresse));
+  adresse.sun_family = AF_UNIX;
+  strncpy (adresse.sun_path, chemin, sizeof (adresse.sun_path) - 1);
+  if ( s < 0 ||
+       connect (s, (struct sockaddr *) &adresse, sizeof (adresse)) != 0 ) {
+     fprintf (stderr, "essaiDemon: incapable de joindre %s: %s\n",
+              chemin, strerror (errno));
+     exit (-1);
+  }
+  return s;
+}
+
+double secondes ( void )
+{
+  struct timespec t;
+
+  clock_gettime (CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int main ( int argc, char *argv[] )
+{
+  long parSeconde[MAX_SECONDES];
+  char tampon[4096];
+  char ligne[64];
+  int position = 0;
+  long numero, attendu = -1;
+  long recus = 0, trous = 0, minimum;
+  int duree, a, b, i, n, deconnecte;
+  struct pollfd fd;
+  double debut, t;
+
+  if ( argc < 2 ) {
+     fprintf (stderr, "usage: essaiDemon <socket> [secondes]\n");
+     return -1;
+  }
+  duree = argc > 2 ? atoi (argv[2]) : 8;
+  if ( duree < 2 || duree > MAX_SECONDES ) {
+     fprintf (stderr, "essaiDemon: de 2 a %d secondes\n", MAX_SECONDES);
+     return -1;
+  }
+
+  b = connecter (argv[1]);
+  a = connecter (argv[1]);
+  memset (parSeconde, 0, sizeof (parSeconde));
+
+  debut = secondes ();
+  fd.fd = a;
+  fd.events = POLLIN;
+  while ( ( t = secondes () - debut ) < duree ) {
+     if ( poll (&fd, 1, 100) <= 0 ) {
+        continue;
+     }
+     n = read (a, tampon, sizeof (tampon));
+     if ( n <= 0 ) {
+        fprintf (stderr, "essaiDemon: le demon a ferme le client A\n");
+        return 1;
+     }
+     recus += n;
+     parSeconde[(int) t] += n;
+
+     // la premiere ligne peut arriver coupee: on ne compte qu'apres
+     for ( i = 0; i < n; i++ ) {
+        if ( tampon[i] != '\n' ) {
+           if ( position < (int) sizeof (ligne) - 1 ) {
+              ligne[position++] = tampon[i];
+           }
+           continue;
+        }
+        ligne[position] = '\0';
+        position = 0;
+        if ( sscanf (ligne, "%*s %ld", &numero) != 1 ) {
+           continue;
+        }
+        if ( attendu >= 0 && numero != attendu ) {
+           trous++;
+        }
+        attendu = numero + 1;
+     }
+  }
+
+  // la derniere seconde peut etre entamee: on ne la compte pas
+  minimum = parSeconde[0];
+  for ( i = 1; i < duree - 1; i++ ) {
+     if ( parSeconde[i] < minimum ) {
+        minimum = parSeconde[i];
+     }
+  }
+
+  // B n'a rien lu: ce qui reste dans son socket, puis la fin si le
+  // demon l'a deconnecte
+  do {
+     n = recv (b, tampon, sizeof (tampon), MSG_DONTWAIT);
+  } while ( n > 0 );
+  deconnecte = n == 0 || errno != EAGAIN;
+
+  printf ("essaiDemon: A a recu %ld octets en %d s (au moins %ld par "
+          "seconde), %ld trous; B est %s\n", recus, duree, minimum, trous,
+          deconnecte ? "deconnecte" : "encore branche");
+
+  close (a);
+  close (b);
+  return ( minimum > 0 && trous == 0 && deconnecte ) ? 0 : 1;
+}
@@ -0,0 +1,105 @@
+/*
+    formatage: affichage des octets en HEX, DEC, BIN ou tels quels a
+               l'aide de tables precalculees.  Le texte produit est
+               identique a celui des anciens fprintf par octet.
+
+    Jerome Collin
+    Modifications, formatage par tables
+
+*/
+
+#include <string.h>
+#include <limits.h>
+#include <formatage.h>
+
+// nombre d'octets formates a la fois par afficherOctets
+#define FORMATAGE_BLOC  1024
+
+static ModesAffichage modeFormatage = BYTE;
+static int sautsFormatage = 0;
+
+static char tableTexte[256][FORMATAGE_MAX_OCTET];
+static unsigned char tableLongueur[256];
+
+void formatageInit ( ModesAffichage mode, int nbSauts )
+{
+   int c, i;
+
+   modeFormatage = mode;
+   sautsFormatage = nbSauts > 0 ? nbSauts : 0;
+
+   for ( c = 0; c < 256; c++ ) {
+      switch( mode )
+      {
+          case HEX:
+              tableLongueur[c] = snprintf (tableTexte[c], FORMATAGE_MAX_OCTET,
+                                           "%#04x ", c);
+              break;
+
+          case DEC:
+              tableLongueur[c] = snprintf (tableTexte[c], FORMATAGE_MAX_OCTET,
+                                           "%#04d ", c);
+              break;
+
+          case BIN:
+              // le bit le plus significatif en premier
+              for ( i = 0; i < CHAR_BIT; i++ ) {
+                 tableTexte[c][i] = ( ( c >> ( CHAR_BIT - 1 - i ) ) & 1 ) + '0';
+              }
+              tableTexte[c][CHAR_BIT] = ' ';
+              tableLongueur[c] = CHAR_BIT + 1;
+              break;
+
+          case BYTE:
+          default:
+              tableTexte[c][0] = c;
+              tableLongueur[c] = 1;
+      }
+   }
+}
+
+size_t formaterOctets ( const unsigned char *octets, int n, int position,
+                        char *texte )
+{
+   char *p = texte;
+   int restant;
+   int j;
+
+   // cas le plus frequent: les octets bruts, sans saut de ligne
+   if ( modeFormatage == BYTE && sautsFormatage == 0 ) {
+      memcpy (texte, octets, n);
+      return n;
+   }
+
+   // octets restants avant le prochain saut de ligne
+   restant = sautsFormatage ? sautsFormatage - position % sautsFormatage
+                            : INT_MAX;
+
+   for ( j = 0; j < n; j++ ) {
+      // copie de taille fixe, plus rapide qu'une copie de longueur
+      // variable; seuls les tableLongueur premiers caracteres comptent
+      memcpy (p, tableTexte[octets[j]], FORMATAGE_MAX_OCTET);
+      p += tableLongueur[octets[j]];
+      if ( --restant == 0 ) {
+         *p++ = '\n';
+         restant = sautsFormatage;
+      }
+   }
+
+   return p - texte;
+}
+
+void afficherOctets ( FILE *fp, const unsigned char *octets, int n,
+                      int position )
+{
+   char texte[FORMATAGE_BLOC * FORMATAGE_MAX_OCTET];
+   int m;
+
+   while ( n > 0 ) {
+      m = n < FORMATAGE_BLOC ? n : FORMATAGE_BLOC;
+      fwrite (texte, 1, formaterOctets (octets, m, position, texte), fp);
+      octets += m;
+      position += m;
+      n -= m;
+   }
+}
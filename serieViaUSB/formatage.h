@@ -0,0 +1,38 @@
+
+#ifndef _FORMATAGE_H_
+#define _FORMATAGE_H_
+
+/*
+ * Formatage des octets recus ou envoyes selon le mode d'affichage.
+ * Le texte de chacun des 256 octets possibles est calcule une seule
+ * fois; un bloc complet est ensuite formate dans un tampon et ecrit
+ * avec un seul fwrite, plutot qu'avec un fprintf par octet.
+ *
+ * Jerome Collin <jerome.collin@polymtl.ca>
+ *
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+
+enum ModesAffichage{BYTE, HEX, DEC, BIN};
+
+// place reservee a chaque octet dans les tables et dans le tampon de
+// formaterOctets (au plus 9 caracteres en binaire et un saut de ligne)
+#define FORMATAGE_MAX_OCTET  16
+
+// calcule les tables pour le mode d'affichage choisi, avec un saut
+// de ligne a chaque nbSauts octets (0 pour aucun)
+void formatageInit ( ModesAffichage mode, int nbSauts );
+
+// formate n octets dans texte, qui doit pouvoir contenir
+// n * FORMATAGE_MAX_OCTET caracteres.  position est le nombre d'octets
+// deja affiches avant ce bloc.  Retourne la longueur du texte.
+size_t formaterOctets ( const unsigned char *octets, int n, int position,
+                        char *texte );
+
+// formate et ecrit un bloc d'octets
+void afficherOctets ( FILE *fp, const unsigned char *octets, int n,
+                      int position );
+
+#endif /* _FORMATAGE_H_ */
@@ -0,0 +1,347 @@
+/*
+    libusbSimule: libusb-1.0 simulee, pour essayer transportUSB.cc
+                  sans materiel (make libusb-simule).  Compile avec
+                  -I libusbSimule, transportUSB.cc voit les
+                  programmeurs de transportSimule.cc comme des
+                  peripheriques USB: les requetes de controle leur
+                  sont passees telles quelles, et les transferts
+                  asynchrones restent en vol jusqu'au prochain
+                  libusb_handle_events_timeout_completed(), qui les
+                  termine dans l'ordre ou ils ont ete soumis.  Un
+                  READSER se termine toujours, meme sans octet; une
+                  lecture du point d'acces interrupt-in attend que la
+                  carte ait quelque chose, comme sur le vrai bus.
+
+                  A la sortie, un bilan des transferts asynchrones
+                  sur stderr:
+
+                  libusb simule: 812 transferts termines, 808 resoumis
+                  par leur rappel, au plus 4 en vol, 0 encore en vol,
+                  0 faute
+
+                  Une faute est un transfert soumis alors qu'il etait
+                  deja en vol; liberer un transfert en vol arrete le
+                  programme.  make essai-libusb verifie le bilan.
+
+    Jerome Collin
+    Modifications, libusb simulee
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <libusb.h>
+
+// le programmeur simule, sous d'autres noms: transportUSB.cc, qu'on
+// essaie, definit les siens
+#define usbLister               simuleLister
+#define usbOuvrir               simuleOuvrir
+#define usbOuvrirTous           simuleOuvrirTous
+#define usbNom                  simuleNom
+#define usbFermer               simuleFermer
+#define usbErreur               simuleErreur
+#define usbControle             simuleControle
+#define usbReserverInterface    simuleReserverInterface
+#define usbDemarrerLecture      simuleDemarrerLecture
+#define usbArreterLecture       simuleArreterLecture
+#define usbErreurLecture        simuleErreurLecture
+#define usbEvenements           simuleEvenements
+
+#include "transportSimule.cc"
+
+// numero du descripteur de chaine du numero de serie
+#define INDEX_SERIE  3
+
+// plus que ce que transportUSB.cc peut avoir en vol (MAX_TRANSFERTS)
+// pour toutes les cartes
+#define MAX_EN_VOL  ( 16 * MAX_SIMULES )
+
+struct libusb_context
+{
+   int bilan;
+};
+
+struct libusb_device
+{
+   int adresse;
+};
+
+struct libusb_device_handle
+{
+   PeripheriqueUSB *p;
+};
+
+// libusb_alloc_transfer() retourne le premier champ
+struct TransfertSimule
+{
+   libusb_transfer t;
+   int enVol;
+   int annule;
+   int dansRappel;
+};
+
+static libusb_context contexte;
+static libusb_device peripheriques[MAX_SIMULES];
+
+// transferts soumis, dans l'ordre
+static TransfertSimule *file[MAX_EN_VOL];
+static int nFile = 0;
+static pthread_mutex_t verrouFile = PTHREAD_MUTEX_INITIALIZER;
+
+// pour le bilan
+static int enVol = 0;
+static int enVolMax = 0;
+static long termines = 0;
+static long resoumis = 0;
+static int fautes = 0;
+
+static void bilan ( void )
+{
+  fprintf (stderr, "libusb simule: %ld transferts termines, %ld resoumis "
+           "par leur rappel, au plus %d en vol, %d encore en vol, "
+           "%d faute%s\n", termines, resoumis, enVolMax, enVol,
+           fautes, fautes > 1 ? "s" : "");
+}
+
+int libusb_init ( libusb_context **ctx )
+{
+  if ( ! contexte.bilan ) {
+    contexte.bilan = 1;
+    atexit (bilan);
+  }
+  *ctx = &contexte;
+  return 0;
+}
+
+ssize_t libusb_get_device_list ( libusb_context *, libusb_device ***liste )
+{
+  int k, n = nombreSimules ();
+
+  *liste = (libusb_device **) calloc (n + 1, sizeof (libusb_device *));
+  for ( k = 0; k < n; k++ ) {
+    peripheriques[k].adresse = k + 1;
+    (*liste)[k] = &peripheriques[k];
+  }
+  return n;
+}
+
+void libusb_free_device_list ( libusb_device **liste, int )
+{
+  free (liste);
+}
+
+int libusb_get_device_descriptor ( libusb_device *,
+                                   struct libusb_device_descriptor *desc )
+{
+  desc->idVendor = USBDEV_VENDOR;
+  desc->idProduct = USBDEV_PRODUCT;
+  desc->iSerialNumber = INDEX_SERIE;
+  return 0;
+}
+
+uint8_t libusb_get_bus_number ( libusb_device * )
+{
+  return 1;
+}
+
+uint8_t libusb_get_device_address ( libusb_device *dev )
+{
+  return dev->adresse;
+}
+
+int libusb_open ( libusb_device *dev, libusb_device_handle **gestion )
+{
+  char selection[16];
+  PeripheriqueUSB *p;
+
+  snprintf (selection, sizeof (selection), "1:%d", dev->adresse);
+  p = simuleOuvrir (selection);
+  if ( p == NULL )
+    return LIBUSB_ERROR_ACCESS;
+  *gestion = (libusb_device_handle *) calloc (1, sizeof (libusb_device_handle));
+  (*gestion)->p = p;
+  return 0;
+}
+
+void libusb_close ( libusb_device_handle *gestion )
+{
+  simuleFermer (gestion->p);
+  free (gestion);
+}
+
+int libusb_get_string_descriptor_ascii ( libusb_device_handle *gestion,
+                                         uint8_t index,
+                                         unsigned char *data, int longueur )
+{
+  if ( index != INDEX_SERIE )
+    return LIBUSB_ERROR_INVALID_PARAM;
+  snprintf ((char *) data, longueur, "%s", simuleNom (gestion->p));
+  return strlen ((char *) data);
+}
+
+int libusb_claim_interface ( libusb_device_handle *, int )
+{
+  return 0;
+}
+
+const char *libusb_error_name ( int code )
+{
+  switch ( code ) {
+    case LIBUSB_SUCCESS:             return "LIBUSB_SUCCESS";
+    case LIBUSB_ERROR_IO:            return "LIBUSB_ERROR_IO";
+    case LIBUSB_ERROR_INVALID_PARAM: return "LIBUSB_ERROR_INVALID_PARAM";
+    case LIBUSB_ERROR_ACCESS:        return "LIBUSB_ERROR_ACCESS";
+    case LIBUSB_ERROR_NO_DEVICE:     return "LIBUSB_ERROR_NO_DEVICE";
+    case LIBUSB_ERROR_NOT_FOUND:     return "LIBUSB_ERROR_NOT_FOUND";
+    case LIBUSB_ERROR_BUSY:          return "LIBUSB_ERROR_BUSY";
+    case LIBUSB_ERROR_TIMEOUT:       return "LIBUSB_ERROR_TIMEOUT";
+    case LIBUSB_ERROR_NO_MEM:        return "LIBUSB_ERROR_NO_MEM";
+    default:                         return "LIBUSB_ERROR_OTHER";
+  }
+}
+
+int libusb_control_transfer ( libusb_device_handle *gestion,
+                              uint8_t bmRequestType, uint8_t bRequest,
+                              uint16_t wValue, uint16_t wIndex,
+                              unsigned char *data, uint16_t wLength,
+                              unsigned int )
+{
+  return simuleControle (gestion->p, bmRequestType & LIBUSB_ENDPOINT_IN,
+                         bRequest, wValue, wIndex, data, wLength);
+}
+
+struct libusb_transfer *libusb_alloc_transfer ( int )
+{
+  TransfertSimule *s;
+
+  s = (TransfertSimule *) calloc (1, sizeof (TransfertSimule));
+  return &s->t;
+}
+
+void libusb_free_transfer ( struct libusb_transfer *t )
+{
+  TransfertSimule *s = (TransfertSimule *) t;
+
+  if ( s->enVol ) {
+    fprintf (stderr, "Erreur: libusb simule: transfert libere en vol\n");
+    exit (-1);
+  }
+  free (s);
+}
+
+int libusb_submit_transfer ( struct libusb_transfer *t )
+{
+  TransfertSimule *s = (TransfertSimule *) t;
+
+  pthread_mutex_lock (&verrouFile);
+  if ( s->enVol || nFile == MAX_EN_VOL ) {
+    if ( s->enVol )
+      fautes++;
+    pthread_mutex_unlock (&verrouFile);
+    return s->enVol ? LIBUSB_ERROR_BUSY : LIBUSB_ERROR_NO_MEM;
+  }
+  s->enVol = 1;
+  s->annule = 0;
+  file[nFile++] = s;
+  if ( ++enVol > enVolMax )
+    enVolMax = enVol;
+  // seul le fil qui execute le rappel voit dansRappel
+  if ( s->dansRappel )
+    resoumis++;
+  pthread_mutex_unlock (&verrouFile);
+  return 0;
+}
+
+int libusb_cancel_transfer ( struct libusb_transfer *t )
+{
+  TransfertSimule *s = (TransfertSimule *) t;
+  int rtn = 0;
+
+  pthread_mutex_lock (&verrouFile);
+  if ( s->enVol )
+    s->annule = 1;
+  else
+    rtn = LIBUSB_ERROR_NOT_FOUND;
+  pthread_mutex_unlock (&verrouFile);
+  return rtn;
+}
+
+// termine un transfert en vol; 0 si une lecture interrupt-in doit
+// encore attendre
+static int terminer ( TransfertSimule *s )
+{
+  libusb_transfer *t = &s->t;
+  PeripheriqueUSB *p = t->dev_handle->p;
+  unsigned char *setup = t->buffer;
+  int n;
+
+  if ( s->annule ) {
+    t->status = LIBUSB_TRANSFER_CANCELLED;
+    t->actual_length = 0;
+    return 1;
+  }
+
+  if ( t->type == LIBUSB_TRANSFER_TYPE_CONTROL ) {
+    n = simuleControle (p, setup[0] & LIBUSB_ENDPOINT_IN, setup[1],
+                        setup[2] | setup[3] << 8, setup[4] | setup[5] << 8,
+                        libusb_control_transfer_get_data (t),
+                        setup[6] | setup[7] << 8);
+    t->status = n < 0 ? LIBUSB_TRANSFER_ERROR : LIBUSB_TRANSFER_COMPLETED;
+    t->actual_length = n < 0 ? 0 : n;
+    return 1;
+  }
+
+  // interrupt-in: les octets bruts de RxFifo, sans entete
+  pthread_mutex_lock (&p->verrou);
+  avancer (p);
+  for ( n = 0; n < t->length && p->rx.n > 0; n++ )
+    t->buffer[n] = fifoRetirer (&p->rx);
+  pthread_mutex_unlock (&p->verrou);
+  if ( n == 0 )
+    return 0;
+  t->status = LIBUSB_TRANSFER_COMPLETED;
+  t->actual_length = n;
+  return 1;
+}
+
+int libusb_handle_events_timeout_completed ( libusb_context *,
+                                             struct timeval *tv,
+                                             int * )
+{
+  struct timespec attente = { 0, 1000000 }; // 1 ms, une trame USB
+  TransfertSimule *prets[MAX_EN_VOL];
+  int i, n;
+
+  if ( tv->tv_sec == 0 && tv->tv_usec < 1000 )
+    attente.tv_nsec = tv->tv_usec * 1000;
+  nanosleep (&attente, NULL);
+
+  // ceux que les rappels resoumettent attendent le prochain appel
+  pthread_mutex_lock (&verrouFile);
+  n = nFile;
+  memcpy (prets, file, n * sizeof (file[0]));
+  nFile = 0;
+  pthread_mutex_unlock (&verrouFile);
+
+  for ( i = 0; i < n; i++ ) {
+    if ( ! terminer (prets[i]) ) {
+      pthread_mutex_lock (&verrouFile);
+      file[nFile++] = prets[i];
+      pthread_mutex_unlock (&verrouFile);
+      continue;
+    }
+    pthread_mutex_lock (&verrouFile);
+    prets[i]->enVol = 0;
+    enVol--;
+    termines++;
+    pthread_mutex_unlock (&verrouFile);
+
+    prets[i]->dansRappel = 1;
+    prets[i]->t.callback (&prets[i]->t);
+    prets[i]->dansRappel = 0;
+  }
+  return 0;
+}
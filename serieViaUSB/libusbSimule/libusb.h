@@ -0,0 +1,162 @@
+#ifndef _LIBUSB_SIMULE_H_
+#define _LIBUSB_SIMULE_H_
+/*
+ * Le sous-ensemble de libusb-1.0 qu'utilise transportUSB.cc, avec les
+ * memes noms et les memes valeurs.  Compile avec -I libusbSimule, ce
+ * fichier remplace <libusb.h>; libusbSimule.cc l'implemente par-dessus
+ * le programmeur simule de transportSimule.cc (make libusb-simule).
+ *
+ * Jerome Collin <jerome.collin@polymtl.ca>
+ *
+ */
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+typedef struct libusb_context libusb_context;
+typedef struct libusb_device libusb_device;
+typedef struct libusb_device_handle libusb_device_handle;
+
+struct libusb_device_descriptor
+{
+   uint16_t idVendor;
+   uint16_t idProduct;
+   uint8_t iSerialNumber;
+};
+
+enum libusb_error
+{
+   LIBUSB_SUCCESS = 0,
+   LIBUSB_ERROR_IO = -1,
+   LIBUSB_ERROR_INVALID_PARAM = -2,
+   LIBUSB_ERROR_ACCESS = -3,
+   LIBUSB_ERROR_NO_DEVICE = -4,
+   LIBUSB_ERROR_NOT_FOUND = -5,
+   LIBUSB_ERROR_BUSY = -6,
+   LIBUSB_ERROR_TIMEOUT = -7,
+   LIBUSB_ERROR_NO_MEM = -11,
+   LIBUSB_ERROR_OTHER = -99
+};
+
+enum libusb_transfer_status
+{
+   LIBUSB_TRANSFER_COMPLETED,
+   LIBUSB_TRANSFER_ERROR,
+   LIBUSB_TRANSFER_TIMED_OUT,
+   LIBUSB_TRANSFER_CANCELLED,
+   LIBUSB_TRANSFER_STALL,
+   LIBUSB_TRANSFER_NO_DEVICE,
+   LIBUSB_TRANSFER_OVERFLOW
+};
+
+#define LIBUSB_TRANSFER_TYPE_CONTROL    0
+#define LIBUSB_TRANSFER_TYPE_INTERRUPT  3
+
+#define LIBUSB_REQUEST_TYPE_VENDOR  ( 0x02 << 5 )
+#define LIBUSB_RECIPIENT_DEVICE     0x00
+#define LIBUSB_ENDPOINT_IN          0x80
+#define LIBUSB_ENDPOINT_OUT         0x00
+
+#define LIBUSB_CONTROL_SETUP_SIZE   8
+
+struct libusb_transfer;
+typedef void (*libusb_transfer_cb_fn)( struct libusb_transfer *t );
+
+struct libusb_transfer
+{
+   libusb_device_handle *dev_handle;
+   uint8_t flags;
+   unsigned char endpoint;
+   unsigned char type;
+   unsigned int timeout;
+   enum libusb_transfer_status status;
+   int length;
+   int actual_length;
+   libusb_transfer_cb_fn callback;
+   void *user_data;
+   unsigned char *buffer;
+};
+
+int libusb_init ( libusb_context **ctx );
+ssize_t libusb_get_device_list ( libusb_context *ctx, libusb_device ***liste );
+void libusb_free_device_list ( libusb_device **liste, int unref );
+int libusb_get_device_descriptor ( libusb_device *dev,
+                                   struct libusb_device_descriptor *desc );
+uint8_t libusb_get_bus_number ( libusb_device *dev );
+uint8_t libusb_get_device_address ( libusb_device *dev );
+int libusb_open ( libusb_device *dev, libusb_device_handle **gestion );
+void libusb_close ( libusb_device_handle *gestion );
+int libusb_get_string_descriptor_ascii ( libusb_device_handle *gestion,
+                                         uint8_t index,
+                                         unsigned char *data, int longueur );
+int libusb_claim_interface ( libusb_device_handle *gestion, int interface );
+const char *libusb_error_name ( int code );
+int libusb_control_transfer ( libusb_device_handle *gestion,
+                              uint8_t bmRequestType, uint8_t bRequest,
+                              uint16_t wValue, uint16_t wIndex,
+                              unsigned char *data, uint16_t wLength,
+                              unsigned int timeout );
+
+struct libusb_transfer *libusb_alloc_transfer ( int iso_packets );
+void libusb_free_transfer ( struct libusb_transfer *t );
+int libusb_submit_transfer ( struct libusb_transfer *t );
+int libusb_cancel_transfer ( struct libusb_transfer *t );
+int libusb_handle_events_timeout_completed ( libusb_context *ctx,
+                                             struct timeval *tv,
+                                             int *completed );
+
+// comme dans libusb.h, le paquet SETUP est au debut du tampon, les
+// champs de 16 bits en petit-boutiste
+static inline void libusb_fill_control_setup ( unsigned char *tampon,
+              uint8_t bmRequestType, uint8_t bRequest, uint16_t wValue,
+              uint16_t wIndex, uint16_t wLength )
+{
+   tampon[0] = bmRequestType;
+   tampon[1] = bRequest;
+   tampon[2] = wValue;
+   tampon[3] = wValue >> 8;
+   tampon[4] = wIndex;
+   tampon[5] = wIndex >> 8;
+   tampon[6] = wLength;
+   tampon[7] = wLength >> 8;
+}
+
+static inline void libusb_fill_control_transfer ( struct libusb_transfer *t,
+              libusb_device_handle *gestion, unsigned char *tampon,
+              libusb_transfer_cb_fn rappel, void *user_data,
+              unsigned int timeout )
+{
+   t->dev_handle = gestion;
+   t->endpoint = 0;
+   t->type = LIBUSB_TRANSFER_TYPE_CONTROL;
+   t->timeout = timeout;
+   t->buffer = tampon;
+   t->length = LIBUSB_CONTROL_SETUP_SIZE + ( tampon[6] | tampon[7] << 8 );
+   t->user_data = user_data;
+   t->callback = rappel;
+}
+
+static inline void libusb_fill_interrupt_transfer ( struct libusb_transfer *t,
+              libusb_device_handle *gestion, unsigned char endpoint,
+              unsigned char *tampon, int longueur,
+              libusb_transfer_cb_fn rappel, void *user_data,
+              unsigned int timeout )
+{
+   t->dev_handle = gestion;
+   t->endpoint = endpoint;
+   t->type = LIBUSB_TRANSFER_TYPE_INTERRUPT;
+   t->timeout = timeout;
+   t->buffer = tampon;
+   t->length = longueur;
+   t->user_data = user_data;
+   t->callback = rappel;
+}
+
+static inline unsigned char *libusb_control_transfer_get_data (
+              struct libusb_transfer *t )
+{
+   return t->buffer + LIBUSB_CONTROL_SETUP_SIZE;
+}
+
+#endif /* _LIBUSB_SIMULE_H_ */
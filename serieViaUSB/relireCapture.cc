@@ -0,0 +1,203 @@
+/*
+    relireCapture: relit une capture horodatee ecrite par
+                   serieViaUSB -l -t et redonne les octets recus,
+                   tels quels ou en texte, avec ou sans leur heure
+                   d'arrivee.
+
+    Jerome Collin
+    Modifications, capture horodatee
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <capture.h>
+#include <formatage.h>
+
+// mode d'affichage est à BYTE par défaut.
+ModesAffichage modeAffichage = BYTE;
+
+// Nombre de caractères avant de faire un saut
+int nbSauts = 0;
+
+// 0: octets seulement, 1: temps depuis le debut, 2: heure murale
+int modeTemps = 0;
+
+char fichierCapture[1024] = "";
+char fichierSortie[1024] = "";
+int utiliseSortie = false;
+
+FILE *fpCapture = NULL;
+FILE *fpSortie = stdout;
+
+LecteurCapture lecteur;
+
+// tampon de sortie: les octets relus sortent par grandes ecritures
+char tamponSortie[1 << 16];
+
+void afficherAide ( void ) {
+   fprintf (stderr, "\n" );
+   fprintf (stderr, "usage: relireCapture [-t | -m] [-h | -d | -b] [-s <n>] [-o <fichier>] <capture>\n" );
+   fprintf (stderr, "\n" );
+   fprintf (stderr, "description : relit une capture ecrite par\n" );
+   fprintf (stderr, "              serieViaUSB -l -t et ecrit les octets\n" );
+   fprintf (stderr, "              recus de la carte a la sortie standard.\n" );
+   fprintf (stderr, "\n" );
+   fprintf (stderr, "-t --temps: une ligne par paquet USB, precedee du temps\n" );
+   fprintf (stderr, "              d'arrivee en secondes depuis le debut.\n" );
+   fprintf (stderr, "\n" );
+   fprintf (stderr, "-m --mural: comme -t, mais avec l'heure murale.\n" );
+   fprintf (stderr, "\n" );
+   fprintf (stderr, "-o --sortie <fichier>: ecrire dans ce fichier plutot\n" );
+   fprintf (stderr, "              qu'a la sortie standard.\n" );
+   fprintf (stderr, "\n" );
+   fprintf (stderr, "-h, -d, -b, -s: comme pour serieViaUSB.\n" );
+   fprintf (stderr, "\n" );
+   fflush(0);
+   exit (-1);
+}
+
+int analyseLigneDeCommande ( int argc, char *argv[] ) {
+
+   int i = 1;
+   while ( i < argc ) {
+      if ( strcmp (argv[i], "-o") == 0 ||
+           strcmp (argv[i], "--sortie") == 0 ) {
+         i++;
+         utiliseSortie = true;
+         if ( i < argc && strlen( argv[i] ) < 1023 ) {
+            strcpy ( fichierSortie, argv[i] );
+         }
+         else {
+            fprintf (stderr, "Erreur: argument manquant pour -o ou --sortie\n\n");
+            afficherAide();
+         }
+      }
+      else if ( strcmp (argv[i], "-s") == 0 ||
+           strcmp (argv[i], "--saut") == 0 ) {
+         i++;
+         if ( i < argc ) {
+            nbSauts = strtol ( argv[i], NULL, 10);
+         }
+         else {
+            fprintf (stderr, "Erreur: argument manquant pour -s ou --saut\n\n");
+            afficherAide();
+         }
+      }
+      else if ( strcmp (argv[i], "-t") == 0 ||
+                strcmp (argv[i], "--temps") == 0 ) {
+         modeTemps = 1;
+      }
+      else if ( strcmp (argv[i], "-m") == 0 ||
+                strcmp (argv[i], "--mural") == 0 ) {
+         modeTemps = 2;
+      }
+      else if ( strcmp (argv[i], "-h") == 0 ||
+                strcmp (argv[i], "--hexadecimal") == 0 ) {
+         modeAffichage = HEX;
+      }
+      else if ( strcmp (argv[i], "-d") == 0 ||
+                strcmp (argv[i], "--decimal") == 0 ) {
+         modeAffichage = DEC;
+      }
+      else if ( strcmp (argv[i], "-b") == 0 ||
+                strcmp (argv[i], "--binaire") == 0 ) {
+         modeAffichage = BIN;
+      }
+      else if ( argv[i][0] != '-' && fichierCapture[0] == '\0' &&
+                strlen( argv[i] ) < 1023 ) {
+         strcpy ( fichierCapture, argv[i] );
+      }
+      else {
+         afficherAide();
+      }
+      i++;
+   }
+
+   if ( fichierCapture[0] == '\0' ) {
+      fprintf (stderr, "Erreur: aucun fichier de capture\n");
+      afficherAide();
+   }
+
+   fpCapture = fopen (fichierCapture, "r");
+   if ( fpCapture == NULL ) {
+      fprintf (stderr, "Erreur: probleme en essayant d'ouvrir le fichier" );
+      fprintf (stderr, " %s\n", fichierCapture);
+      afficherAide();
+   }
+
+   if ( utiliseSortie == true ) {
+      fpSortie = fopen (fichierSortie, "w");
+      if ( fpSortie == NULL ) {
+         fprintf (stderr, "Erreur: probleme en essayant d'ouvrir le fichier" );
+         fprintf (stderr, " %s\n", fichierSortie);
+         afficherAide();
+      }
+   }
+
+   return 1; // succes
+}
+
+// temps d'arrivee d'un paquet au debut de sa ligne
+void afficherTemps ( uint64_t temps )
+{
+   time_t secondes;
+   struct tm heure;
+   char texte[32];
+
+   if ( modeTemps == 1 ) {
+      fprintf (fpSortie, "%12.6f  ", temps / 1e6);
+   }
+   else {
+      temps += lecteur.debutMural;
+      secondes = temps / 1000000;
+      localtime_r (&secondes, &heure);
+      strftime (texte, sizeof (texte), "%Y-%m-%d %H:%M:%S", &heure);
+      fprintf (fpSortie, "%s.%06u  ", texte, (unsigned) ( temps % 1000000 ));
+   }
+}
+
+int main ( int argc, char *argv[] ) {
+
+   const unsigned char *octets;
+   uint64_t temps;
+   long position = 0;
+   long nPaquets = 0;
+   int n;
+
+   if ( ! analyseLigneDeCommande ( argc, argv ) )
+      return -1;
+   formatageInit (modeAffichage, modeTemps ? 0 : nbSauts);
+   setvbuf (fpSortie, tamponSortie, _IOFBF, sizeof (tamponSortie));
+
+   if ( ! captureLireEntete (&lecteur, fpCapture) ) {
+      fprintf (stderr, "Erreur: %s n'est pas une capture de ", fichierCapture);
+      fprintf (stderr, "serieViaUSB\n");
+      exit (-1);
+   }
+
+   while ( ( n = captureLirePaquet (&lecteur, &temps, &octets) ) >= 0 ) {
+      if ( modeTemps ) {
+         afficherTemps (temps);
+         afficherOctets (fpSortie, octets, n, 0);
+         fputc ('\n', fpSortie);
+      }
+      else {
+         afficherOctets (fpSortie, octets, n, position);
+      }
+      position += n;
+      nPaquets++;
+   }
+   fflush (fpSortie);
+
+   if ( n == -2 ) {
+      fprintf (stderr, "Erreur: capture corrompue apres %ld octets\n", position);
+      exit (-1);
+   }
+
+   fprintf (stderr, "relireCapture : %ld octets en %ld paquets\n",
+            position, nPaquets);
+   return 0;
+}
@@ -3,8 +3,8 @@
     serieViaUSB: programme qui peut etre considere comme un terminal
                  extremement primitif et qui vise l'echange de quelques
                  octets avec une carte a microcontroleur par port RS232
-                 Unique comminication possible : 2400 baud, 8 bits,
-                 aucun bit de parite et un seul d'arret.
+                 Par defaut : 2400 baud, 8 bits, aucun bit de
+                 parite et un seul d'arret (voir -v, -bits et -p).
 
     Matthew Khouzam
     Jerome Collin
@@ -20,16 +20,29 @@
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <string.h>
 #include <limits>
 #include <time.h>
-#include <usb.h>        /* acces a libusb, voir http://libusb.sourceforge.net/ */
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
 #include <usbcmd.h>
+#include <transportUSB.h>
+#include <anneau.h>
+#include <formatage.h>
+#include <capture.h>
+#include <cible/trame.h>
+#include <cible/compression.h>
 #include <ctype.h>
 
-enum ModesAffichage{BYTE, HEX, DEC, BIN};
-
 // vrai s'il y a communication de la carte vers le PC.
 int lecture = false;
 
@@ -49,28 +62,176 @@ FILE *fpFichier = NULL;
 char fichier[1024] = "";
 int utiliseFichier = false;
 
-// pour la conversion char-bin. 
-// Tiré de http://cboard.cprogramming.com/c-programming/42817-convert-char-binary.html
-char* charToBin ( unsigned char c )
+// destination des octets recus de la carte.  Avec -l seul, c'est le
+// fichier de l'option -f; avec -l et -e, -f donne les octets a envoyer
+// et les octets recus vont a la sortie standard ou au fichier de -o.
+FILE *fpSortie = NULL;
+char fichierSortie[1024] = "";
+int utiliseSortie = false;
+
+// nombre d'octets a envoyer a la carte (taille du fichier ou -nb)
+int nOctetsEcriture = 0;
+
+// le fichier a envoyer, projete en memoire
+const unsigned char *donneesEcriture = NULL;
+
+// avec -z, le fichier part compresse (voir cible/compression.h) et
+// nOctetsFichier garde sa taille d'origine pour le rapport
+int compression = false;
+int nOctetsFichier = 0;
+
+// echo a l'ecran des octets envoyes (option -q pour l'enlever)
+int echo = true;
+
+// tampon de stderr pendant l'echo: une ecriture par transfert USB
+// plutot qu'un appel systeme par octet
+char tamponEcho[1 << 16];
+
+// ecriture en continu, rythmee par la place libre dans le fifo
+// de transmission du firmware plutot que par un delai fixe
+int continu = false;
+
+// reception par le point d'acces interrupt-in plutot que par
+// des requetes de controle USBASP_FUNC_READSER
+int interruption = false;
+
+// part du tampon serie du programmeur donnee a la reception, en 16e
+// (USBASP_SERRX_*); 0 laisse le firmware la partager moitie-moitie
+int partReception = 0;
+
+// controle de flux XON/XOFF du programmeur vers la carte: place libre
+// dans son fifo de reception quand il envoie XOFF (0: sans controle)
+int margeXonXoff = 0;
+
+// avec -l, ecrire les octets recus dans le format de capture
+// horodatee (voir capture.h) plutot que tels quels
+int horodatage = false;
+
+// avec -l, afficher les compteurs de la ligne serie du programmeur
+// toutes les periodeCompteurs secondes (0: seulement a la fin)
+int periodeCompteurs = 0;
+
+// origine des temps de la capture
+struct timespec debutCapture;
+
+// en capture, le fil de lecture depose dans l'anneau un enregistrement
+// par paquet: le temps en us, le nombre d'octets, puis les octets
+#define ENTETE_ENREGISTREMENT  ( sizeof (uint64_t) + 1 )
+
+// un bloc de capture incomplet est ecrit apres ce delai sans
+// nouveaux octets, pour ne pas perdre grand-chose si tout s'arrete
+#define PERIODE_CAPTURE_US  1000000
+
+// avec -P, les octets passent dans des trames numerotees et verifiees
+// par CRC, confirmees par la carte (voir cible/trame.h)
+int protocole = false;
+Trame trameHote;
+int recusTrames = 0;
+
+// trames encodees en attente de place dans le fifo de transmission
+unsigned char sortant[8192];
+int nSortant = 0;
+
+// mode demon: le programmeur reste ouvert et les octets passent
+// par ce socket Unix (option -D)
+int demonActif = false;
+char socketDemon[sizeof (((struct sockaddr_un *) 0)->sun_path)] = "";
+volatile sig_atomic_t arretDemon = false;
+
+// clients connectes en meme temps au demon
+#define MAX_CLIENTS  8
+
+// retard permis a un client du demon (tampon d'envoi de son socket,
+// que Linux double): plus, et il est deconnecte
+#define TAMPON_CLIENT  16384
+
+// vitesse de la communication serie avec la carte
+int vitesseBaud = 2400;
+
+// bits de donnees et parite (USBASP_MODE_PARITYN, E ou O)
+int bitsDonnees = 8;
+int parite = USBASP_MODE_PARITYN;
+
+// chercher la vitesse la plus elevee ou l'echo de la carte est exact
+int negociation = false;
+
+// vitesses possibles, dans l'ordre des USBASP_MODE_SETBAUD*
+const int vitesses[] = { 300, 600, 1200, 2400, 4800, 9600,
+                         19200, 38400, 57600, 115200 };
+#define N_VITESSES  ( (int) ( sizeof (vitesses) / sizeof (vitesses[0]) ) )
+
+// un octet serie prend un bit de depart, les bits de donnees,
+// la parite s'il y a lieu et un bit d'arret
+#define DUREE_OCTET_NS  ( ( 2 + bitsDonnees + \
+                            ( parite != USBASP_MODE_PARITYN ) ) * \
+                          1000000000LL / vitesseBaud )
+
+// octets envoyes a chaque vitesse essayee pendant la negociation
+#define TAILLE_ESSAI  64
+
+// en mode continu et en lecture, pas plus de 16 paquets de 8 octets
+// par transfert
+#define PAQUETS_PAR_TRANSFERT  16
+
+// en mode continu, attendre que cette place se libere dans le fifo
+// de transmission avant de renvoyer quelque chose
+#define SEUIL_CONTINU  ( 4 * USBASP_SERPAYLOAD )
+
+// pour l'interface USB vers la carte (la premiere, s'il y en a plusieurs)
+PeripheriqueUSB *gestionUSB;
+
+// en lecture, un fil interroge le USB et depose les octets de chaque
+// carte dans son anneau; le fil principal les formate et les ecrit
+// dans le fichier de la carte
+struct Carte
 {
-    static char bin[CHAR_BIT + 1] = {0};
-    int i;
+   PeripheriqueUSB *p;
+   char nom[USB_LONGUEUR_NOM];
+   FILE *fp;
+   Anneau anneau;
+   Capture capture;
+   int recus;
 
-    for ( i = CHAR_BIT - 1; i >= 0; i-- )
-    {
-        bin[i] = (c % 2) + '0';
-        c /= 2;
-    }
+   // octets que le firmware a du jeter faute de place dans son fifo
+   // de reception (-1 si le firmware ne tient pas ce compte)
+   std::atomic<long> perdus;
 
-    return bin;
-}
+   // USBASP_FUNC_GETSERSTATS cumule sur toute la session: les
+   // compteurs s'additionnent, les niveaux gardent leur maximum
+   unsigned long compteurs[USBASP_SERSTAT_N];
+   int avecCompteurs;
+};
+
+// avec plusieurs -u, ou -u tous, la lecture se fait sur plusieurs
+// programmeurs a la fois, chacun dans son fichier
+#define MAX_CARTES  16
+Carte cartes[MAX_CARTES];
+int nCartes = 0;
+char selections[MAX_CARTES][USB_LONGUEUR_NOM];
+int nSelections = 0;
+int tousLesProgrammeurs = false;
+
+std::atomic<int> arretLecture(false);
+
+// nombre de lectures asynchrones gardees en vol en meme temps
+#define TRANSFERTS_EN_VOL  4
 
-// pour l'interface USB vers la carte
-usb_dev_handle *gestionUSB;
+// intervalle entre deux demandes d'etat au firmware pendant la lecture
+#define PERIODE_ETAT_NS  1000000000LL
+
+// plusieurs -u, ou -u tous
+int plusieursProgrammeurs ( void )
+{
+   return nSelections > 1 || tousLesProgrammeurs;
+}
 
 void afficherAide ( void ) {
    fprintf (stderr, "\n" );
-   fprintf (stderr, "usage: serieViaUSB [-l | -e] [-nb <n>] [-f <fichier>] [-h | -d | -b] [-s <n>]\n" );
+   fprintf (stderr, "usage: serieViaUSB [-l [-i] [-t] [-o <fichier>]] [-e [-c] [-q] [-z]] [-nb <n>] [-f <fichier>] [-h | -d | -b] [-s <n>]\n" );
+   fprintf (stderr, "                   [-P] [-r <n>] [-x <n>] [-S <s>] [-v <baud>] [-bits <n>] [-p n|e|o] [-a]\n" );
+   fprintf (stderr, "       serieViaUSB -D <socket> [-i] [-v <baud>] [-bits <n>] [-p n|e|o] [-a]\n" );
+   fprintf (stderr, "       serieViaUSB -L\n" );
+   fprintf (stderr, "       (chaque forme accepte aussi -u <programmeur>)\n" );
    fprintf (stderr, "\n" );
    fprintf (stderr, "description : programme permettant de recevoir et\n" );
    fprintf (stderr, "              d'envoyer des octets de facon serielle mais\n" );
@@ -85,7 +246,86 @@ void afficherAide ( void ) {
    fprintf (stderr, "               l'utilisation de l'option -f.\n" );
    fprintf (stderr, "\n" );
    fprintf (stderr, "-l --lecture: pour reception des donnees en provenance\n" );
-   fprintf (stderr, "              de la carte\n" );
+   fprintf (stderr, "              de la carte.  Les options -l et -e peuvent\n" );
+   fprintf (stderr, "              etre utilisees ensemble: les octets du\n" );
+   fprintf (stderr, "              fichier -f partent vers la carte (comme\n" );
+   fprintf (stderr, "              avec -c) pendant que les octets recus\n" );
+   fprintf (stderr, "              vont a la sortie standard.\n" );
+   fprintf (stderr, "\n" );
+   fprintf (stderr, "-D --demon <socket>: garder le programmeur ouvert et\n" );
+   fprintf (stderr, "              configure, et echanger les octets par ce\n" );
+   fprintf (stderr, "              socket Unix jusqu'a SIGINT ou SIGTERM.  Ce\n" );
+   fprintf (stderr, "              qu'un client ecrit part vers la carte et\n" );
+   fprintf (stderr, "              ce que la carte envoie va a tous les\n" );
+   fprintf (stderr, "              clients (par exemple: socat - UNIX:<socket>).\n" );
+   fprintf (stderr, "              Sans client, les octets recus sont jetes.\n" );
+   fprintf (stderr, "              Un seul programmeur (-u) par demon.  Un\n" );
+   fprintf (stderr, "              client qui ne lit plus est deconnecte.\n" );
+   fprintf (stderr, "\n" );
+   fprintf (stderr, "-L --liste: afficher les programmeurs branches, avec\n" );
+   fprintf (stderr, "              leur bus:adresse et numero de serie.\n" );
+   fprintf (stderr, "\n" );
+   fprintf (stderr, "-u --usb <bus:adresse | serie | tous>: utiliser ce\n" );
+   fprintf (stderr, "              programmeur plutot que le premier trouve.\n" );
+   fprintf (stderr, "              Avec plusieurs -u ou -u tous, -l lit tous\n" );
+   fprintf (stderr, "              les programmeurs a la fois et les octets\n" );
+   fprintf (stderr, "              de chacun vont dans <fichier de -o>.<nom>,\n" );
+   fprintf (stderr, "              ou nom est le numero de serie ou bus-adresse.\n" );
+   fprintf (stderr, "\n" );
+   fprintf (stderr, "-o --sortie <fichier>: avec -l, ecrire les octets recus\n" );
+   fprintf (stderr, "              dans ce fichier.\n" );
+   fprintf (stderr, "\n" );
+   fprintf (stderr, "-t --horodatage: avec -l, ecrire les octets recus dans\n" );
+   fprintf (stderr, "              un format binaire compact ou chaque\n" );
+   fprintf (stderr, "              paquet USB porte son heure d'arrivee.\n" );
+   fprintf (stderr, "              Voir relireCapture pour le relire.\n" );
+   fprintf (stderr, "\n" );
+   fprintf (stderr, "-i --interruption: avec -l, recevoir les octets par\n" );
+   fprintf (stderr, "              le point d'acces interrupt-in du\n" );
+   fprintf (stderr, "              programmeur (8 octets par paquet, sans\n" );
+   fprintf (stderr, "              requete de controle a chaque lecture).\n" );
+   fprintf (stderr, "              Un paquet par 10 ms au plus: environ\n" );
+   fprintf (stderr, "              800 octets/s, moins que 9600 baud.\n" );
+   fprintf (stderr, "\n" );
+   fprintf (stderr, "-r --reception <n>: donner n 16e (1 a 15) du tampon\n" );
+   fprintf (stderr, "              serie du programmeur a la reception, le\n" );
+   fprintf (stderr, "              reste a l'emission.  15 garde la plus\n" );
+   fprintf (stderr, "              longue rafale de la carte quand le PC\n" );
+   fprintf (stderr, "              tarde a lire.  Par defaut, moitie-moitie.\n" );
+   fprintf (stderr, "\n" );
+   fprintf (stderr, "-x --xonxoff <n>: le programmeur envoie XOFF a la carte\n" );
+   fprintf (stderr, "              quand il ne lui reste que n octets (16,\n" );
+   fprintf (stderr, "              32, 64 ou 128) pour la reception, puis XON\n" );
+   fprintf (stderr, "              quand le PC a lu la moitie de ce qu'il\n" );
+   fprintf (stderr, "              garde.  La carte doit s'arreter au plus\n" );
+   fprintf (stderr, "              n octets plus loin, et retirer 0x11 et\n" );
+   fprintf (stderr, "              0x13 de ce qui lui arrive: pas avec -e,\n" );
+   fprintf (stderr, "              -z, -P ou -D, qui lui en envoient.\n" );
+   fprintf (stderr, "\n" );
+   fprintf (stderr, "-S --statistiques <s>: avec -l, afficher toutes les s\n" );
+   fprintf (stderr, "              secondes les compteurs du programmeur:\n" );
+   fprintf (stderr, "              octets ecrases (DOR), erreurs de trame et\n" );
+   fprintf (stderr, "              de parite, octets perdus et plus hauts\n" );
+   fprintf (stderr, "              niveaux des fifos depuis l'affichage\n" );
+   fprintf (stderr, "              precedent.  Le total s'affiche a la fin.\n" );
+   fprintf (stderr, "\n" );
+   fprintf (stderr, "-P --protocole: avec -l et/ou -e, echanger les octets\n" );
+   fprintf (stderr, "              dans des trames verifiees par CRC-16,\n" );
+   fprintf (stderr, "              confirmees et retransmises au besoin.  La\n" );
+   fprintf (stderr, "              carte doit utiliser cible/trame.c.\n" );
+   fprintf (stderr, "\n" );
+   fprintf (stderr, "-c --continu: avec -e, envoyer les octets aussi vite\n" );
+   fprintf (stderr, "              que la carte peut les transmettre en\n" );
+   fprintf (stderr, "              surveillant la place libre dans le\n" );
+   fprintf (stderr, "              tampon du programmeur plutot qu'avec\n" );
+   fprintf (stderr, "              un delai fixe entre chaque paquet.\n" );
+   fprintf (stderr, "\n" );
+   fprintf (stderr, "-q --silencieux: avec -e, ne pas afficher a l'ecran\n" );
+   fprintf (stderr, "              les octets envoyes vers la carte.\n" );
+   fprintf (stderr, "\n" );
+   fprintf (stderr, "-z --compression: avec -e, compresser le fichier avant\n" );
+   fprintf (stderr, "              de l'envoyer.  La carte doit le decompresser\n" );
+   fprintf (stderr, "              avec cible/compression.c.\n" );
    fprintf (stderr, "\n" );
    fprintf (stderr, "-nb --nBytes <n>: terminer le programme directement apres\n" );
    fprintf (stderr, "              le transfert de n octets.  Sans cette option,\n" );
@@ -112,81 +352,1065 @@ void afficherAide ( void ) {
    fprintf (stderr, "-s --saut <n>: effectue un retour à la ligne à chaque n\n" );
    fprintf (stderr, "                  caractère.\n" );
    fprintf (stderr, "\n" );
+   fprintf (stderr, "-v --vitesse <baud>: vitesse de la communication serie\n" );
+   fprintf (stderr, "              (300, 600, 1200, 2400, 4800, 9600, 19200,\n" );
+   fprintf (stderr, "              38400, 57600 ou 115200; 2400 par defaut).\n" );
+   fprintf (stderr, "\n" );
+   fprintf (stderr, "-bits --bits <n>: nombre de bits de donnees, de 5 a 8\n" );
+   fprintf (stderr, "              (8 par defaut).\n" );
+   fprintf (stderr, "\n" );
+   fprintf (stderr, "-p --parite <n|e|o>: aucune parite (par defaut), paire\n" );
+   fprintf (stderr, "              ou impaire.\n" );
+   fprintf (stderr, "\n" );
+   fprintf (stderr, "-a --auto: a partir de la vitesse de -v, essayer les\n" );
+   fprintf (stderr, "              vitesses superieures une a une et garder\n" );
+   fprintf (stderr, "              la plus elevee ou la carte renvoie sans\n" );
+   fprintf (stderr, "              erreur les octets d'essai.  La carte (ou un\n" );
+   fprintf (stderr, "              cavalier entre TX et RX) doit faire l'echo\n" );
+   fprintf (stderr, "              de chaque octet recu a la vitesse choisie.\n" );
+   fprintf (stderr, "\n" );
    fflush(0);
    exit (-1);
 }
 
-/* Fonctions pour gerer le USB */
+/* Fonctions pour gerer le USB (voir transportUSB.cc) */
+
+int usbAjustementSerie (PeripheriqueUSB *p, int baud, int bits, int parity,
+                        int options)
+{
+  int nOctets;
+  unsigned char cmd[4];
+  unsigned char msg[4] = {0, 0, 0, 0};
+  // le firmware attend ces parametres, et dans cet ordre
+  cmd[0] = baud;
+  cmd[1] = bits;
+  cmd[2] = parity;
+  cmd[3] = options;
+
+  // USBASP_FUNC_SETSERIOS ajuste les parametres USB (voir firmware)
+  nOctets = usbControle (p, 1, USBASP_FUNC_SETSERIOS,
+             (cmd[1] << 8) | cmd[0], (cmd[3] << 8) | cmd[2],
+             msg, 4);
+
+  if ( nOctets < 0 ) {
+     fprintf(stderr, "Erreur: probleme de transmission USB: %s\n", usbErreur(nOctets));
+     usbFermer (gestionUSB);
+     exit (-1);
+  }
+
+  // la configuration se confirme par un echo des parametres
+  // il faut donc verifier que l'on a bien recu ce qu'on attend...
+  if ( msg[0] == cmd[0] && msg[1] == cmd[1] &&
+       msg[2] == cmd[2] && msg[3] == cmd[3] ) {
+     return 1;
+  }
+
+  // un firmware plus ancien ne renvoie pas la part de la reception:
+  // ses fifos restent de taille fixe, mais le reste tient
+  if ( msg[0] == cmd[0] && msg[1] == cmd[1] && msg[2] == cmd[2] &&
+       msg[3] == ( cmd[3] & ~USBASP_SERRX_MASK ) ) {
+     fprintf (stderr, "Attention: le firmware du programmeur ignore -r\n");
+     return 1;
+  }
+
+  // sans controle de flux, -x ne protegerait rien: mieux vaut s'arreter
+  if ( ( cmd[3] & USBASP_SERFLAG_XONXOFF ) &&
+       ! ( msg[3] & USBASP_SERFLAG_XONXOFF ) ) {
+     fprintf (stderr, "Erreur: le firmware du programmeur ne connait pas ");
+     fprintf (stderr, "XON/XOFF (-x)\n");
+  }
+
+  return 0;
+}
+
+// rapport sur le debit obtenu et le temps processeur utilise
+void rapportPerformance ( int nOctets, const struct timespec *debut )
+{
+  struct timespec fin;
+  struct rusage usage;
+  double duree, cpu;
+
+  clock_gettime (CLOCK_MONOTONIC, &fin);
+  getrusage (RUSAGE_SELF, &usage);
+  duree = ( fin.tv_sec - debut->tv_sec ) +
+          ( fin.tv_nsec - debut->tv_nsec ) / 1e9;
+  cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+        usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+
+  fprintf (stderr, "serieViaUSB : %.3f s, %.0f octets/s, ", duree,
+           duree > 0 ? nOctets / duree : 0.0 );
+  fprintf (stderr, "temps processeur %.3f s\n", cpu );
+}
+
+// lecture de l'etat des fifos du firmware: place libre pour la
+// transmission vers la carte, octets en attente de la carte et
+// octets de la carte perdus parce que le fifo de reception etait plein
+int usbEtatSerie ( PeripheriqueUSB *p, int *txLibre, int *rxOccupe,
+                   long *rxPerdus )
+{
+  int nOctets;
+  unsigned char msg[6];
+
+  nOctets = usbControle (p, 1, USBASP_FUNC_GETSERSTATUS,
+             0, 0, msg, 6);
+
+  if ( nOctets < 0 ) {
+     fprintf(stderr, "Erreur: probleme de transmission USB: %s\n", usbErreur(nOctets));
+     usbFermer (gestionUSB);
+     exit (-1);
+  }
+
+  // un firmware plus ancien ne connait pas cette requete et ne repond rien
+  if ( nOctets < 4 ) {
+     return 0;
+  }
+
+  *txLibre = msg[0] | (msg[1] << 8);
+  *rxOccupe = msg[2] | (msg[3] << 8);
+  *rxPerdus = ( nOctets < 6 ) ? -1 : ( msg[4] | (msg[5] << 8) );
+  return 1;
+}
+
+// compteurs de la ligne serie du firmware (USBASP_SERSTAT_*), remis a
+// zero apres la lecture, ajoutes a ceux de la carte.  Retourne 0 si le
+// firmware ne connait pas USBASP_FUNC_GETSERSTATS.
+int usbCompteursSerie ( Carte *carte, unsigned long compteurs[USBASP_SERSTAT_N] )
+{
+  int nOctets, i;
+  unsigned char msg[2 * USBASP_SERSTAT_N];
+
+  nOctets = usbControle (carte->p, 1, USBASP_FUNC_GETSERSTATS,
+             USBASP_SERSTAT_RAZ, 0, msg, sizeof (msg));
+
+  if ( nOctets < 0 ) {
+     fprintf(stderr, "Erreur: probleme de transmission USB: %s\n", usbErreur(nOctets));
+     usbFermer (gestionUSB);
+     exit (-1);
+  }
+  if ( nOctets < (int) sizeof (msg) ) {
+     return 0;
+  }
+
+  for ( i = 0; i < USBASP_SERSTAT_N; i++ ) {
+     compteurs[i] = msg[2 * i] | (msg[2 * i + 1] << 8);
+     if ( i == USBASP_SERSTAT_RXMAX || i == USBASP_SERSTAT_TXMAX ) {
+        if ( compteurs[i] > carte->compteurs[i] ) {
+           carte->compteurs[i] = compteurs[i];
+        }
+     }
+     else {
+        carte->compteurs[i] += compteurs[i];
+     }
+  }
+  carte->avecCompteurs = true;
+  return 1;
+}
+
+// une ligne de compteurs, ceux d'un intervalle ou de toute la session
+void afficherCompteurs ( const Carte *carte, const char *quand,
+                         const unsigned long compteurs[USBASP_SERSTAT_N] )
+{
+  fprintf (stderr, "serieViaUSB : %s%s%s: DOR %lu, trame %lu, parite %lu, ",
+           nCartes > 1 ? carte->nom : "", nCartes > 1 ? " " : "", quand,
+           compteurs[USBASP_SERSTAT_DOR],
+           compteurs[USBASP_SERSTAT_FE],
+           compteurs[USBASP_SERSTAT_PE] );
+  fprintf (stderr, "fifo plein %lu, niveau max RX %lu TX %lu\n",
+           compteurs[USBASP_SERSTAT_PERTES],
+           compteurs[USBASP_SERSTAT_RXMAX],
+           compteurs[USBASP_SERSTAT_TXMAX] );
+}
+
+// 4e octet de USBASP_FUNC_SETSERIOS selon les options choisies; la
+// marge de -x est arrondie a celle du firmware juste au-dessus
+int optionsSerie ( void )
+{
+  int options = partReception << USBASP_SERRX_SHIFT;
+  int n = 0;
+
+  if ( interruption ) {
+     options |= USBASP_SERFLAG_INTRIN;
+  }
+  if ( margeXonXoff > 0 ) {
+     while ( USBASP_SERMARGE (n << USBASP_SERFLOW_SHIFT) < margeXonXoff ) {
+        n++;
+     }
+     options |= USBASP_SERFLAG_XONXOFF | ( n << USBASP_SERFLOW_SHIFT );
+  }
+  return options;
+}
+
+// mode USBASP_MODE_SETBAUD* d'une vitesse, 0 si elle n'existe pas
+int modeVitesse ( int baud )
+{
+  int i;
+
+  for ( i = 0; i < N_VITESSES; i++ ) {
+     if ( vitesses[i] == baud ) {
+        return USBASP_MODE_SETBAUD300 + i;
+     }
+  }
+  return 0;
+}
+
+// une requete READSER: retire les octets en attente dans le fifo de
+// reception du firmware, au plus max.  Retourne le nombre d'octets.
+int usbLectureSerie ( unsigned char *octets, int max )
+{
+  unsigned char tampon[PAQUETS_PAR_TRANSFERT * USBASP_SERPACKETSIZE];
+  int nOctets, i, n;
+  int recus = 0;
+
+  nOctets = usbControle (gestionUSB, 1, USBASP_FUNC_READSER, 0, 0,
+                         tampon, sizeof (tampon));
+  if ( nOctets < 0 ) {
+     fprintf(stderr, "Erreur: probleme de transmission USB: %s\n", usbErreur(nOctets));
+     usbFermer (gestionUSB);
+     exit (-1);
+  }
+
+  for ( i = 0; i < nOctets; i += USBASP_SERPACKETSIZE ) {
+     n = tampon[i];
+     if ( n > USBASP_SERPAYLOAD ) {
+        n = USBASP_SERPAYLOAD;
+     }
+     if ( n > nOctets - i - 1 ) {
+        n = nOctets - i - 1;
+     }
+     if ( n > max - recus ) {
+        n = max - recus;
+     }
+     if ( n > 0 ) {
+        memcpy (octets + recus, tampon + i + 1, n);
+        recus += n;
+     }
+  }
+  return recus;
+}
+
+// essai d'une vitesse: la carte doit renvoyer exactement les octets
+// envoyes, sans perte dans le fifo de reception du programmeur
+int essaiEcho ( int baud )
+{
+  unsigned char motif[TAILLE_ESSAI];
+  unsigned char recu[TAILLE_ESSAI];
+  unsigned char tampon[USBASP_SERPACKETSIZE];
+  unsigned char poubelle[USBASP_SERPAYLOAD * PAQUETS_PAR_TRANSFERT];
+  struct timespec attente = { 0, 20000000 }; // 20 ms
+  long long delai;
+  int txLibre, rxOccupe;
+  long rxPerdus;
+  int i, n, rtn;
+  int recus = 0;
+
+  if ( ! usbAjustementSerie (gestionUSB, modeVitesse (baud), USBASP_MODE_UART5BIT +
+                             bitsDonnees - 5, parite, 0) ) {
+     return 0;
+  }
+  vitesseBaud = baud;
+
+  // laisser passer les octets en route, puis vider la reception
+  nanosleep (&attente, NULL);
+  while ( usbLectureSerie (poubelle, sizeof (poubelle)) > 0 );
+
+  // toutes les valeurs possibles avec ce nombre de bits, dans
+  // un ordre qui alterne beaucoup les bits
+  for ( i = 0; i < TAILLE_ESSAI; i++ ) {
+     motif[i] = ( i * 0x9D + 0x55 ) & ( ( 1 << bitsDonnees ) - 1 );
+  }
+
+  for ( i = 0; i < TAILLE_ESSAI; i += n ) {
+     n = TAILLE_ESSAI - i;
+     if ( n > USBASP_SERPAYLOAD ) {
+        n = USBASP_SERPAYLOAD;
+     }
+     tampon[0] = n;
+     memcpy (tampon + 1, motif + i, n);
+     rtn = usbControle (gestionUSB, 0, USBASP_FUNC_WRITESER, 0, 0,
+                        tampon, n + 1);
+     if ( rtn < 0 ) {
+        fprintf (stderr, "Erreur: problem de tansmission USB:" );
+        fprintf (stderr, " %s\n", usbErreur(rtn));
+        usbFermer (gestionUSB);
+        exit(-1);
+     }
+  }
+
+  // l'aller et le retour, plus une bonne marge pour la carte
+  delai = 2 * TAILLE_ESSAI * DUREE_OCTET_NS + 200000000LL;
+  while ( recus < TAILLE_ESSAI && delai > 0 ) {
+     n = usbLectureSerie (recu + recus, TAILLE_ESSAI - recus);
+     if ( n == 0 ) {
+        nanosleep (&attente, NULL);
+        delai -= attente.tv_nsec;
+     }
+     recus += n;
+  }
+
+  if ( recus != TAILLE_ESSAI || memcmp (recu, motif, TAILLE_ESSAI) != 0 ) {
+     return 0;
+  }
+
+  // un octet de trop ou perdu par le programmeur est aussi une erreur
+  nanosleep (&attente, NULL);
+  if ( usbLectureSerie (poubelle, sizeof (poubelle)) > 0 ) {
+     return 0;
+  }
+  if ( usbEtatSerie (gestionUSB, &txLibre, &rxOccupe, &rxPerdus) &&
+       rxPerdus > 0 ) {
+     return 0;
+  }
+  return 1;
+}
+
+// monte la vitesse tant que l'echo de la carte reste exact et garde
+// la derniere vitesse sans erreur dans vitesseBaud
+void negocierVitesse ( void )
+{
+  int depart = modeVitesse (vitesseBaud) - USBASP_MODE_SETBAUD300;
+  int meilleure = 0;
+  int i;
+
+  for ( i = depart; i < N_VITESSES; i++ ) {
+     fprintf (stderr, "essai a %d baud: ", vitesses[i]);
+     if ( ! essaiEcho (vitesses[i]) ) {
+        fprintf (stderr, "erreurs\n");
+        break;
+     }
+     fprintf (stderr, "OK\n");
+     meilleure = vitesses[i];
+  }
+
+  if ( meilleure == 0 ) {
+     fprintf (stderr, "Erreur: aucun echo correct de la carte a %d baud\n",
+              vitesses[depart]);
+     usbFermer (gestionUSB);
+     exit (-1);
+  }
+  vitesseBaud = meilleure;
+}
+
+// appele depuis usbEvenements() pour chaque paquet recu d'une carte.
+// L'anneau est grand: s'il est plein, c'est la sortie qui bloque et il
+// vaut mieux attendre que jeter des octets deja recus.
+void recevoirOctets ( PeripheriqueUSB *, const unsigned char *octets,
+                      int n, void *contexte )
+{
+  Carte *carte = (Carte *) contexte;
+  int ecrits = 0;
+  struct timespec attente = { 0, 1000000 }; // 1 ms
+  struct timespec maintenant;
+  unsigned char enregistrement[ENTETE_ENREGISTREMENT + 255];
+  uint64_t temps;
+
+  // en capture, l'enregistrement entre d'un coup dans l'anneau pour que
+  // le lecteur n'y trouve jamais un paquet a moitie ecrit
+  if ( horodatage ) {
+     clock_gettime (CLOCK_MONOTONIC, &maintenant);
+     temps = ( maintenant.tv_sec - debutCapture.tv_sec ) * 1000000LL +
+             ( maintenant.tv_nsec - debutCapture.tv_nsec ) / 1000;
+     memcpy (enregistrement, &temps, sizeof (temps));
+     enregistrement[sizeof (temps)] = n;
+     memcpy (enregistrement + ENTETE_ENREGISTREMENT, octets, n);
+     octets = enregistrement;
+     n += ENTETE_ENREGISTREMENT;
+     while ( TAILLE_ANNEAU - anneauOccupe (&carte->anneau) < (size_t) n &&
+             ! arretLecture ) {
+        nanosleep (&attente, NULL);
+     }
+  }
+
+  while ( ecrits < n && ! arretLecture ) {
+     ecrits += anneauEcrire (&carte->anneau, octets + ecrits, n - ecrits);
+     if ( ecrits < n ) {
+        nanosleep (&attente, NULL);
+     }
+  }
+}
+
+// fil de lecture: garde plusieurs lectures asynchrones en vol sur
+// chaque programmeur et fait tourner la boucle d'evenements USB, la
+// meme pour tous.  L'ecriture dans les fichiers ne peut donc plus
+// retarder la prochaine interrogation du USB.
+void *filLecture ( void * )
+{
+  int rtn;
+  int txLibre, rxOccupe;
+  long rxPerdus;
+  int k;
+  struct timespec dernierEtat, maintenant;
+
+  // chaque READSER peut vider tout le fifo de reception du firmware,
+  // qui termine le transfert par un paquet court des que le fifo est
+  // vide: une lecture ne coute donc pas plus de paquets que necessaire
+  for ( k = 0; k < nCartes; k++ ) {
+     rtn = usbDemarrerLecture (cartes[k].p, interruption, TRANSFERTS_EN_VOL,
+                               PAQUETS_PAR_TRANSFERT * USBASP_SERPACKETSIZE,
+                               recevoirOctets, &cartes[k]);
+     if ( rtn < 0 ) {
+        fprintf (stderr, "Erreur: problem de tansmission USB (%s):",
+                 cartes[k].nom );
+        fprintf (stderr, " %s\n", usbErreur(rtn));
+        exit(-1);
+     }
+  }
+
+  clock_gettime (CLOCK_MONOTONIC, &dernierEtat);
+
+  while ( ! arretLecture ) {
+     usbEvenements (100);
+
+     for ( k = 0; k < nCartes; k++ ) {
+        rtn = usbErreurLecture (cartes[k].p);
+        if ( rtn < 0 ) {
+           fprintf (stderr, "Erreur: problem de tansmission USB (%s):",
+                    cartes[k].nom );
+           fprintf (stderr, " %s\n", usbErreur(rtn));
+           exit(-1);
+        }
+     }
+
+     // de temps en temps, demander aux firmwares s'ils ont perdu des octets
+     clock_gettime (CLOCK_MONOTONIC, &maintenant);
+     if ( ( maintenant.tv_sec - dernierEtat.tv_sec ) * 1000000000LL +
+          ( maintenant.tv_nsec - dernierEtat.tv_nsec ) > PERIODE_ETAT_NS ) {
+        for ( k = 0; k < nCartes; k++ ) {
+           if ( usbEtatSerie (cartes[k].p, &txLibre, &rxOccupe, &rxPerdus) ) {
+              cartes[k].perdus = rxPerdus;
+           }
+        }
+        dernierEtat = maintenant;
+     }
+  }
+
+  for ( k = 0; k < nCartes; k++ ) {
+     usbArreterLecture (cartes[k].p);
+  }
+  return NULL;
+}
+
+// vide l'anneau d'une carte en capture horodatee: les enregistrements
+// sont accumules en blocs, ecrits chacun d'un seul coup.  Retourne le
+// nombre d'octets de la carte retires.
+int viderCapture ( Carte *carte )
+{
+  unsigned char enregistrement[ENTETE_ENREGISTREMENT + 255];
+  uint64_t temps;
+  int total = 0;
+  int n;
+
+  // le producteur n'ecrit que des enregistrements complets
+  while ( carte->recus < nBytes &&
+          anneauLire (&carte->anneau, enregistrement,
+                      ENTETE_ENREGISTREMENT) > 0 ) {
+     memcpy (&temps, enregistrement, sizeof (temps));
+     n = enregistrement[sizeof (temps)];
+     anneauLire (&carte->anneau, enregistrement + ENTETE_ENREGISTREMENT, n);
+     if ( n > nBytes - carte->recus ) {
+        n = nBytes - carte->recus;
+     }
+     captureAjouter (&carte->capture, temps,
+                     enregistrement + ENTETE_ENREGISTREMENT, n);
+     carte->recus += n;
+     total += n;
+  }
+  return total;
+}
+
+// vide l'anneau d'une carte: formatage et ecriture par blocs
+int viderAnneau ( Carte *carte )
+{
+  unsigned char bloc[4096];
+  int total = 0;
+  int n;
+
+  while ( carte->recus < nBytes ) {
+     n = sizeof (bloc);
+     if ( n > nBytes - carte->recus ) {
+        n = nBytes - carte->recus;
+     }
+     n = anneauLire (&carte->anneau, bloc, n);
+     if ( n == 0 ) {
+        break;
+     }
+     afficherOctets (carte->fp, bloc, n, carte->recus);
+     carte->recus += n;
+     total += n;
+  }
+  return total;
+}
+
+// lecture des octets des cartes.  Le fil principal vide les anneaux
+// par blocs, formate les octets et les ecrit pendant que filLecture
+// continue d'interroger le USB.  Chaque carte s'arrete apres nBytes.
+void lectureAvecFil ( void )
+{
+  pthread_t fil;
+  int txLibre, rxOccupe;
+  long rxPerdus;
+  int actives, recus, k;
+  uint64_t temps;
+  struct timespec attente = { 0, 1000000 }; // 1 ms
+  struct timespec maintenant, prochainsCompteurs;
+  unsigned long compteurs[USBASP_SERSTAT_N];
+
+  if ( horodatage ) {
+     clock_gettime (CLOCK_REALTIME, &maintenant);
+     clock_gettime (CLOCK_MONOTONIC, &debutCapture);
+  }
+  for ( k = 0; k < nCartes; k++ ) {
+     anneauInit (&cartes[k].anneau);
+     cartes[k].recus = 0;
+     if ( horodatage &&
+          ! captureOuvrir (&cartes[k].capture, cartes[k].fp,
+                           maintenant.tv_sec * 1000000ULL +
+                           maintenant.tv_nsec / 1000 ) ) {
+        fprintf (stderr, "Erreur: incapable d'ecrire la capture\n");
+        exit (-1);
+     }
+  }
+
+  if ( pthread_create (&fil, NULL, filLecture, NULL) != 0 ) {
+     fprintf (stderr, "Erreur: incapable de creer le fil de lecture\n");
+     exit (-1);
+  }
+  clock_gettime (CLOCK_MONOTONIC, &prochainsCompteurs);
+  prochainsCompteurs.tv_sec += periodeCompteurs;
+
+  do {
+     actives = 0;
+     recus = 0;
+     for ( k = 0; k < nCartes; k++ ) {
+        if ( cartes[k].recus < nBytes ) {
+           recus += horodatage ? viderCapture (&cartes[k]) :
+                                 viderAnneau (&cartes[k]);
+           actives += cartes[k].recus < nBytes;
+        }
+     }
+
+     // rien de nouveau, c'est le moment de vider les tampons de sortie;
+     // un bloc de capture n'est ecrit qu'apres un moment sans octets
+     if ( recus == 0 ) {
+        clock_gettime (CLOCK_MONOTONIC, &maintenant);
+        temps = ( maintenant.tv_sec - debutCapture.tv_sec ) * 1000000LL +
+                ( maintenant.tv_nsec - debutCapture.tv_nsec ) / 1000;
+        for ( k = 0; k < nCartes; k++ ) {
+           if ( horodatage && cartes[k].capture.nPaquets > 0 &&
+                temps - cartes[k].capture.tempsBloc > PERIODE_CAPTURE_US ) {
+              captureVider (&cartes[k].capture);
+           }
+           fflush (cartes[k].fp);
+        }
+        nanosleep (&attente, NULL);
+     }
+
+     // les compteurs de l'intervalle qui vient de finir
+     if ( periodeCompteurs > 0 ) {
+        clock_gettime (CLOCK_MONOTONIC, &maintenant);
+        if ( maintenant.tv_sec > prochainsCompteurs.tv_sec ||
+             ( maintenant.tv_sec == prochainsCompteurs.tv_sec &&
+               maintenant.tv_nsec >= prochainsCompteurs.tv_nsec ) ) {
+           for ( k = 0; k < nCartes; k++ ) {
+              if ( usbCompteursSerie (&cartes[k], compteurs) ) {
+                 afficherCompteurs (&cartes[k], "intervalle", compteurs);
+              }
+           }
+           prochainsCompteurs.tv_sec += periodeCompteurs;
+        }
+     }
+  } while ( actives > 0 );
+
+  arretLecture = true;
+  pthread_join (fil, NULL);
+
+  for ( k = 0; k < nCartes; k++ ) {
+     if ( horodatage ) {
+        captureVider (&cartes[k].capture);
+     }
+     fflush (cartes[k].fp);
+     if ( usbEtatSerie (cartes[k].p, &txLibre, &rxOccupe, &rxPerdus) ) {
+        cartes[k].perdus = rxPerdus;
+     }
+  }
+}
+
+// ecriture vers la carte en continu.  Les octets sont regroupes
+// en paquets de 8 (un octet de longueur et 7 de donnees) et plusieurs
+// paquets partent dans le meme transfert USB.  On n'envoie jamais plus
+// que la place libre annoncee par le firmware: le fifo de transmission
+// ne peut donc pas deborder, peu importe la vitesse serie.
+void ecritureEnContinu ( void )
+{
+  int i = 0;
+  int premier, j, n;
+  int txLibre, rxOccupe;
+  long rxPerdus;
+  int rtn;
+  unsigned char tampon[PAQUETS_PAR_TRANSFERT * USBASP_SERPACKETSIZE];
+  struct timespec tempSpec;
+  long long attenteNs;
+
+  while ( i < nOctetsEcriture ) {
+     if ( ! usbEtatSerie ( gestionUSB, &txLibre, &rxOccupe, &rxPerdus ) ) {
+        fprintf (stderr, "Erreur: le firmware du programmeur ne permet pas " );
+        fprintf (stderr, "l'option -c\n" );
+        usbFermer (gestionUSB);
+        exit (-1);
+     }
+
+     // pas assez de place, laisser le temps a l'UART de vider le fifo
+     // (plus d'une seconde a 300 baud: tv_nsec doit rester sous 1e9)
+     if ( txLibre < SEUIL_CONTINU && txLibre < nOctetsEcriture - i ) {
+        attenteNs = ( SEUIL_CONTINU - txLibre ) * DUREE_OCTET_NS;
+        tempSpec.tv_sec = attenteNs / 1000000000LL;
+        tempSpec.tv_nsec = attenteNs % 1000000000LL;
+        nanosleep (&tempSpec, NULL);
+        continue;
+     }
+
+     if ( txLibre > PAQUETS_PAR_TRANSFERT * USBASP_SERPAYLOAD ) {
+        txLibre = PAQUETS_PAR_TRANSFERT * USBASP_SERPAYLOAD;
+     }
+
+     // remplir autant de paquets que la place libre le permet, par
+     // tranches de 7 octets prises directement dans la projection
+     premier = i;
+     j = 0;
+     while ( txLibre > 0 && i < nOctetsEcriture ) {
+        n = USBASP_SERPAYLOAD;
+        if ( n > txLibre ) {
+           n = txLibre;
+        }
+        if ( n > nOctetsEcriture - i ) {
+           n = nOctetsEcriture - i;
+        }
+        tampon[j] = n;
+        memcpy (tampon + j + 1, donneesEcriture + i, n);
+        i += n;
+        txLibre -= n;
+        j += n + 1;
+     }
+
+     rtn = usbControle (gestionUSB, 0, USBASP_FUNC_WRITESER,
+                0, 0, tampon, j);
+
+     if ( rtn < 0 ) {
+       fprintf (stderr, "Erreur: problem de tansmission USB:" );
+       fprintf (stderr, " %s\n", usbErreur(rtn));
+       usbFermer (gestionUSB);
+       exit(-1);
+     }
+
+     // echo a l'ecran, hors du chemin critique: une seule ecriture
+     // sur stderr pour tout le transfert
+     if ( echo ) {
+        afficherOctets (stderr, donneesEcriture + premier, i - premier,
+                        premier);
+        fflush (stderr);
+     }
+  }
+}
+
+// le fichier a envoyer est projete en memoire: les paquets USB sont
+// remplis directement a partir de la projection, sans getc par octet
+void projeterFichier ( void )
+{
+  void *projection;
+
+  // mmap refuse une longueur nulle, et il n'y a alors rien a envoyer
+  if ( nOctetsEcriture == 0 ) {
+     return;
+  }
+
+  projection = mmap (NULL, nOctetsEcriture, PROT_READ, MAP_PRIVATE,
+                     fileno (fpFichier), 0);
+  if ( projection == MAP_FAILED ) {
+     fprintf (stderr, "Erreur: incapable de projeter le fichier %s ", fichier);
+     fprintf (stderr, "en memoire\n");
+     exit (-1);
+  }
+  madvise (projection, nOctetsEcriture, MADV_SEQUENTIAL);
+  donneesEcriture = (const unsigned char *) projection;
+}
+
+// avec -z, ce qui part vers la carte est le fichier compresse
+void compresserFichier ( void )
+{
+  unsigned char *compresse;
+
+  compresse = (unsigned char *) malloc (COMPRESSION_BORNE (nOctetsEcriture));
+  if ( compresse == NULL ) {
+     fprintf (stderr, "Erreur: pas assez de memoire pour compresser ");
+     fprintf (stderr, "le fichier %s\n", fichier);
+     exit (-1);
+  }
+  nOctetsEcriture = compression_compresser (donneesEcriture, nOctetsEcriture,
+                                            compresse);
+  donneesEcriture = compresse;
+}
+
+// en lecture et ecriture simultanees, l'envoi du fichier se fait
+// dans son propre fil
+void *filEcriture ( void * )
+{
+  ecritureEnContinu ();
+  return NULL;
+}
+
+// envoi vers la carte d'au plus n octets, sans depasser la place
+// libre dans le fifo de transmission du firmware.  Retourne le nombre
+// d'octets envoyes.
+int envoyerCarte ( const unsigned char *octets, int n )
+{
+  unsigned char tampon[PAQUETS_PAR_TRANSFERT * USBASP_SERPACKETSIZE];
+  int txLibre, rxOccupe;
+  long rxPerdus;
+  int i = 0;
+  int j = 0;
+  int m, rtn;
+
+  if ( ! usbEtatSerie (gestionUSB, &txLibre, &rxOccupe, &rxPerdus) ) {
+     return 0;
+  }
+  if ( txLibre > PAQUETS_PAR_TRANSFERT * USBASP_SERPAYLOAD ) {
+     txLibre = PAQUETS_PAR_TRANSFERT * USBASP_SERPAYLOAD;
+  }
+
+  while ( txLibre > 0 && i < n ) {
+     m = USBASP_SERPAYLOAD;
+     if ( m > txLibre ) {
+        m = txLibre;
+     }
+     if ( m > n - i ) {
+        m = n - i;
+     }
+     tampon[j] = m;
+     memcpy (tampon + j + 1, octets + i, m);
+     i += m;
+     txLibre -= m;
+     j += m + 1;
+  }
+  if ( j == 0 ) {
+     return 0;
+  }
+
+  rtn = usbControle (gestionUSB, 0, USBASP_FUNC_WRITESER, 0, 0, tampon, j);
+  if ( rtn < 0 ) {
+     fprintf (stderr, "Erreur: problem de tansmission USB:" );
+     fprintf (stderr, " %s\n", usbErreur(rtn));
+     usbFermer (gestionUSB);
+     exit(-1);
+  }
+  return i;
+}
+
+// trame_envoyer() et les ACK passent par ici, un octet a la fois.  Si
+// le tampon deborde, la trame est perdue et sera retransmise.
+void ajouterSortant ( void *, uint8_t octet )
+{
+  if ( nSortant < (int) sizeof (sortant) ) {
+     sortant[nSortant++] = octet;
+  }
+}
+
+// donnees recues de la carte, en ordre et sans double
+uint8_t livrerTrame ( void *, const uint8_t *donnees, uint8_t n )
+{
+  int m = n;
+
+  if ( m > nBytes - recusTrames ) {
+     m = nBytes - recusTrames;
+  }
+  afficherOctets (fpSortie, donnees, m, recusTrames);
+  recusTrames += m;
+  return 1;
+}
+
+// echange avec -P.  Le fil de lecture depose dans l'anneau les octets
+// de la carte; ce fil-ci les decode, remplit la fenetre de trames avec
+// le fichier a envoyer et pousse les octets encodes au rythme du fifo
+// de transmission, sans delai fixe: les pertes sont reparees par les
+// retransmissions plutot qu'evitees par prudence.
+void echangeTrames ( void )
+{
+  pthread_t fil;
+  unsigned char bloc[4096];
+  struct timespec attente = { 0, 1000000 }; // 1 ms
+  struct timespec debut, maintenant;
+  long ms, msDonnees = 0;
+  int envoyes = 0;
+  int n, m, j;
+
+  trame_init (&trameHote, ajouterSortant, livrerTrame, NULL);
+
+  // une fenetre complete aller-retour a la vitesse serie, plus le USB
+  trameHote.m_delai = 2 * TRAME_FENETRE *
+                      ( 2 * TRAME_MAX_DONNEES + TRAME_ENTETE + 2 ) *
+                      DUREE_OCTET_NS / 1000000 + 50;
+
+  anneauInit (&cartes[0].anneau);
+  if ( pthread_create (&fil, NULL, filLecture, NULL) != 0 ) {
+     fprintf (stderr, "Erreur: incapable de creer le fil de lecture\n");
+     usbFermer (gestionUSB);
+     exit (-1);
+  }
+  clock_gettime (CLOCK_MONOTONIC, &debut);
+
+  while ( ( ecriture && ( envoyes < nOctetsEcriture ||
+                          trame_libre (&trameHote) < TRAME_FENETRE ) ) ||
+          ( lecture && recusTrames < nBytes ) ) {
+     // ACK, NAK et trames de donnees de la carte
+     n = anneauLire (&cartes[0].anneau, bloc, sizeof (bloc));
+     for ( j = 0; j < n; j++ ) {
+        trame_recevoir_octet (&trameHote, bloc[j]);
+     }
+
+     // de nouvelles trames tant que la fenetre le permet
+     while ( ecriture && envoyes < nOctetsEcriture &&
+             trame_libre (&trameHote) > 0 ) {
+        m = nOctetsEcriture - envoyes;
+        if ( m > TRAME_MAX_DONNEES ) {
+           m = TRAME_MAX_DONNEES;
+        }
+        trame_envoyer (&trameHote, donneesEcriture + envoyes, m);
+        if ( echo ) {
+           afficherOctets (stderr, donneesEcriture + envoyes, m, envoyes);
+        }
+        envoyes += m;
+     }
+
+     clock_gettime (CLOCK_MONOTONIC, &maintenant);
+     ms = ( maintenant.tv_sec - debut.tv_sec ) * 1000 +
+          ( maintenant.tv_nsec - debut.tv_nsec ) / 1000000;
+     if ( ms > msDonnees ) {
+        trame_tic (&trameHote, ms - msDonnees);
+        msDonnees = ms;
+     }
+
+     m = 0;
+     if ( nSortant > 0 ) {
+        m = envoyerCarte (sortant, nSortant);
+        memmove (sortant, sortant + m, nSortant - m);
+        nSortant -= m;
+     }
+
+     if ( n == 0 && m == 0 ) {
+        if ( echo ) {
+           fflush (stderr);
+        }
+        fflush (fpSortie);
+        nanosleep (&attente, NULL);
+     }
+  }
+
+  // le dernier ACK de la carte peut encore etre en route
+  while ( nSortant > 0 ) {
+     m = envoyerCarte (sortant, nSortant);
+     memmove (sortant, sortant + m, nSortant - m);
+     nSortant -= m;
+  }
+
+  arretLecture = true;
+  pthread_join (fil, NULL);
+  fflush (fpSortie);
+
+  fprintf (stderr, "\nserieViaUSB : %u trames retransmises, ",
+           trameHote.m_retransmissions );
+  fprintf (stderr, "%u trames recues avec erreur\n", trameHote.m_erreurs );
+}
+
+void signalArret ( int )
+{
+  arretDemon = true;
+}
 
-/* fonction assez standard pour l'ouverture du port USB */
-int usbOuvrir()
+// socket Unix d'ecoute du demon
+int ouvrirSocket ( void )
 {
-  struct usb_bus    *bus;
-  struct usb_device *dev = 0;
-
-  /* facon de faire standard pour trouver le device USB et l'ouvrir... */
-  usb_init();
-  usb_find_busses();
-  usb_find_devices();
-  for(bus=usb_busses; bus; bus=bus->next){
-    for(dev=bus->devices; dev; dev=dev->next){
-      if(dev->descriptor.idVendor == USBDEV_VENDOR &&
-         dev->descriptor.idProduct == USBDEV_PRODUCT)
-        break;
-    }
-    if(dev)
-      break;
+  struct sockaddr_un adresse;
+  struct stat buf;
+  int s;
+
+  s = socket (AF_UNIX, SOCK_STREAM, 0);
+  if ( s < 0 ) {
+     fprintf (stderr, "Erreur: incapable de creer le socket: %s\n",
+              strerror (errno));
+     exit (-1);
   }
-  if( ! dev ) {
-    fprintf (stderr, "Erreur: incapable de trouver le peripherique USB ");
-    fprintf (stderr, "(vendor=0x%x product=0x%x)\n", USBDEV_VENDOR, USBDEV_PRODUCT);
-    exit (-1);
+
+  // un socket laisse par un demon precedent, mais jamais un autre fichier
+  if ( stat (socketDemon, &buf) == 0 && S_ISSOCK (buf.st_mode) ) {
+     unlink (socketDemon);
   }
 
-  // la documentation de libUSB donne des exemples de cette facon de faire
-  gestionUSB = usb_open(dev);
-  if ( ! gestionUSB ) {
-    fprintf (stderr, "Erreur: incapable d'ouvrir le port USB vers le ");
-    fprintf (stderr, "peripherique: %s\n", usb_strerror());
-    usb_close (gestionUSB);
-    exit (-1);
+  memset (&adresse, 0, sizeof (adresse));
+  adresse.sun_family = AF_UNIX;
+  strcpy (adresse.sun_path, socketDemon);
+  if ( bind (s, (struct sockaddr *) &adresse, sizeof (adresse)) != 0 ||
+       listen (s, MAX_CLIENTS) != 0 ) {
+     fprintf (stderr, "Erreur: incapable d'ecouter sur %s: %s\n",
+              socketDemon, strerror (errno));
+     exit (-1);
   }
+  return s;
+}
 
-  return 0;
+// retire les clients fermes (-1) du tableau
+int compacterClients ( int *clients, int nClients )
+{
+  int i, j = 0;
+
+  for ( i = 0; i < nClients; i++ ) {
+     if ( clients[i] >= 0 ) {
+        clients[j++] = clients[i];
+     }
+  }
+  return j;
 }
 
-int usbAjustementSerie (int baud, int bits, int parity)
+// mode demon: une seule ouverture et une seule configuration du
+// programmeur pour autant de clients qu'on veut.  filLecture garde ses
+// lectures en vol comme avec -l; ce fil-ci copie les octets recus aux
+// clients et envoie vers la carte ce que les clients ecrivent.
+void demon ( void )
 {
-  int nOctets;
-  unsigned char cmd[4];
-  char msg[4] = {0, 0, 0, 0};
-  // le firmware attend ces parametres, et dans cet ordre
-  cmd[0] = baud;
-  cmd[1] = bits;
-  cmd[2] = parity;
-  cmd[3] = 0;
+  pthread_t fil;
+  struct pollfd fds[1 + MAX_CLIENTS];
+  struct sigaction action;
+  int clients[MAX_CLIENTS];
+  int nClients = 0;
+  unsigned char envoi[4096];
+  int nEnvoi = 0;
+  unsigned char bloc[4096];
+  long recus = 0;
+  long envoyes = 0;
+  long deconnectes = 0;
+  int txLibre, rxOccupe;
+  long rxPerdus;
+  int ecoute, c, j, n;
 
-  // USBASP_FUNC_SETSERIOS ajuste les parametres USB (voir firmware)
-  nOctets = usb_control_msg (gestionUSB,
-             USB_TYPE_VENDOR | USB_RECIP_DEVICE | (1 << 7),
-             USBASP_FUNC_SETSERIOS,
-             (cmd[1] << 8) | cmd[0], (cmd[3] << 8) | cmd[2],
-             msg, 4, 5000);
+  if ( ! usbEtatSerie (gestionUSB, &txLibre, &rxOccupe, &rxPerdus) ) {
+     fprintf (stderr, "Erreur: le firmware du programmeur ne permet pas " );
+     fprintf (stderr, "l'option -D\n" );
+     usbFermer (gestionUSB);
+     exit (-1);
+  }
 
-  if ( nOctets < 0 ) {
-     fprintf(stderr, "Erreur: probleme de transmission USB: %s\n", usb_strerror());
-     usb_close (gestionUSB);
+  ecoute = ouvrirSocket ();
+
+  // sans SA_RESTART, poll() revient tout de suite avec EINTR
+  memset (&action, 0, sizeof (action));
+  action.sa_handler = signalArret;
+  sigaction (SIGINT, &action, NULL);
+  sigaction (SIGTERM, &action, NULL);
+
+  anneauInit (&cartes[0].anneau);
+  if ( pthread_create (&fil, NULL, filLecture, NULL) != 0 ) {
+     fprintf (stderr, "Erreur: incapable de creer le fil de lecture\n");
+     usbFermer (gestionUSB);
      exit (-1);
   }
 
-  // la configuration se confirme par un echo des parametres
-  // il faut donc verifier que l'on a bien recu ce qu'on attend...
-  if ( msg[0] == cmd[0] && msg[1] == cmd[1] &&
-       msg[2] == cmd[2] && msg[3] == msg[3] ) {
-     return 1;
+  fprintf (stderr, "serieViaUSB : en attente de clients sur %s\n",
+           socketDemon);
+
+  while ( ! arretDemon ) {
+     // de la carte vers tous les clients, sans jamais attendre: un
+     // client qui n'a plus de place est deconnecte plutot que de
+     // bloquer les autres et les lectures USB.  Un octet perdu au
+     // milieu du flot le tromperait plus qu'une deconnexion.
+     while ( ( n = anneauLire (&cartes[0].anneau, bloc, sizeof (bloc)) ) > 0 ) {
+        for ( j = 0; j < nClients; j++ ) {
+           if ( send (clients[j], bloc, n, MSG_NOSIGNAL) != n ) {
+              fprintf (stderr, "serieViaUSB : client trop lent, " );
+              fprintf (stderr, "deconnecte\n" );
+              close (clients[j]);
+              clients[j] = -1;
+              deconnectes++;
+           }
+        }
+        nClients = compacterClients (clients, nClients);
+        recus += n;
+     }
+
+     // des clients vers la carte, au rythme du fifo de transmission
+     if ( nEnvoi > 0 ) {
+        n = envoyerCarte (envoi, nEnvoi);
+        memmove (envoi, envoi + n, nEnvoi - n);
+        nEnvoi -= n;
+        envoyes += n;
+     }
+
+     // on ne lit plus les clients tant que le tampon d'envoi est plein
+     fds[0].fd = ecoute;
+     fds[0].events = POLLIN;
+     for ( j = 0; j < nClients; j++ ) {
+        fds[1 + j].fd = clients[j];
+        fds[1 + j].events = nEnvoi < (int) sizeof (envoi) ? POLLIN : 0;
+     }
+
+     // l'anneau n'a pas de descripteur: revenir le voir chaque ms
+     if ( poll (fds, 1 + nClients, 1) < 0 ) {
+        if ( errno == EINTR ) {
+           continue;
+        }
+        fprintf (stderr, "Erreur: poll: %s\n", strerror (errno));
+        break;
+     }
+
+     for ( j = 0; j < nClients; j++ ) {
+        if ( fds[1 + j].revents & ( POLLIN | POLLHUP | POLLERR ) ) {
+           n = read (clients[j], envoi + nEnvoi, sizeof (envoi) - nEnvoi);
+           if ( n < 0 && errno == EAGAIN ) {
+              continue;
+           }
+           if ( n <= 0 ) {
+              close (clients[j]);
+              clients[j] = -1;
+           }
+           else {
+              nEnvoi += n;
+           }
+        }
+     }
+     nClients = compacterClients (clients, nClients);
+
+     if ( fds[0].revents & POLLIN ) {
+        c = accept (ecoute, NULL, NULL);
+        if ( c >= 0 && nClients < MAX_CLIENTS ) {
+           n = TAMPON_CLIENT;
+           setsockopt (c, SOL_SOCKET, SO_SNDBUF, &n, sizeof (n));
+           fcntl (c, F_SETFL, fcntl (c, F_GETFL) | O_NONBLOCK);
+           clients[nClients++] = c;
+        }
+        else if ( c >= 0 ) {
+           close (c);
+        }
+     }
   }
 
-  return 0;
+  for ( j = 0; j < nClients; j++ ) {
+     close (clients[j]);
+  }
+  close (ecoute);
+  unlink (socketDemon);
+
+  arretLecture = true;
+  pthread_join (fil, NULL);
+
+  fprintf (stderr, "\n--------------------------------------------\n");
+  fprintf (stderr, "serieViaUSB : %ld octets ont ete transmis ", envoyes );
+  fprintf (stderr, "et %ld octets recus\n", recus );
+  if ( deconnectes > 0 ) {
+     fprintf (stderr, "serieViaUSB : %ld clients trop lents ont ete ",
+              deconnectes );
+     fprintf (stderr, "deconnectes\n" );
+  }
+  if ( cartes[0].perdus > 0 ) {
+     fprintf (stderr, "serieViaUSB : %ld octets de la carte ont ete perdus ",
+              cartes[0].perdus.load() );
+     fprintf (stderr, "par le programmeur (tampon de reception plein)\n" );
+  }
 }
 
 int analyseLigneDeCommande ( int argc, char *argv[] ) {
@@ -224,6 +1448,57 @@ int analyseLigneDeCommande ( int argc, char *argv[] ) {
             afficherAide();
          }
       }
+      // mode demon: -D | --demon <socket>
+      else if ( strcmp (argv[i], "-D") == 0 ||
+           strcmp (argv[i], "--demon") == 0 ) {
+         i++;
+         demonActif = true;
+         if ( i < argc && strlen( argv[i] ) < sizeof (socketDemon) ) {
+            strcpy ( socketDemon, argv[i] );
+         }
+         else {
+            fprintf (stderr, "Erreur: argument manquant pour -D ou --demon\n\n");
+            afficherAide();
+         }
+      }
+      // choix du programmeur: -u | --usb <bus:adresse | serie | tous>
+      else if ( strcmp (argv[i], "-u") == 0 ||
+           strcmp (argv[i], "--usb") == 0 ) {
+         i++;
+         if ( i < argc && strcmp (argv[i], "tous") == 0 ) {
+            tousLesProgrammeurs = true;
+         }
+         else if ( i < argc && nSelections < MAX_CARTES &&
+                   strlen( argv[i] ) < USB_LONGUEUR_NOM ) {
+            strcpy ( selections[nSelections++], argv[i] );
+         }
+         else {
+            fprintf (stderr, "Erreur: argument manquant ou trop de ");
+            fprintf (stderr, "programmeurs pour -u ou --usb\n\n");
+            afficherAide();
+         }
+      }
+      // liste des programmeurs branches: -L | --liste
+      else if ( strcmp (argv[i], "-L") == 0 ||
+                strcmp (argv[i], "--liste") == 0 ) {
+         if ( usbLister () == 0 ) {
+            fprintf (stderr, "aucun programmeur USBasp n'est branche\n");
+         }
+         exit (0);
+      }
+      // fichier de sortie pour la lecture: -o | --sortie <string>
+      else if ( strcmp (argv[i], "-o") == 0 ||
+           strcmp (argv[i], "--sortie") == 0 ) {
+         i++;
+         utiliseSortie = true;
+         if ( i < argc && strlen( argv[i] ) < 1023 ) {
+            strcpy ( fichierSortie, argv[i] );
+         }
+         else {
+            fprintf (stderr, "Erreur: argument manquant pour -o ou --sortie\n\n");
+            afficherAide();
+         }
+      }
       else if ( strcmp (argv[i], "-s") == 0 ||
            strcmp (argv[i], "--saut") == 0 ) {
          i++;
@@ -235,6 +1510,79 @@ int analyseLigneDeCommande ( int argc, char *argv[] ) {
             afficherAide();
          }
       }
+      // part du tampon pour la reception: -r | --reception <n>
+      else if ( strcmp (argv[i], "-r") == 0 ||
+           strcmp (argv[i], "--reception") == 0 ) {
+         i++;
+         if ( i < argc ) {
+            partReception = strtol ( argv[i], NULL, 10);
+            if ( partReception < 1 || partReception > 15 ) {
+               fprintf (stderr, "Erreur: l'option -r prend un nombre ");
+               fprintf (stderr, "de 1 a 15\n\n");
+               afficherAide();
+            }
+         }
+         else {
+            fprintf (stderr, "Erreur: argument manquant pour -r ou --reception\n\n");
+            afficherAide();
+         }
+      }
+      // vitesse serie: -v | --vitesse <baud>
+      else if ( strcmp (argv[i], "-v") == 0 ||
+           strcmp (argv[i], "--vitesse") == 0 ) {
+         i++;
+         if ( i < argc ) {
+            vitesseBaud = strtol ( argv[i], NULL, 10);
+            if ( modeVitesse (vitesseBaud) == 0 ) {
+               fprintf (stderr, "Erreur: vitesse incorrecte pour l'option -v\n\n");
+               afficherAide();
+            }
+         }
+         else {
+            fprintf (stderr, "Erreur: argument manquant pour -v ou --vitesse\n\n");
+            afficherAide();
+         }
+      }
+      // bits de donnees: -bits | --bits <n>
+      else if ( strcmp (argv[i], "-bits") == 0 ||
+           strcmp (argv[i], "--bits") == 0 ) {
+         i++;
+         if ( i < argc ) {
+            bitsDonnees = strtol ( argv[i], NULL, 10);
+            if ( bitsDonnees < 5 || bitsDonnees > 8 ) {
+               fprintf (stderr, "Erreur: le nombre de bits doit etre entre ");
+               fprintf (stderr, "5 et 8\n\n");
+               afficherAide();
+            }
+         }
+         else {
+            fprintf (stderr, "Erreur: argument manquant pour -bits ou --bits\n\n");
+            afficherAide();
+         }
+      }
+      // parite: -p | --parite <n|e|o>
+      else if ( strcmp (argv[i], "-p") == 0 ||
+           strcmp (argv[i], "--parite") == 0 ) {
+         i++;
+         if ( i < argc && strcmp (argv[i], "n") == 0 ) {
+            parite = USBASP_MODE_PARITYN;
+         }
+         else if ( i < argc && strcmp (argv[i], "e") == 0 ) {
+            parite = USBASP_MODE_PARITYE;
+         }
+         else if ( i < argc && strcmp (argv[i], "o") == 0 ) {
+            parite = USBASP_MODE_PARITYO;
+         }
+         else {
+            fprintf (stderr, "Erreur: argument manquant ou incorrect pour ");
+            fprintf (stderr, "-p ou --parite\n\n");
+            afficherAide();
+         }
+      }
+      else if ( strcmp (argv[i], "-a") == 0 ||
+                strcmp (argv[i], "--auto") == 0 ) {
+         negociation = true;
+      }
       // mode lecture: -l | --lecture
       else if ( strcmp (argv[i], "-l") == 0 ||
                 strcmp (argv[i], "--lecture") == 0 ) {
@@ -244,6 +1592,62 @@ int analyseLigneDeCommande ( int argc, char *argv[] ) {
                 strcmp (argv[i], "--ecriture") == 0 ) {
          ecriture = true;
       }
+      else if ( strcmp (argv[i], "-i") == 0 ||
+                strcmp (argv[i], "--interruption") == 0 ) {
+         interruption = true;
+      }
+      else if ( strcmp (argv[i], "-t") == 0 ||
+                strcmp (argv[i], "--horodatage") == 0 ) {
+         horodatage = true;
+      }
+      else if ( strcmp (argv[i], "-x") == 0 ||
+                strcmp (argv[i], "--xonxoff") == 0 ) {
+         i++;
+         if ( i < argc ) {
+            margeXonXoff = strtol ( argv[i], NULL, 10);
+            if ( margeXonXoff < 1 || margeXonXoff > USBASP_SERMARGE (0xFF) ) {
+               fprintf (stderr, "Erreur: l'option -x prend un nombre ");
+               fprintf (stderr, "d'octets de 1 a %d\n\n", USBASP_SERMARGE (0xFF));
+               afficherAide();
+            }
+         }
+         else {
+            fprintf (stderr, "Erreur: argument manquant pour -x ou --xonxoff\n\n");
+            afficherAide();
+         }
+      }
+      else if ( strcmp (argv[i], "-S") == 0 ||
+                strcmp (argv[i], "--statistiques") == 0 ) {
+         i++;
+         if ( i < argc ) {
+            periodeCompteurs = strtol ( argv[i], NULL, 10);
+            if ( periodeCompteurs < 1 ) {
+               fprintf (stderr, "Erreur: l'option -S prend un nombre ");
+               fprintf (stderr, "de secondes\n\n");
+               afficherAide();
+            }
+         }
+         else {
+            fprintf (stderr, "Erreur: argument manquant pour -S ou --statistiques\n\n");
+            afficherAide();
+         }
+      }
+      else if ( strcmp (argv[i], "-P") == 0 ||
+                strcmp (argv[i], "--protocole") == 0 ) {
+         protocole = true;
+      }
+      else if ( strcmp (argv[i], "-z") == 0 ||
+                strcmp (argv[i], "--compression") == 0 ) {
+         compression = true;
+      }
+      else if ( strcmp (argv[i], "-q") == 0 ||
+                strcmp (argv[i], "--silencieux") == 0 ) {
+         echo = false;
+      }
+      else if ( strcmp (argv[i], "-c") == 0 ||
+                strcmp (argv[i], "--continu") == 0 ) {
+         continu = true;
+      }
       else if ( strcmp (argv[i], "-h") == 0 ||
                 strcmp (argv[i], "--hexadecimal") == 0 ) {
          modeAffichage = HEX;
@@ -265,18 +1669,96 @@ int analyseLigneDeCommande ( int argc, char *argv[] ) {
    // determiner la lecture et/ou l'ecriture et ajuster
    // la lecture ou l'ecriture dans le fichier en consequence au besoin
    char modeFichier[4] = "";
-   if ( lecture == ecriture ) {
-      fprintf (stderr, "Erreur: exactement une option, -l ou -e ");
+   if ( demonActif == true ) {
+      // le demon ne fait que relayer les octets entre le socket et la carte
+      if ( lecture || ecriture || utiliseFichier || utiliseSortie ||
+           horodatage || continu || protocole || compression ) {
+         fprintf (stderr, "Erreur: l'option -D ne s'utilise pas avec ");
+         fprintf (stderr, "-l, -e, -f, -o, -t, -c, -P ou -z\n");
+         afficherAide();
+      }
+      // demon() ne relaie qu'une carte: les autres rempliraient leur
+      // anneau jusqu'a bloquer le fil de libusb
+      else if ( plusieursProgrammeurs () ) {
+         fprintf (stderr, "Erreur: l'option -D s'utilise avec un seul ");
+         fprintf (stderr, "programmeur\n");
+         afficherAide();
+      }
+      // les clients envoient n'importe quels octets a la carte
+      else if ( margeXonXoff > 0 ) {
+         fprintf (stderr, "Erreur: l'option -x ne s'utilise pas avec -D\n");
+         afficherAide();
+      }
+      return 1;
+   }
+   else if ( lecture == false && ecriture == false ) {
+      fprintf (stderr, "Erreur: au moins une option, -l ou -e, ");
       fprintf (stderr, "doit etre specifiee\n");
       afficherAide();
    }
-   else if ( lecture == true ) {
-      strcpy (modeFichier, "w");
-      fpFichier = stdout;
+   else if ( compression == true && ecriture == false ) {
+      fprintf (stderr, "Erreur: l'option -z s'utilise uniquement avec -e\n");
+      afficherAide();
+   }
+   else if ( continu == true && ecriture == false ) {
+      fprintf (stderr, "Erreur: l'option -c s'utilise uniquement avec -e\n");
+      afficherAide();
+   }
+   // -e, -z et -P envoient des donnees binaires ou 0x11 et 0x13 sont
+   // des octets comme les autres, que la carte ne doit pas retirer
+   else if ( margeXonXoff > 0 && ( ecriture == true || protocole == true ) ) {
+      fprintf (stderr, "Erreur: l'option -x ne s'utilise pas avec -e, ");
+      fprintf (stderr, "-z ou -P\n");
+      afficherAide();
+   }
+   else if ( interruption == true && lecture == false ) {
+      fprintf (stderr, "Erreur: l'option -i s'utilise uniquement avec -l\n");
+      afficherAide();
+   }
+   else if ( periodeCompteurs > 0 && ( lecture == false || protocole == true ) ) {
+      fprintf (stderr, "Erreur: l'option -S s'utilise uniquement avec -l, ");
+      fprintf (stderr, "sans -P\n");
+      afficherAide();
+   }
+   else if ( plusieursProgrammeurs () &&
+             ( lecture == false || ecriture == true || negociation == true ||
+               utiliseSortie == false ) ) {
+      fprintf (stderr, "Erreur: avec plusieurs programmeurs, seule la ");
+      fprintf (stderr, "lecture -l est possible, sans -a, et -o donne le\n");
+      fprintf (stderr, "       debut du nom des fichiers\n");
+      afficherAide();
+   }
+   else if ( protocole == true &&
+             ( horodatage == true || plusieursProgrammeurs () ) ) {
+      fprintf (stderr, "Erreur: l'option -P ne s'utilise pas avec -t ");
+      fprintf (stderr, "ni avec plusieurs programmeurs\n");
+      afficherAide();
+   }
+   else if ( horodatage == true && lecture == false ) {
+      fprintf (stderr, "Erreur: l'option -t s'utilise uniquement avec -l\n");
+      afficherAide();
+   }
+   else if ( horodatage == true && ( modeAffichage != BYTE || nbSauts ) ) {
+      fprintf (stderr, "Erreur: l'option -t ne s'utilise pas avec ");
+      fprintf (stderr, "-h, -d, -b ou -s\n");
+      afficherAide();
+   }
+   else if ( utiliseSortie == true && lecture == false ) {
+      fprintf (stderr, "Erreur: l'option -o s'utilise uniquement avec -l\n");
+      afficherAide();
    }
    else if ( ecriture == true ) {
       strcpy (modeFichier, "r");
       fpFichier = stdin;
+      // en lecture et ecriture simultanees, les ecritures doivent etre
+      // rythmees par la place libre pour ne pas bloquer les lectures
+      if ( lecture == true ) {
+         continu = true;
+      }
+   }
+   else if ( lecture == true ) {
+      strcpy (modeFichier, "w");
+      fpFichier = stdout;
    }
 
    // Ouverture du fichier, si necessaire
@@ -289,6 +1771,26 @@ int analyseLigneDeCommande ( int argc, char *argv[] ) {
       }
    }
 
+   // destination des octets recus; avec plusieurs programmeurs, les
+   // fichiers sont ouverts avec les programmeurs
+   if ( plusieursProgrammeurs () ) {
+      fpSortie = NULL;
+   }
+   else if ( utiliseSortie == true ) {
+      fpSortie = fopen (fichierSortie, "w");
+      if ( fpSortie == NULL ) {
+         fprintf (stderr, "Erreur: probleme en essayant d'ouvrir le fichier" );
+         fprintf (stderr, " %s\n", fichierSortie);
+         afficherAide();
+      }
+   }
+   else if ( ecriture == false ) {
+      fpSortie = fpFichier;
+   }
+   else {
+      fpSortie = stdout;
+   }
+
    // le cas de l'ecriture est un peu special
    if ( ecriture == true ) {
       // l'ecriture doit implique un fichier en entree
@@ -306,8 +1808,18 @@ int analyseLigneDeCommande ( int argc, char *argv[] ) {
             fprintf (stderr, "sur le fichier %s\n", fichier);
             exit (-1);
          }
-         if ( buf.st_size < nBytes ) {
-            nBytes = buf.st_size;
+         nOctetsEcriture = nBytes;
+         if ( buf.st_size < nOctetsEcriture ) {
+            nOctetsEcriture = buf.st_size;
+         }
+         projeterFichier ();
+         nOctetsFichier = nOctetsEcriture;
+         if ( compression ) {
+            compresserFichier ();
+         }
+         // sans lecture, tout se termine avec le dernier octet envoye
+         if ( lecture == false ) {
+            nBytes = nOctetsEcriture;
          }
       } 
    }
@@ -315,135 +1827,198 @@ int analyseLigneDeCommande ( int argc, char *argv[] ) {
    return 1; // succes
 }
 
+// ouverture des programmeurs choisis par -u (le premier trouve par
+// defaut) et des fichiers ou vont leurs octets
+void ouvrirProgrammeurs ( void )
+{
+  PeripheriqueUSB *liste[MAX_CARTES];
+  char nomFichier[sizeof (fichierSortie) + USB_LONGUEUR_NOM + 1];
+  int k;
+
+  if ( tousLesProgrammeurs ) {
+     nCartes = usbOuvrirTous (liste, MAX_CARTES);
+     if ( nCartes == 0 ) {
+        fprintf (stderr, "Erreur: aucun programmeur USBasp n'est branche\n");
+        exit (-1);
+     }
+  }
+  else if ( nSelections == 0 ) {
+     liste[0] = usbOuvrir (NULL);
+     if ( liste[0] == NULL ) {
+        exit (-1);
+     }
+     nCartes = 1;
+  }
+  else {
+     for ( k = 0; k < nSelections; k++ ) {
+        liste[k] = usbOuvrir (selections[k]);
+        if ( liste[k] == NULL ) {
+           exit (-1);
+        }
+     }
+     nCartes = nSelections;
+  }
+
+  for ( k = 0; k < nCartes; k++ ) {
+     cartes[k].p = liste[k];
+     strcpy (cartes[k].nom, usbNom (liste[k]));
+     cartes[k].perdus = -1;
+
+     // un fichier par programmeur: le nom de -o suivi du sien
+     if ( plusieursProgrammeurs () ) {
+        snprintf (nomFichier, sizeof (nomFichier), "%s.%s",
+                  fichierSortie, cartes[k].nom);
+        cartes[k].fp = fopen (nomFichier, "w");
+        if ( cartes[k].fp == NULL ) {
+           fprintf (stderr, "Erreur: probleme en essayant d'ouvrir le fichier" );
+           fprintf (stderr, " %s\n", nomFichier);
+           exit (-1);
+        }
+     }
+     else {
+        cartes[k].fp = fpSortie;
+     }
+  }
+  gestionUSB = cartes[0].p;
+}
+
 int main ( int argc, char *argv[] ) {
 
    // commencer par analyser les options sur la ligne de commande...
    if ( ! analyseLigneDeCommande ( argc, argv ) )
       return -1;
+   formatageInit (modeAffichage, nbSauts);
 
    /* OK, ouvrir tout ce qui est USB... */
-   usbOuvrir();
-   if ( usbAjustementSerie(USBASP_MODE_SETBAUD2400,
-                           USBASP_MODE_UART8BIT, USBASP_MODE_PARITYN ) ) {
+   ouvrirProgrammeurs ();
+   if ( negociation ) {
+      negocierVitesse ();
+   }
+   int c;
+   for ( c = 0; c < nCartes; c++ ) {
+      if ( ! usbAjustementSerie(cartes[c].p, modeVitesse (vitesseBaud),
+                           USBASP_MODE_UART5BIT + bitsDonnees - 5, parite,
+                           optionsSerie () ) ) {
+         break;
+      }
+   }
+   if ( c == nCartes ) {
+      if ( nCartes > 1 ) {
+         fprintf (stderr, "OK: %d programmeurs:", nCartes);
+         for ( c = 0; c < nCartes; c++ ) {
+            fprintf (stderr, " %s", cartes[c].nom);
+         }
+         fprintf (stderr, "\n");
+      }
       fprintf (stderr, "OK: le peripherique USB est reconnu et la\n");
-      fprintf (stderr, "    communication serie doit se faire a 2400 baud,\n");
-      fprintf (stderr, "    8 bits et sans parite.\n" );
+      fprintf (stderr, "    communication serie doit se faire a %d baud,\n",
+               vitesseBaud);
+      fprintf (stderr, "    %d bits et %s.\n", bitsDonnees,
+               parite == USBASP_MODE_PARITYE ? "parite paire" :
+               parite == USBASP_MODE_PARITYO ? "parite impaire" :
+                                               "sans parite" );
       fprintf (stderr, "--------------------------------------------\n");
    }
    else {
-      fprintf(stderr, "Erreur: incapable d'ajuster la communication serie\n");
+      fprintf(stderr, "Erreur: incapable d'ajuster la communication serie");
+      fprintf(stderr, " (%s)\n", cartes[c].nom);
       exit (-1);
    }
    fflush(0);
 
+   // le point d'acces interrupt-in appartient a l'interface 0
+   int rtn;
+   for ( c = 0; c < nCartes && interruption; c++ ) {
+      if ( ( rtn = usbReserverInterface (cartes[c].p) ) < 0 ) {
+         fprintf (stderr, "Erreur: incapable de reserver l'interface USB ");
+         fprintf (stderr, "(%s): %s\n", cartes[c].nom, usbErreur(rtn));
+         exit (-1);
+      }
+   }
+
+   if ( demonActif ) {
+      demon ();
+      fflush(0);
+      usbFermer (gestionUSB);
+      return 0;
+   }
+
    // lecture et/ou ecriture sans fin
    int i = 0;
    int j = 0;
    int k = 0;
-   int rtn;
-   int grandeurTampon = 8;
-   unsigned char tampon[grandeurTampon];
+   int grandeurTampon = USBASP_SERPACKETSIZE;
+   unsigned char tampon[USBASP_SERPACKETSIZE];
+   struct timespec debut;
    struct timespec tempSpec;
    tempSpec.tv_sec = 0;
    tempSpec.tv_nsec = 80000000; // 50 ms
 
+   // l'echo des octets envoyes passe par un tampon plutot que
+   // par un appel systeme pour chaque octet
+   if ( ecriture && echo ) {
+      setvbuf (stderr, tamponEcho, _IOFBF, sizeof (tamponEcho));
+   }
+
+   clock_gettime (CLOCK_MONOTONIC, &debut);
+
+   // trames confirmees dans un sens ou dans les deux
+   if ( protocole ) {
+      echangeTrames ();
+      if ( lecture ) {
+         nBytes = recusTrames;
+      }
+      i = nBytes;
+   }
+   // lecture et ecriture en meme temps: un fil envoie le fichier
+   // pendant que le fil de lecture garde ses READSER en vol
+   else if ( lecture && ecriture ) {
+      pthread_t fil;
+      if ( pthread_create (&fil, NULL, filEcriture, NULL) != 0 ) {
+         fprintf (stderr, "Erreur: incapable de creer le fil d'ecriture\n");
+         usbFermer (gestionUSB);
+         exit (-1);
+      }
+      lectureAvecFil ();
+      pthread_join (fil, NULL);
+      i = nBytes;
+   }
+   // le PC recoit les donnees de la carte
+   else if ( lecture ) {
+      lectureAvecFil ();
+      i = nBytes;
+   }
+   // l'ecriture en continu remplace la boucle avec delai fixe
+   else if ( continu ) {
+      ecritureEnContinu ();
+      i = nBytes;
+   }
+
    while ( i < nBytes ) {
      // mettre 0xFF dans tout le tampon
-     grandeurTampon = 8;
+     grandeurTampon = USBASP_SERPACKETSIZE;
      memset (tampon, 0xFF, grandeurTampon);
 
-     // lecture - le PC recoit les donnees de la carte
-     if ( lecture ) {
-        rtn = usb_control_msg (gestionUSB,
-                   USB_TYPE_VENDOR | USB_RECIP_DEVICE | (1 << 7),
-                   USBASP_FUNC_READSER,
-                   0, 0, (char *)tampon,
-                   grandeurTampon, 5000);
-        if ( rtn < 0 ){
-          fprintf (stderr, "Erreur: problem de tansmission USB:" );
-          fprintf (stderr, " %s\n", usb_strerror());
-          usb_close (gestionUSB);
-          exit(-1);
-        }
-
-        /* le premier octet donne le nombre d'octets vraiment transferes 
-           (au maximum 7) */
-        if ( tampon[0] < grandeurTampon ) {
-           grandeurTampon = tampon[0] + 1;
-        }
-
-        j = 1;
-        while ( j < grandeurTampon && i < nBytes ) {
-          switch( modeAffichage )
-          {
-              case HEX:
-                  fprintf(fpFichier, "%#04x ", tampon[j]);
-                  break;
-
-              case DEC:
-                  fprintf(fpFichier, "%#04d ", tampon[j]);
-                  break;
-
-              case BIN:
-                  fprintf(fpFichier, "%s ", charToBin(tampon[j]));
-                  break;
-
-              case BYTE:
-              default:
-                  fputc (tampon[j], fpFichier);
-          }
-        
-          if( nbSauts ) {
-              if( ( (i+1) % nbSauts) == 0 ) { fputc ('\n', fpFichier); }
-          }
-
-          i++;
-          j++;
-        }
-      }
       // le PC envoie les donnees vers la carte
       if ( ecriture ) {
-        // remplir le tampon - fpFichier ne peut etre stdin
-        j = 1;
-        while ( j < grandeurTampon && i < nBytes ) {
-          tampon[j] = getc (fpFichier);
-          i++;
-          j++;
+        // remplir le tampon a partir de la projection du fichier
+        k = i;
+        j = grandeurTampon - 1;
+        if ( j > nBytes - i ) {
+          j = nBytes - i;
         }
-        tampon[0] = j - 1;
+        memcpy (tampon + 1, donneesEcriture + i, j);
+        tampon[0] = j;
+        i += j;
+        j++;
 
         // on envoie vers l'USB  0 == envoie
-        rtn = usb_control_msg (gestionUSB,
-                   USB_TYPE_VENDOR | USB_RECIP_DEVICE | (0 << 7),
-                   USBASP_FUNC_WRITESER,
-                   0, 0, (char *)tampon, j, 5000);
+        rtn = usbControle (gestionUSB, 0, USBASP_FUNC_WRITESER,
+                   0, 0, tampon, j);
 
         // echo a l'ecran, pas strictement necessaire mais interessant
-        for ( k = 0; k < j; k++ )
-        {
-          switch( modeAffichage )
-          {
-              case HEX:
-                  fprintf(stderr, "%#04x ", tampon[k]);
-                  break;
-
-              case DEC:
-                  fprintf(stderr, "%#04d ", tampon[k]);
-                  break;
-
-              case BIN:
-                  fprintf(stderr, "%s ", charToBin(tampon[k]));
-                  break;
-
-              case BYTE:
-              default:
-                  fputc (tampon[k], stderr);
-           }
-
-           if( nbSauts ) {
-               if( ( (k+1) % nbSauts) == 0 ) { fputc ('\n', stderr); }
-           }
-
+        if ( echo ) {
+          afficherOctets (stderr, tampon + 1, j - 1, k);
         }
 
         // il faut que la carte ecrive les octets en memoire
@@ -455,8 +2030,8 @@ int main ( int argc, char *argv[] ) {
 
         if ( rtn < 0 ) {
           fprintf (stderr, "Erreur: problem de tansmission USB:" );
-          fprintf (stderr, " %s\n", usb_strerror());
-          usb_close (gestionUSB);
+          fprintf (stderr, " %s\n", usbErreur(rtn));
+          usbFermer (gestionUSB);
           exit(-1);
         }
       } /* while */
@@ -466,11 +2041,59 @@ int main ( int argc, char *argv[] ) {
 
    // rapport indiquant que la transmission est terminee
    fprintf (stderr, "\n--------------------------------------------\n");
-   fprintf (stderr, "serieViaUSB : %d octets ont ete transmis ", nBytes );
-   fprintf (stderr, "ou recus\n" );
+   if ( lecture && ecriture ) {
+      fprintf (stderr, "serieViaUSB : %d octets ont ete transmis ", nOctetsEcriture );
+      fprintf (stderr, "et %d octets recus\n", nBytes );
+   }
+   else if ( nCartes > 1 ) {
+      for ( c = 0, i = 0; c < nCartes; c++ ) {
+         fprintf (stderr, "serieViaUSB : %s : %d octets recus\n",
+                  cartes[c].nom, cartes[c].recus );
+         i += cartes[c].recus;
+      }
+      nBytes = i;
+   }
+   else {
+      fprintf (stderr, "serieViaUSB : %d octets ont ete transmis ", nBytes );
+      fprintf (stderr, "ou recus\n" );
+   }
+   for ( c = 0; c < nCartes && lecture; c++ ) {
+      if ( cartes[c].perdus > 0 ) {
+         fprintf (stderr, "serieViaUSB : %ld octets de la carte ", cartes[c].perdus.load() );
+         if ( nCartes > 1 ) {
+            fprintf (stderr, "%s ", cartes[c].nom );
+         }
+         fprintf (stderr, "ont ete perdus " );
+         fprintf (stderr, "par le programmeur (tampon de reception plein)\n" );
+      }
+   }
+   // les compteurs de toute la session, si le firmware les tient
+   for ( c = 0; c < nCartes; c++ ) {
+      unsigned long compteurs[USBASP_SERSTAT_N];
+      usbCompteursSerie (&cartes[c], compteurs);
+      if ( cartes[c].avecCompteurs ) {
+         afficherCompteurs (&cartes[c], "ligne serie", cartes[c].compteurs);
+      }
+   }
+   // le gain se mesure sur la liaison serie, qui est le goulot
+   if ( compression && nOctetsFichier > 0 ) {
+      fprintf (stderr, "serieViaUSB : compression de %d a %d octets (%.1f %%), ",
+               nOctetsFichier, nOctetsEcriture,
+               100.0 * nOctetsEcriture / nOctetsFichier );
+      fprintf (stderr, "%.2f s au lieu de %.2f s a %d baud\n",
+               nOctetsEcriture * DUREE_OCTET_NS / 1e9,
+               nOctetsFichier * DUREE_OCTET_NS / 1e9, vitesseBaud );
+   }
+   rapportPerformance (lecture && ecriture ? nBytes + nOctetsEcriture : nBytes,
+                       &debut);
    fflush(0);
 
-   usb_close (gestionUSB);
+   for ( c = 0; c < nCartes; c++ ) {
+      if ( plusieursProgrammeurs () ) {
+         fclose (cartes[c].fp);
+      }
+      usbFermer (cartes[c].p);
+   }
    return 0;
 }
 
@@ -0,0 +1,281 @@
+/*
+    transportFirmware: le programmeur est le vrai firmware (main.c,
+                       fifo.c, usart.c, isp.c, clock.c) compile pour le
+                       PC, avec les modeles de
+                       usbaspPoly/firmware/hote.  Il se lie a la place
+                       de transportUSB.cc (make firmware ou make banc).
+                       TX est relie a RX: la carte renvoie chaque octet.
+                       Avec la variable d'environnement
+                       SERIEVIAUSB_SOURCE=<n>, la carte envoie plutot n
+                       octets des le SETSERIOS, dos a dos, en obeissant
+                       a XON/XOFF (hote_source), pour mesurer la
+                       reception seule (make banc-lecture).
+
+                       A la fermeture, une ligne resume l'echange:
+                       octets/s sur la ligne serie, latence des requetes
+                       de controle (percentiles, en us), octets perdus
+                       par le USART (DOR) et par le fifo du firmware.
+
+    Jerome Collin
+    Modifications, banc d'essai
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <usbcmd.h>
+#include <transportUSB.h>
+#include <hote.h>
+
+// latences gardees pour les percentiles; au-dela, on ne garde plus
+#define MAX_LATENCES  ( 1 << 20 )
+
+struct PeripheriqueUSB
+{
+   int lectureActive;
+   int interruption;
+   int longueur;
+   RappelLecture rappel;
+   void *contexte;
+   int erreur;
+
+   int baud;
+   struct timespec debut;     // dernier SETSERIOS
+};
+
+static const int vitesses[] = { 300, 600, 1200, 2400, 4800, 9600,
+                                19200, 38400, 57600, 115200 };
+
+// un seul firmware par processus: ses variables sont globales
+static PeripheriqueUSB *ouvert = NULL;
+static int demarre = false;
+
+// SERIEVIAUSB_SOURCE: ce que la carte envoie, valide jusqu'a la fin
+static unsigned char *source = NULL;
+
+static pthread_mutex_t verrouLatences = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int *latences = NULL;
+static int nLatences = 0;
+
+static double depuis ( const struct timespec *debut )
+{
+  struct timespec maintenant;
+
+  clock_gettime (CLOCK_MONOTONIC, &maintenant);
+  return ( maintenant.tv_sec - debut->tv_sec ) +
+         ( maintenant.tv_nsec - debut->tv_nsec ) / 1e9;
+}
+
+static int comparer ( const void *a, const void *b )
+{
+  unsigned int x = *(const unsigned int *) a;
+  unsigned int y = *(const unsigned int *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+static unsigned int percentile ( int p )
+{
+  return latences[(long) ( nLatences - 1 ) * p / 100];
+}
+
+int usbLister ( void )
+{
+  fprintf (stderr, "programmeur 1:1  serie: firmware (compile pour le PC)\n");
+  return 1;
+}
+
+PeripheriqueUSB *usbOuvrir ( const char *selection )
+{
+  if ( selection != NULL && strcmp (selection, "1:1") != 0 &&
+       strcmp (selection, "firmware") != 0 ) {
+    fprintf (stderr, "Erreur: incapable de trouver le peripherique USB ");
+    fprintf (stderr, "%s\n", selection);
+    return NULL;
+  }
+  if ( ouvert != NULL )
+    return NULL;
+
+  ouvert = (PeripheriqueUSB *) calloc (1, sizeof (PeripheriqueUSB));
+  ouvert->baud = 2400;
+  clock_gettime (CLOCK_MONOTONIC, &ouvert->debut);
+  if ( latences == NULL )
+    latences = (unsigned int *) malloc (MAX_LATENCES * sizeof (unsigned int));
+  if ( ! demarre ) {
+    hote_demarrer ();
+    demarre = true;
+  }
+  fprintf (stderr, "serieViaUSB : firmware compile pour le PC\n");
+  return ouvert;
+}
+
+int usbOuvrirTous ( PeripheriqueUSB **liste, int max )
+{
+  if ( max < 1 || ( liste[0] = usbOuvrir (NULL) ) == NULL )
+    return 0;
+  return 1;
+}
+
+const char *usbNom ( PeripheriqueUSB * )
+{
+  return "firmware";
+}
+
+void usbFermer ( PeripheriqueUSB *p )
+{
+  HoteStatistiques s;
+  double duree;
+
+  if ( p == NULL )
+    return;
+
+  hote_statistiques (&s);
+  duree = depuis (&p->debut);
+  pthread_mutex_lock (&verrouLatences);
+  qsort (latences, nLatences, sizeof (unsigned int), comparer);
+  fprintf (stderr, "banc: %6d baud %8.0f octets/s  %6d requetes",
+           p->baud, ( s.m_envoyes + s.m_recus ) / duree, nLatences);
+  if ( nLatences > 0 ) {
+    fprintf (stderr, "  latence p50 %5u p90 %5u p99 %5u max %6u us",
+             percentile (50), percentile (90), percentile (99),
+             latences[nLatences - 1]);
+  }
+  fprintf (stderr, "  DOR %lu  fifo %lu", s.m_dor, s.m_pertesFifo);
+  if ( s.m_tempsPerdu > 0.01 * duree ) {
+    fprintf (stderr, "  (fil du firmware arrete %.0f %% du temps)",
+             100 * s.m_tempsPerdu / duree);
+  }
+  fprintf (stderr, "\n");
+  nLatences = 0;
+  pthread_mutex_unlock (&verrouLatences);
+
+  free (p);
+  ouvert = NULL;
+}
+
+const char *usbErreur ( int )
+{
+  return "requete refusee par le firmware";
+}
+
+int usbControle ( PeripheriqueUSB *p, int entrant, int requete,
+                  int valeur, int index,
+                  unsigned char *tampon, int longueur )
+{
+  unsigned char setup[8];
+  struct timespec debut;
+  double duree;
+  int rtn;
+
+  // type vendeur, destinataire le peripherique, comme transportUSB.cc
+  setup[0] = 0x40 | ( entrant ? 0x80 : 0 );
+  setup[1] = requete;
+  setup[2] = valeur;
+  setup[3] = valeur >> 8;
+  setup[4] = index;
+  setup[5] = index >> 8;
+  setup[6] = longueur;
+  setup[7] = longueur >> 8;
+
+  clock_gettime (CLOCK_MONOTONIC, &debut);
+  rtn = hote_controle (setup, tampon);
+  duree = depuis (&debut);
+
+  pthread_mutex_lock (&verrouLatences);
+  if ( nLatences < MAX_LATENCES )
+    latences[nLatences++] = (unsigned int) ( duree * 1e6 );
+  pthread_mutex_unlock (&verrouLatences);
+
+  // la vitesse et le debut de l'echange, pour le resume
+  if ( requete == USBASP_FUNC_SETSERIOS && rtn >= 1 &&
+       tampon[0] >= USBASP_MODE_SETBAUD300 &&
+       tampon[0] <= USBASP_MODE_SETBAUD115200 ) {
+    p->baud = vitesses[tampon[0] - USBASP_MODE_SETBAUD300];
+    clock_gettime (CLOCK_MONOTONIC, &p->debut);
+    if ( getenv ("SERIEVIAUSB_SOURCE") != NULL ) {
+      long i, n = atol (getenv ("SERIEVIAUSB_SOURCE"));
+      free (source);
+      source = (unsigned char *) malloc (n > 0 ? n : 1);
+      for ( i = 0; i < n; i++ )
+        source[i] = i;
+      hote_source (source, n);
+    }
+  }
+  return rtn;
+}
+
+int usbReserverInterface ( PeripheriqueUSB * )
+{
+  return 0;
+}
+
+int usbDemarrerLecture ( PeripheriqueUSB *p, int interruption,
+                         int, int longueur,
+                         RappelLecture rappel, void *contexte )
+{
+  p->interruption = interruption;
+  p->longueur = longueur;
+  p->rappel = rappel;
+  p->contexte = contexte;
+  p->erreur = 0;
+  p->lectureActive = 1;
+  return 0;
+}
+
+void usbArreterLecture ( PeripheriqueUSB *p )
+{
+  p->lectureActive = 0;
+}
+
+int usbErreurLecture ( PeripheriqueUSB *p )
+{
+  return p->erreur;
+}
+
+// le endpoint 0 ne fait qu'une requete a la fois: une seule lecture
+// en vol suffit, et elle alterne avec les ecritures des autres fils
+int usbEvenements ( int )
+{
+  struct timespec attente = { 0, 1000000 }; // 1 ms
+  unsigned char tampon[1 << 12];
+  PeripheriqueUSB *p = ouvert;
+  int i, n, rtn;
+
+  if ( p == NULL || ! p->lectureActive ) {
+    nanosleep (&attente, NULL);
+    return 0;
+  }
+
+  if ( p->interruption ) {
+    rtn = hote_interruption (tampon);
+    if ( rtn > 0 )
+      p->rappel (p, tampon, rtn, p->contexte);
+    else
+      nanosleep (&attente, NULL);
+    return 0;
+  }
+
+  n = p->longueur;
+  if ( n > (int) sizeof (tampon) )
+    n = sizeof (tampon);
+  rtn = usbControle (p, 1, USBASP_FUNC_READSER, 0, 0, tampon, n);
+  if ( rtn < 0 ) {
+    p->erreur = rtn;
+    return rtn;
+  }
+
+  // chaque paquet de 8 octets commence par le nombre d'octets utiles
+  for ( i = 0; i < rtn; i += USBASP_SERPACKETSIZE ) {
+    n = tampon[i];
+    if ( n > USBASP_SERPAYLOAD )
+      n = USBASP_SERPAYLOAD;
+    if ( n > rtn - i - 1 )
+      n = rtn - i - 1;
+    if ( n > 0 )
+      p->rappel (p, tampon + i + 1, n, p->contexte);
+  }
+  return 0;
+}
@@ -0,0 +1,546 @@
+/*
+    transportSimule: programmeur USBasp simule, a lier a la place de
+                     transportUSB.cc pour essayer serieViaUSB sans
+                     materiel (make simule).  La carte simulee renvoie
+                     chaque octet recu (comme un cavalier entre TX et
+                     RX), au rythme de la vitesse serie choisie.  Les
+                     fifos ont la taille de ceux du firmware et
+                     GETSERSTATUS compte les octets perdus.
+                     GETSERSTATS tient les pertes et les niveaux des
+                     fifos; la ligne simulee ne fait ni DOR ni erreur
+                     de trame ou de parite.  Avec XON/XOFF, la carte
+                     s'arrete d'envoyer aux memes niveaux de RxFifo que
+                     dans usart.c (les caracteres eux-memes ne passent
+                     pas sur la ligne simulee).
+
+                     Au-dessus de la vitesse donnee par la variable
+                     d'environnement SERIEVIAUSB_BAUD_MAX, l'echo est
+                     corrompu, pour essayer l'option -a.
+                     SERIEVIAUSB_SIMULES donne le nombre de
+                     programmeurs branches (1 par defaut), sur le bus 1
+                     aux adresses 1, 2, ..., avec les numeros de serie
+                     sim1, sim2, ...  Avec SERIEVIAUSB_BAVARD, chaque
+                     carte envoie aussi sans arret des lignes
+                     "simN k" numerotees, pour essayer -l seul.
+
+                     Avec SERIEVIAUSB_TRAMES, la carte simulee utilise
+                     cible/trame.c et renvoie les donnees recues dans
+                     ses propres trames, pour essayer -P.
+                     SERIEVIAUSB_PERTES (une probabilite, par exemple
+                     0.01) perd ou corrompt des octets au hasard sur
+                     la ligne serie, dans les deux sens.  Par exemple:
+
+                     SERIEVIAUSB_TRAMES=1 SERIEVIAUSB_PERTES=0.02 \
+                       serieViaUSB-simule -P -l -e -q -v 115200 \
+                       -f donnees -nb <taille de donnees> -o copie
+                     cmp donnees copie
+
+                     Avec SERIEVIAUSB_COMPRESSION, la carte simulee
+                     decompresse avec cible/compression.c ce qu'elle
+                     recoit avant de le renvoyer, pour essayer -z de
+                     la meme facon (sans -P).
+
+    Jerome Collin
+    Modifications, programmeur simule
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <usbcmd.h>
+#include <transportUSB.h>
+#include <cible/trame.h>
+#include <cible/compression.h>
+
+// meme tampon que USBASPSERLEN du firmware, partage entre les deux
+// fifos par SETSERIOS; comme dans fifo.c, une case reste toujours vide
+#define TAILLE_SERIE  688
+#define TAILLE_RX(part)  ( ( TAILLE_SERIE / 16 ) * ( (part) ? (part) : 8 ) )
+
+// ce que la carte a a envoyer, sans limite pratique: decompresse, il
+// y en a plus que ce qui arrive
+#define TAILLE_RETOUR  ( 1 << 16 )
+
+#define ERREUR_SIMULEE  -1
+
+struct FifoSimule
+{
+   unsigned char donnees[TAILLE_RETOUR];
+   int taille;
+   int debut;
+   int n;
+};
+
+struct PeripheriqueUSB
+{
+   pthread_mutex_t verrou;
+   FifoSimule tx;
+   FifoSimule rx;
+   FifoSimule retour;         // de la carte vers le programmeur
+   int baud;
+   int baudMax;
+   double credit;             // octets que la ligne a eu le temps de passer
+   double creditRetour;       // meme chose dans l'autre sens
+   double ms;                 // temps pas encore donne a trame_tic
+   struct timespec dernier;
+   unsigned int perdus;
+   double pertes;
+   unsigned int compteurs[USBASP_SERSTAT_N];  // GETSERSTATS
+   int haut, bas;             // XON/XOFF, haut a 0 sans controle de flux
+   int xoff;
+
+   // carte qui parle avec cible/trame.c
+   int trames;
+   Trame trameCarte;
+
+   // carte qui decompresse ce qu'elle recoit
+   int decompresse;
+   Decompression decompression;
+
+   int lectureActive;
+   int interruption;
+   RappelLecture rappel;
+   void *contexte;
+
+   int adresse;
+   char nom[USB_LONGUEUR_NOM];
+
+   // carte bavarde: la ligne en cours d'envoi
+   int bavard;
+   long ligne;
+   char texte[32];
+   int position;
+};
+
+#define MAX_SIMULES  16
+
+// programmeurs ouverts, pour usbEvenements()
+static PeripheriqueUSB *ouverts[MAX_SIMULES];
+static pthread_mutex_t verrouOuverts = PTHREAD_MUTEX_INITIALIZER;
+
+static const int vitesses[] = { 300, 600, 1200, 2400, 4800, 9600,
+                                19200, 38400, 57600, 115200 };
+
+static void fifoVider ( FifoSimule *f, int taille )
+{
+  f->taille = taille;
+  f->debut = 0;
+  f->n = 0;
+}
+
+static int fifoLibre ( FifoSimule *f )
+{
+  return f->taille - 1 - f->n;
+}
+
+static void fifoAjouter ( FifoSimule *f, unsigned char octet )
+{
+  f->donnees[( f->debut + f->n ) % f->taille] = octet;
+  f->n++;
+}
+
+static unsigned char fifoRetirer ( FifoSimule *f )
+{
+  unsigned char octet = f->donnees[f->debut];
+  f->debut = ( f->debut + 1 ) % f->taille;
+  f->n--;
+  return octet;
+}
+
+// plus haut niveau d'un fifo, comme usart_niveau() du firmware
+static void niveau ( unsigned int *max, int n )
+{
+  if ( (unsigned int) n > *max )
+    *max = n;
+}
+
+// injection de pertes: retourne 1 si l'octet est perdu, sinon il
+// peut avoir ete corrompu
+static int perdre ( PeripheriqueUSB *p, unsigned char *octet )
+{
+  if ( p->pertes <= 0 || drand48 () >= p->pertes )
+    return 0;
+  if ( drand48 () < 0.5 )
+    return 1;
+  *octet ^= 1 << ( lrand48 () % 8 );
+  return 0;
+}
+
+// la carte simulee ecrit sur sa ligne serie
+static void carteEnvoyer ( void *contexte, uint8_t octet )
+{
+  PeripheriqueUSB *p = (PeripheriqueUSB *) contexte;
+
+  if ( fifoLibre (&p->retour) > 0 )
+    fifoAjouter (&p->retour, octet);
+}
+
+// la carte simulee renvoie ce qu'elle recoit; si sa propre fenetre
+// est pleine, elle refuse et la trame reviendra
+static uint8_t carteLivrer ( void *contexte, const uint8_t *donnees,
+                             uint8_t n )
+{
+  PeripheriqueUSB *p = (PeripheriqueUSB *) contexte;
+
+  return trame_envoyer (&p->trameCarte, donnees, n);
+}
+
+// fait passer sur la ligne serie les octets que le temps ecoule permet
+static void avancer ( PeripheriqueUSB *p )
+{
+  struct timespec maintenant;
+  unsigned char octet;
+  double ecoule;
+
+  clock_gettime (CLOCK_MONOTONIC, &maintenant);
+  ecoule = ( maintenant.tv_sec - p->dernier.tv_sec ) +
+           ( maintenant.tv_nsec - p->dernier.tv_nsec ) / 1e9;
+  p->dernier = maintenant;
+
+  // 10 bits par octet, dans chaque sens
+  p->credit += ecoule * p->baud / 10;
+  p->creditRetour += ecoule * p->baud / 10;
+
+  // du programmeur vers la carte
+  while ( p->credit >= 1 && p->tx.n > 0 ) {
+    octet = fifoRetirer (&p->tx);
+    p->credit -= 1;
+    if ( p->baudMax > 0 && p->baud > p->baudMax )
+      octet ^= 0x10;
+    if ( perdre (p, &octet) )
+      continue;
+    if ( p->trames )
+      trame_recevoir_octet (&p->trameCarte, octet);
+    else if ( p->decompresse )
+      decompression_recevoir_octet (&p->decompression, octet);
+    else if ( fifoLibre (&p->retour) > 0 )
+      fifoAjouter (&p->retour, octet);
+  }
+
+  if ( p->trames ) {
+    p->ms += ecoule * 1000;
+    if ( p->ms >= 1 ) {
+      trame_tic (&p->trameCarte, (uint16_t) p->ms);
+      p->ms -= (uint16_t) p->ms;
+    }
+  }
+
+  // de la carte vers le programmeur, sauf apres XOFF
+  while ( p->creditRetour >= 1 && ( p->retour.n > 0 || p->bavard ) ) {
+    if ( p->haut > 0 && p->rx.n >= p->haut )
+      p->xoff = true;
+    else if ( p->xoff && p->rx.n <= p->bas )
+      p->xoff = false;
+    if ( p->xoff ) {
+      p->creditRetour = 1;
+      break;
+    }
+    if ( p->retour.n > 0 ) {
+      octet = fifoRetirer (&p->retour);
+    }
+    else {
+      if ( p->texte[p->position] == '\0' ) {
+        snprintf (p->texte, sizeof (p->texte), "%s %ld\n", p->nom, p->ligne++);
+        p->position = 0;
+      }
+      octet = p->texte[p->position++];
+    }
+    p->creditRetour -= 1;
+    if ( perdre (p, &octet) )
+      continue;
+    if ( fifoLibre (&p->rx) > 0 ) {
+      fifoAjouter (&p->rx, octet);
+      niveau (&p->compteurs[USBASP_SERSTAT_RXMAX], p->rx.n);
+    }
+    else if ( p->perdus != 0xFFFF ) {
+      p->perdus++;
+      p->compteurs[USBASP_SERSTAT_PERTES]++;
+    }
+  }
+
+  // une ligne au repos n'accumule rien
+  if ( p->tx.n == 0 && p->credit > 1 )
+    p->credit = 1;
+  if ( p->retour.n == 0 && ! p->bavard && p->creditRetour > 1 )
+    p->creditRetour = 1;
+}
+
+static int nombreSimules ( void )
+{
+  const char *n = getenv ("SERIEVIAUSB_SIMULES");
+  int nSimules = n != NULL ? atoi (n) : 1;
+
+  return nSimules > MAX_SIMULES ? MAX_SIMULES : nSimules;
+}
+
+// programmeur simule a l'adresse donnee, NULL s'il est deja ouvert
+static PeripheriqueUSB *creer ( int adresse )
+{
+  PeripheriqueUSB *p;
+  const char *max;
+
+  pthread_mutex_lock (&verrouOuverts);
+  if ( ouverts[adresse - 1] != NULL ) {
+    pthread_mutex_unlock (&verrouOuverts);
+    return NULL;
+  }
+  p = (PeripheriqueUSB *) calloc (1, sizeof (PeripheriqueUSB));
+  ouverts[adresse - 1] = p;
+  pthread_mutex_unlock (&verrouOuverts);
+
+  pthread_mutex_init (&p->verrou, NULL);
+  p->baud = 2400;
+  p->adresse = adresse;
+  snprintf (p->nom, sizeof (p->nom), "sim%d", adresse);
+  max = getenv ("SERIEVIAUSB_BAUD_MAX");
+  if ( max != NULL )
+    p->baudMax = atoi (max);
+  p->bavard = getenv ("SERIEVIAUSB_BAVARD") != NULL;
+  p->trames = getenv ("SERIEVIAUSB_TRAMES") != NULL;
+  if ( getenv ("SERIEVIAUSB_PERTES") != NULL )
+    p->pertes = atof (getenv ("SERIEVIAUSB_PERTES"));
+  fifoVider (&p->tx, TAILLE_SERIE - TAILLE_RX (0));
+  fifoVider (&p->rx, TAILLE_RX (0));
+  fifoVider (&p->retour, TAILLE_RETOUR);
+  trame_init (&p->trameCarte, carteEnvoyer, carteLivrer, p);
+  p->decompresse = getenv ("SERIEVIAUSB_COMPRESSION") != NULL;
+  decompression_init (&p->decompression, carteEnvoyer, p);
+  srand48 (adresse);
+  clock_gettime (CLOCK_MONOTONIC, &p->dernier);
+
+  fprintf (stderr, "serieViaUSB : programmeur simule %s\n", p->nom);
+  return p;
+}
+
+int usbLister ( void )
+{
+  int k;
+
+  for ( k = 1; k <= nombreSimules (); k++ )
+    fprintf (stderr, "programmeur 1:%d  serie: sim%d\n", k, k);
+  return nombreSimules ();
+}
+
+PeripheriqueUSB *usbOuvrir ( const char *selection )
+{
+  int bus, adresse;
+
+  if ( selection == NULL )
+    adresse = 1;
+  else if ( sscanf (selection, "%d:%d", &bus, &adresse) == 2 )
+    adresse = bus == 1 ? adresse : 0;
+  else if ( sscanf (selection, "sim%d", &adresse) != 1 )
+    adresse = 0;
+
+  if ( adresse < 1 || adresse > nombreSimules () ) {
+    fprintf (stderr, "Erreur: incapable de trouver le peripherique USB ");
+    fprintf (stderr, "simule %s\n", selection);
+    return NULL;
+  }
+  return creer (adresse);
+}
+
+int usbOuvrirTous ( PeripheriqueUSB **liste, int max )
+{
+  int k, n = 0;
+
+  for ( k = 1; k <= nombreSimules () && n < max; k++ )
+    if ( ( liste[n] = creer (k) ) != NULL )
+      n++;
+  return n;
+}
+
+const char *usbNom ( PeripheriqueUSB *p )
+{
+  return p->nom;
+}
+
+void usbFermer ( PeripheriqueUSB *p )
+{
+  if ( p == NULL )
+    return;
+  pthread_mutex_lock (&verrouOuverts);
+  ouverts[p->adresse - 1] = NULL;
+  pthread_mutex_unlock (&verrouOuverts);
+  pthread_mutex_destroy (&p->verrou);
+  free (p);
+}
+
+const char *usbErreur ( int )
+{
+  return "erreur du programmeur simule";
+}
+
+int usbControle ( PeripheriqueUSB *p, int entrant, int requete,
+                  int valeur, int index,
+                  unsigned char *tampon, int longueur )
+{
+  unsigned char reponse[6];
+  int i, n, k;
+  int rtn = 0;
+
+  pthread_mutex_lock (&p->verrou);
+  avancer (p);
+
+  switch ( requete ) {
+    case USBASP_FUNC_SETSERIOS:
+      n = valeur & 0xFF;
+      if ( n >= USBASP_MODE_SETBAUD300 && n <= USBASP_MODE_SETBAUD115200 ) {
+        p->baud = vitesses[n - USBASP_MODE_SETBAUD300];
+        reponse[0] = n;
+      }
+      else {
+        reponse[0] = 0xFE;
+      }
+      n = valeur >> 8;
+      reponse[1] = ( n >= USBASP_MODE_UART5BIT && n <= USBASP_MODE_UART8BIT ) ?
+                   n : 1;
+      n = index & 0xFF;
+      reponse[2] = ( n >= USBASP_MODE_PARITYN && n <= USBASP_MODE_PARITYO ) ?
+                   n : 0;
+      reponse[3] = ( index >> 8 ) & ( USBASP_SERRX_MASK | USBASP_SERFLOW_MASK |
+                                      USBASP_SERFLAG_XONXOFF |
+                                      USBASP_SERFLAG_INTRIN );
+      p->interruption = reponse[3] & USBASP_SERFLAG_INTRIN;
+      n = TAILLE_RX (reponse[3] >> USBASP_SERRX_SHIFT);
+      fifoVider (&p->tx, TAILLE_SERIE - n);
+      fifoVider (&p->rx, n);
+      // memes seuils que usart_init
+      p->haut = 0;
+      p->xoff = false;
+      if ( reponse[3] & USBASP_SERFLAG_XONXOFF ) {
+        k = USBASP_SERMARGE (reponse[3]);
+        p->haut = ( n - 1 > 2 * k ) ? n - 1 - k : ( n - 1 ) / 2;
+        p->bas = p->haut / 2;
+      }
+      p->perdus = 0;
+      memset (p->compteurs, 0, sizeof (p->compteurs));
+      rtn = longueur < 4 ? longueur : 4;
+      memcpy (tampon, reponse, rtn);
+      break;
+
+    case USBASP_FUNC_GETSERSTATUS:
+      reponse[0] = fifoLibre (&p->tx);
+      reponse[1] = fifoLibre (&p->tx) >> 8;
+      reponse[2] = p->rx.n;
+      reponse[3] = p->rx.n >> 8;
+      reponse[4] = p->perdus;
+      reponse[5] = p->perdus >> 8;
+      rtn = longueur < 6 ? longueur : 6;
+      memcpy (tampon, reponse, rtn);
+      break;
+
+    case USBASP_FUNC_READSER:
+      // comme le firmware: un paquet court termine le transfert
+      for ( i = 0; i + USBASP_SERPACKETSIZE <= longueur; ) {
+        for ( n = 0; n < USBASP_SERPAYLOAD && p->rx.n > 0; n++ )
+          tampon[i + 1 + n] = fifoRetirer (&p->rx);
+        tampon[i] = n;
+        i += n + 1;
+        if ( n < USBASP_SERPAYLOAD )
+          break;
+      }
+      rtn = i;
+      break;
+
+    case USBASP_FUNC_WRITESER:
+      // le firmware lit le nombre d'octets au debut de chaque paquet USB
+      for ( i = 0; i < longueur; i += USBASP_SERPACKETSIZE ) {
+        n = tampon[i];
+        if ( n > USBASP_SERPAYLOAD )
+          n = USBASP_SERPAYLOAD;
+        for ( k = 0; k < n && i + 1 + k < longueur; k++ )
+          if ( fifoLibre (&p->tx) > 0 )
+            fifoAjouter (&p->tx, tampon[i + 1 + k]);
+      }
+      niveau (&p->compteurs[USBASP_SERSTAT_TXMAX], p->tx.n);
+      rtn = longueur;
+      break;
+
+    case USBASP_FUNC_GETSERSTATS:
+      for ( i = 0; i < USBASP_SERSTAT_N && 2 * i + 1 < longueur; i++ ) {
+        tampon[2 * i] = p->compteurs[i];
+        tampon[2 * i + 1] = p->compteurs[i] >> 8;
+      }
+      if ( valeur & USBASP_SERSTAT_RAZ )
+        memset (p->compteurs, 0, sizeof (p->compteurs));
+      rtn = 2 * i;
+      break;
+
+    default:
+      rtn = ERREUR_SIMULEE;
+  }
+
+  (void) entrant;
+  pthread_mutex_unlock (&p->verrou);
+  return rtn;
+}
+
+int usbReserverInterface ( PeripheriqueUSB * )
+{
+  return 0;
+}
+
+int usbDemarrerLecture ( PeripheriqueUSB *p, int interruption,
+                         int, int,
+                         RappelLecture rappel, void *contexte )
+{
+  pthread_mutex_lock (&p->verrou);
+  p->interruption = interruption;
+  p->rappel = rappel;
+  p->contexte = contexte;
+  p->lectureActive = 1;
+  pthread_mutex_unlock (&p->verrou);
+  return 0;
+}
+
+void usbArreterLecture ( PeripheriqueUSB *p )
+{
+  pthread_mutex_lock (&p->verrou);
+  p->lectureActive = 0;
+  pthread_mutex_unlock (&p->verrou);
+}
+
+int usbErreurLecture ( PeripheriqueUSB * )
+{
+  return 0;
+}
+
+// une interrogation par ms, comme le ferait le programmeur; les
+// octets sont remis par paquets de la taille de ceux du firmware
+static void interroger ( PeripheriqueUSB *p )
+{
+  unsigned char paquet[USBASP_SERPACKETSIZE];
+  int taille, n;
+
+  do {
+    pthread_mutex_lock (&p->verrou);
+    if ( ! p->lectureActive ) {
+      pthread_mutex_unlock (&p->verrou);
+      return;
+    }
+    avancer (p);
+    taille = p->interruption ? USBASP_SERPACKETSIZE : USBASP_SERPAYLOAD;
+    for ( n = 0; n < taille && p->rx.n > 0; n++ )
+      paquet[n] = fifoRetirer (&p->rx);
+    pthread_mutex_unlock (&p->verrou);
+
+    if ( n > 0 )
+      p->rappel (p, paquet, n, p->contexte);
+  } while ( n == taille );
+}
+
+int usbEvenements ( int )
+{
+  struct timespec attente = { 0, 1000000 }; // 1 ms
+  int k;
+
+  nanosleep (&attente, NULL);
+  for ( k = 0; k < MAX_SIMULES; k++ )
+    if ( ouverts[k] != NULL )
+      interroger (ouverts[k]);
+  return 0;
+}
@@ -0,0 +1,380 @@
+/*
+    transportUSB: acces au programmeur USBasp par libusb-1.0, avec
+                  des requetes synchrones pour la configuration et
+                  plusieurs lectures asynchrones en vol pour que la
+                  latence du USB chevauche le traitement des octets.
+
+    Jerome Collin
+    Modifications, libusb-1.0
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libusb.h>     /* acces a libusb-1.0, voir http://libusb.info/ */
+#include <usbcmd.h>
+#include <transportUSB.h>
+
+// plus de transferts en vol n'apporte rien a un peripherique lent
+#define MAX_TRANSFERTS  16
+
+struct PeripheriqueUSB
+{
+   libusb_device_handle *gestion;
+
+   // lecture asynchrone
+   libusb_transfer *transferts[MAX_TRANSFERTS];
+   int nTransferts;
+   int enVol;
+   int interruption;
+   int arret;
+   int erreur;
+   RappelLecture rappel;
+   void *contexte;
+
+   char nom[USB_LONGUEUR_NOM];
+};
+
+static libusb_context *contexteUSB = NULL;
+
+// vrai si dev est un programmeur USBasp
+static int estProgrammeur ( libusb_device *dev )
+{
+  struct libusb_device_descriptor descripteur;
+
+  return libusb_get_device_descriptor (dev, &descripteur) == 0 &&
+         descripteur.idVendor == USBDEV_VENDOR &&
+         descripteur.idProduct == USBDEV_PRODUCT;
+}
+
+// numero de serie d'un programmeur ouvert, chaine vide s'il n'en a pas
+static void lireSerie ( libusb_device *dev, libusb_device_handle *gestion,
+                        char *serie, int longueur )
+{
+  struct libusb_device_descriptor descripteur;
+
+  serie[0] = '\0';
+  if ( libusb_get_device_descriptor (dev, &descripteur) == 0 &&
+       descripteur.iSerialNumber != 0 &&
+       libusb_get_string_descriptor_ascii (gestion, descripteur.iSerialNumber,
+              (unsigned char *) serie, longueur) < 0 )
+    serie[0] = '\0';
+}
+
+static int initialiser ( void )
+{
+  if ( contexteUSB == NULL && libusb_init (&contexteUSB) != 0 ) {
+    fprintf (stderr, "Erreur: incapable d'initialiser libusb\n");
+    return 0;
+  }
+  return 1;
+}
+
+static PeripheriqueUSB *creer ( libusb_device *dev,
+                                libusb_device_handle *gestion )
+{
+  PeripheriqueUSB *p;
+
+  p = (PeripheriqueUSB *) calloc (1, sizeof (PeripheriqueUSB));
+  p->gestion = gestion;
+  lireSerie (dev, gestion, p->nom, sizeof (p->nom));
+  if ( p->nom[0] == '\0' )
+    snprintf (p->nom, sizeof (p->nom), "%03d-%03d",
+              libusb_get_bus_number (dev), libusb_get_device_address (dev));
+  return p;
+}
+
+int usbLister ( void )
+{
+  libusb_device **liste;
+  libusb_device_handle *gestion;
+  char serie[USB_LONGUEUR_NOM];
+  ssize_t n, i;
+  int nProgrammeurs = 0;
+
+  if ( ! initialiser () )
+    return 0;
+
+  n = libusb_get_device_list (contexteUSB, &liste);
+  for ( i = 0; i < n; i++ ) {
+    if ( ! estProgrammeur (liste[i]) )
+      continue;
+    serie[0] = '\0';
+    if ( libusb_open (liste[i], &gestion) == 0 ) {
+      lireSerie (liste[i], gestion, serie, sizeof (serie));
+      libusb_close (gestion);
+    }
+    fprintf (stderr, "programmeur %d:%d  serie: %s\n",
+             libusb_get_bus_number (liste[i]),
+             libusb_get_device_address (liste[i]),
+             serie[0] ? serie : "(aucun)");
+    nProgrammeurs++;
+  }
+  if ( n >= 0 )
+    libusb_free_device_list (liste, 1);
+  return nProgrammeurs;
+}
+
+/* facon de faire standard pour trouver le device USB et l'ouvrir... */
+PeripheriqueUSB *usbOuvrir ( const char *selection )
+{
+  libusb_device **liste;
+  libusb_device_handle *gestion = NULL;
+  libusb_device *dev = NULL;
+  char serie[USB_LONGUEUR_NOM];
+  PeripheriqueUSB *p;
+  ssize_t n, i;
+  int bus, adresse;
+  int parPosition;
+  int rtn = 0;
+
+  if ( ! initialiser () )
+    return NULL;
+
+  parPosition = selection != NULL &&
+                sscanf (selection, "%d:%d", &bus, &adresse) == 2;
+
+  n = libusb_get_device_list (contexteUSB, &liste);
+  for ( i = 0; i < n && dev == NULL; i++ ) {
+    if ( ! estProgrammeur (liste[i]) )
+      continue;
+    if ( selection == NULL ) {
+      dev = liste[i];
+    }
+    else if ( parPosition ) {
+      if ( libusb_get_bus_number (liste[i]) == bus &&
+           libusb_get_device_address (liste[i]) == adresse )
+        dev = liste[i];
+    }
+    // le numero de serie ne se lit qu'une fois le programmeur ouvert
+    else if ( libusb_open (liste[i], &gestion) == 0 ) {
+      lireSerie (liste[i], gestion, serie, sizeof (serie));
+      if ( strcmp (serie, selection) == 0 ) {
+        dev = liste[i];
+        break;
+      }
+      libusb_close (gestion);
+      gestion = NULL;
+    }
+  }
+  if( ! dev ) {
+    fprintf (stderr, "Erreur: incapable de trouver le peripherique USB ");
+    fprintf (stderr, "(vendor=0x%x product=0x%x", USBDEV_VENDOR, USBDEV_PRODUCT);
+    if ( selection != NULL )
+      fprintf (stderr, ", %s", selection);
+    fprintf (stderr, ")\n");
+    if ( n >= 0 )
+      libusb_free_device_list (liste, 1);
+    return NULL;
+  }
+
+  if ( gestion == NULL )
+    rtn = libusb_open (dev, &gestion);
+  if ( rtn != 0 ) {
+    libusb_free_device_list (liste, 1);
+    fprintf (stderr, "Erreur: incapable d'ouvrir le port USB vers le ");
+    fprintf (stderr, "peripherique: %s\n", usbErreur (rtn));
+    return NULL;
+  }
+
+  p = creer (dev, gestion);
+  libusb_free_device_list (liste, 1);
+  return p;
+}
+
+int usbOuvrirTous ( PeripheriqueUSB **ouverts, int max )
+{
+  libusb_device **liste;
+  libusb_device_handle *gestion;
+  ssize_t n, i;
+  int nOuverts = 0;
+  int rtn;
+
+  if ( ! initialiser () )
+    return 0;
+
+  n = libusb_get_device_list (contexteUSB, &liste);
+  for ( i = 0; i < n && nOuverts < max; i++ ) {
+    if ( ! estProgrammeur (liste[i]) )
+      continue;
+    rtn = libusb_open (liste[i], &gestion);
+    if ( rtn != 0 ) {
+      fprintf (stderr, "Erreur: incapable d'ouvrir le programmeur %d:%d: ",
+               libusb_get_bus_number (liste[i]),
+               libusb_get_device_address (liste[i]));
+      fprintf (stderr, "%s\n", usbErreur (rtn));
+      continue;
+    }
+    ouverts[nOuverts++] = creer (liste[i], gestion);
+  }
+  if ( n >= 0 )
+    libusb_free_device_list (liste, 1);
+  return nOuverts;
+}
+
+const char *usbNom ( PeripheriqueUSB *p )
+{
+  return p->nom;
+}
+
+void usbFermer ( PeripheriqueUSB *p )
+{
+  if ( p == NULL )
+    return;
+  if ( p->nTransferts > 0 )
+    usbArreterLecture (p);
+  libusb_close (p->gestion);
+  free (p);
+}
+
+const char *usbErreur ( int code )
+{
+  return libusb_error_name (code);
+}
+
+int usbControle ( PeripheriqueUSB *p, int entrant, int requete,
+                  int valeur, int index,
+                  unsigned char *tampon, int longueur )
+{
+  return libusb_control_transfer (p->gestion,
+             LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE |
+             ( entrant ? LIBUSB_ENDPOINT_IN : LIBUSB_ENDPOINT_OUT ),
+             requete, valeur, index, tampon, longueur, USB_DELAI);
+}
+
+int usbReserverInterface ( PeripheriqueUSB *p )
+{
+  return libusb_claim_interface (p->gestion, 0);
+}
+
+// fin d'un transfert de lecture: remettre les octets utiles, puis
+// resoumettre le transfert tout de suite pour garder la file pleine
+static void finLecture ( libusb_transfer *t )
+{
+  PeripheriqueUSB *p = (PeripheriqueUSB *) t->user_data;
+  unsigned char *donnees;
+  int i, n;
+
+  if ( t->status == LIBUSB_TRANSFER_COMPLETED ) {
+    if ( p->interruption ) {
+      if ( t->actual_length > 0 )
+        p->rappel (p, t->buffer, t->actual_length, p->contexte);
+    }
+    else {
+      // chaque paquet de 8 octets commence par le nombre d'octets utiles
+      donnees = libusb_control_transfer_get_data (t);
+      for ( i = 0; i < t->actual_length; i += USBASP_SERPACKETSIZE ) {
+        n = donnees[i];
+        if ( n > USBASP_SERPAYLOAD )
+          n = USBASP_SERPAYLOAD;
+        if ( n > t->actual_length - i - 1 )
+          n = t->actual_length - i - 1;
+        if ( n > 0 )
+          p->rappel (p, donnees + i + 1, n, p->contexte);
+      }
+    }
+  }
+  else if ( t->status == LIBUSB_TRANSFER_NO_DEVICE ) {
+    p->erreur = LIBUSB_ERROR_NO_DEVICE;
+  }
+  else if ( t->status != LIBUSB_TRANSFER_CANCELLED &&
+            t->status != LIBUSB_TRANSFER_TIMED_OUT ) {
+    p->erreur = LIBUSB_ERROR_IO;
+  }
+
+  if ( ! p->arret && ! p->erreur && libusb_submit_transfer (t) == 0 )
+    return;
+
+  p->enVol--;
+}
+
+int usbDemarrerLecture ( PeripheriqueUSB *p, int interruption,
+                         int nTransferts, int longueur,
+                         RappelLecture rappel, void *contexte )
+{
+  libusb_transfer *t;
+  unsigned char *tampon;
+  int i;
+  int rtn = 0;
+
+  if ( nTransferts > MAX_TRANSFERTS )
+    nTransferts = MAX_TRANSFERTS;
+
+  p->interruption = interruption;
+  p->rappel = rappel;
+  p->contexte = contexte;
+  p->arret = 0;
+  p->erreur = 0;
+  p->enVol = 0;
+  p->nTransferts = 0;
+
+  for ( i = 0; i < nTransferts; i++ ) {
+    t = libusb_alloc_transfer (0);
+    if ( t == NULL ) {
+      rtn = LIBUSB_ERROR_NO_MEM;
+      break;
+    }
+    p->transferts[p->nTransferts++] = t;
+
+    if ( interruption ) {
+      // le point d'acces ne repond que s'il a quelque chose: pas de delai
+      tampon = (unsigned char *) malloc (USBASP_SERPACKETSIZE);
+      libusb_fill_interrupt_transfer (t, p->gestion, USBASP_SERENDPOINT,
+                                      tampon, USBASP_SERPACKETSIZE,
+                                      finLecture, p, 0);
+    }
+    else {
+      tampon = (unsigned char *) malloc (LIBUSB_CONTROL_SETUP_SIZE + longueur);
+      libusb_fill_control_setup (tampon,
+                  LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE |
+                  LIBUSB_ENDPOINT_IN,
+                  USBASP_FUNC_READSER, 0, 0, longueur);
+      libusb_fill_control_transfer (t, p->gestion, tampon,
+                                    finLecture, p, USB_DELAI);
+    }
+
+    rtn = libusb_submit_transfer (t);
+    if ( rtn != 0 )
+      break;
+    p->enVol++;
+  }
+
+  if ( p->enVol < nTransferts ) {
+    usbArreterLecture (p);
+    return rtn;
+  }
+  return 0;
+}
+
+void usbArreterLecture ( PeripheriqueUSB *p )
+{
+  int i;
+
+  p->arret = 1;
+  for ( i = 0; i < p->nTransferts; i++ )
+    libusb_cancel_transfer (p->transferts[i]);
+
+  while ( p->enVol > 0 )
+    usbEvenements (100);
+
+  for ( i = 0; i < p->nTransferts; i++ ) {
+    free (p->transferts[i]->buffer);
+    libusb_free_transfer (p->transferts[i]);
+  }
+  p->nTransferts = 0;
+}
+
+int usbErreurLecture ( PeripheriqueUSB *p )
+{
+  return p->erreur;
+}
+
+int usbEvenements ( int delaiMs )
+{
+  struct timeval tv;
+
+  tv.tv_sec = delaiMs / 1000;
+  tv.tv_usec = ( delaiMs % 1000 ) * 1000;
+  return libusb_handle_events_timeout_completed (contexteUSB, &tv, NULL);
+}
@@ -0,0 +1,79 @@
+
+#ifndef _TRANSPORTUSB_H_
+#define _TRANSPORTUSB_H_
+
+/*
+ * Acces au programmeur USBasp par libusb-1.0.  serieViaUSB ne parle
+ * au USB qu'a travers ces fonctions: pour l'essayer sans materiel, il
+ * suffit de lier transportSimule.cc a la place (make simule).  Pour
+ * essayer transportUSB.cc lui-meme sans materiel, make libusb-simule
+ * le compile sur une libusb-1.0 simulee (libusbSimule.cc).
+ *
+ * Jerome Collin <jerome.collin@polymtl.ca>
+ *
+ */
+
+// delai maximal d'une requete synchrone, en ms
+#define USB_DELAI       5000
+
+struct PeripheriqueUSB;
+
+// appele pour chaque paquet recu de la carte, avec uniquement
+// les octets utiles (l'entete de longueur de READSER est retiree)
+typedef void (*RappelLecture)( PeripheriqueUSB *p,
+                               const unsigned char *octets, int n,
+                               void *contexte );
+
+// longueur maximale du nom d'un programmeur, avec le 0 final
+#define USB_LONGUEUR_NOM  64
+
+// affiche tous les programmeurs branches et retourne leur nombre
+int usbLister ( void );
+
+// ouverture d'un programmeur, NULL s'il n'y en a pas.  selection est
+// "bus:adresse" (en decimal, par exemple 1:5), le numero de serie du
+// programmeur, ou NULL pour le premier trouve.
+PeripheriqueUSB *usbOuvrir ( const char *selection );
+
+// ouverture de tous les programmeurs branches, au plus max.
+// Retourne le nombre ouvert.
+int usbOuvrirTous ( PeripheriqueUSB **liste, int max );
+
+// nom d'un programmeur ouvert: son numero de serie s'il en a un,
+// sinon "bus-adresse" (par exemple 001-005)
+const char *usbNom ( PeripheriqueUSB *p );
+
+void usbFermer ( PeripheriqueUSB *p );
+
+// texte decrivant un code d'erreur negatif retourne par les fonctions
+const char *usbErreur ( int code );
+
+// requete de controle synchrone vers (entrant == 0) ou en provenance
+// (entrant != 0) du programmeur.  Retourne le nombre d'octets
+// transferes ou un code d'erreur negatif.
+int usbControle ( PeripheriqueUSB *p, int entrant, int requete,
+                  int valeur, int index,
+                  unsigned char *tampon, int longueur );
+
+// reserve l'interface 0, necessaire pour le point d'acces interrupt-in
+int usbReserverInterface ( PeripheriqueUSB *p );
+
+// Lecture asynchrone: nTransferts requetes restent en vol en meme
+// temps et chacune se resoumet des qu'elle se termine.  Les octets sont
+// remis dans l'ordre a rappel, a partir de usbEvenements().  Avec
+// interruption, on lit le point d'acces interrupt-in, sinon on emet
+// des READSER de longueur octets (un multiple de 8).
+int usbDemarrerLecture ( PeripheriqueUSB *p, int interruption,
+                         int nTransferts, int longueur,
+                         RappelLecture rappel, void *contexte );
+
+// annule les lectures en vol et attend qu'elles se terminent
+void usbArreterLecture ( PeripheriqueUSB *p );
+
+// erreur survenue pendant la lecture asynchrone, 0 s'il n'y en a pas
+int usbErreurLecture ( PeripheriqueUSB *p );
+
+// traite les transferts termines pendant au plus delaiMs ms
+int usbEvenements ( int delaiMs );
+
+#endif /* _TRANSPORTUSB_H_ */
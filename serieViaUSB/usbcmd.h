@@ -28,6 +28,10 @@
 #define USBASP_FUNC_SETSERIOS  11
 #define USBASP_FUNC_READSER    12
 #define USBASP_FUNC_WRITESER   13
+#define USBASP_FUNC_GETSERSTATUS 14
+#define USBASP_FUNC_GETSERSTATS 15
+#define USBASP_FUNC_GETPROGSTATUS 16
+#define USBASP_FUNC_CRCFLASH   17
 
 // Fonction ISP - USB
 #define USBASP_BLOCKFLAG_FIRST    1
@@ -36,6 +40,12 @@
 #define USBASP_READBLOCKSIZE   200
 #define USBASP_WRITEBLOCKSIZE  200
 
+// Fonction serie - USB
+// chaque paquet de 8 octets d'un WRITESER ou d'un READSER commence
+// par le nombre d'octets utiles qu'il contient (au maximum 7)
+#define USBASP_SERPACKETSIZE   8
+#define USBASP_SERPAYLOAD      (USBASP_SERPACKETSIZE - 1)
+
 // Fonction UART IOS
 #define USBASP_MODE_SETBAUD300		0x10
 #define USBASP_MODE_SETBAUD600		0x11
@@ -57,4 +67,34 @@
 #define USBASP_MODE_PARITYE			0x02
 #define USBASP_MODE_PARITYO			0x03
 
+// options serie, 4e octet de USBASP_FUNC_SETSERIOS
+#define USBASP_SERFLAG_INTRIN		0x01	/* carte -> PC par interrupt-in */
+#define USBASP_SERFLAG_XONXOFF		0x02	/* XON/XOFF vers la carte */
+// bits 3..2: avec XON/XOFF, place qui reste dans RxFifo quand XOFF
+// part, 16 << n octets; XON quand RxFifo est redescendu a moitie
+#define USBASP_SERFLOW_MASK			0x0C
+#define USBASP_SERFLOW_SHIFT		2
+#define USBASP_SERMARGE(options) \
+	( 16 << ( ( (options) & USBASP_SERFLOW_MASK ) >> USBASP_SERFLOW_SHIFT ) )
+#define USBASP_XON					0x11
+#define USBASP_XOFF					0x13
+// bits 7..4: part du tampon serie pour la reception, en 16e (1 a 15),
+// 0 pour moitie-moitie; renvoyee dans l'echo
+#define USBASP_SERRX_MASK			0xF0
+#define USBASP_SERRX_SHIFT			4
+
+// compteurs de USBASP_FUNC_GETSERSTATS, 2 octets chacun (poids faible
+// d'abord) dans cet ordre; bit 0 de wValue: remise a zero apres lecture
+#define USBASP_SERSTAT_DOR			0	/* DOR: octets ecrases dans le USART */
+#define USBASP_SERSTAT_FE			1	/* erreurs de trame */
+#define USBASP_SERSTAT_PE			2	/* erreurs de parite */
+#define USBASP_SERSTAT_PERTES		3	/* octets jetes, RxFifo plein */
+#define USBASP_SERSTAT_RXMAX		4	/* plus haut niveau de RxFifo */
+#define USBASP_SERSTAT_TXMAX		5	/* plus haut niveau de TxFifo */
+#define USBASP_SERSTAT_N			6
+#define USBASP_SERSTAT_RAZ			0x01
+
+// point d'acces interrupt-in (endpoint 1) pour les octets de la carte
+#define USBASP_SERENDPOINT			0x81
+
 #endif /* _USBCMD_H_ */
@@ -8,8 +8,23 @@
  * Last change....: 2010-06-20
  */
 
+#include <string.h>
+
 #include "fifo.h"
 
+/*
+ * fifo_suivant : la case apres i.  La taille n'est plus forcement une
+ * puissance de 2 (usart_init partage un seul tampon entre les deux
+ * fifos): une comparaison remplace le masque, et coute moins qu'un
+ * modulo sur l'AVR.
+ */
+static uint16_t fifo_suivant( const struct Fifo *fifo, uint16_t i )
+{
+    if( ++i == fifo->m_size )
+        i = 0;
+    return i;
+}
+
 /*
   * fifo_init : initialiser le fifo 
  * Arguments: 
@@ -51,8 +66,7 @@ uint8_t fifo_enqueue( struct Fifo *fifo , uint8_t data)
         else
         {
             fifo->m_data[fifo->m_end]=data; 
-            fifo->m_end=( ( fifo->m_end + 1 ) & 
-                ( fifo->m_size - 1 ) );     
+            fifo->m_end = fifo_suivant( fifo, fifo->m_end );
             rc = 0x00;
         }
     }
@@ -83,8 +97,7 @@ uint16_t fifo_dequeue( struct Fifo *fifo )
         else
         {
             rc = (uint16_t)fifo->m_data[fifo->m_begin];
-            fifo->m_begin = ( ( fifo->m_begin + 1  )
-                             & ( fifo->m_size - 1 ) );
+            fifo->m_begin = fifo_suivant( fifo, fifo->m_begin );
         }
     }
     return rc;
@@ -120,8 +133,107 @@ uint8_t fifo_full( const struct Fifo *fifo )
 {
     // si le fifo est plein
     uint8_t rc = (uint8_t)
-        ( fifo->m_begin == 
-        ( ( fifo->m_end + 1 ) 
-        & ( fifo->m_size - 1 ) ) );
+        ( fifo->m_begin == fifo_suivant( fifo, fifo->m_end ) );
     return rc;
 }
+
+/*
+ * fifo_count : Nombre d'elements presentement dans le fifo
+ * Arguments:
+ *      struct Fifo *fifo   - la structure du Fifo initialisé
+ * Retourne:
+ *      uint16_t            - le nombre d'octets en attente
+ */
+uint16_t fifo_count( const struct Fifo *fifo )
+{
+    if( fifo->m_end >= fifo->m_begin )
+        return fifo->m_end - fifo->m_begin;
+    return fifo->m_size - fifo->m_begin + fifo->m_end;
+}
+
+/*
+ * fifo_free : Nombre d'elements qu'on peut encore ajouter au fifo
+ * Arguments:
+ *      struct Fifo *fifo   - la structure du Fifo
+ * Retourne:
+ *      uint16_t            - le nombre d'octets libres
+ *                            (0 si le fifo n'est pas initialisé)
+ */
+uint16_t fifo_free( const struct Fifo *fifo )
+{
+    // un fifo non initialisé n'a aucune place
+    if( fifo->m_size == 0 )
+        return 0;
+    // une case reste toujours vide pour distinguer plein de vide
+    return fifo->m_size - 1 - fifo_count( fifo );
+}
+
+/*
+ * fifo_enqueue_n : Ajouter jusqu'a n elements d'un coup
+ * Arguments:
+ *      struct Fifo *fifo   - la structure du Fifo initialisé
+ *      const uint8_t *data - les données à rajouter au Fifo
+ *      uint16_t n          - le nombre d'octets de data
+ * Retourne:
+ *      uint16_t            - le nombre d'octets ajoutes, moins que n si
+ *                            le fifo se remplit
+ * Deux copies au plus, de part et d'autre de la fin du tampon, au lieu
+ * d'un fifo_enqueue par octet dans les fonctions USB.
+ */
+uint16_t fifo_enqueue_n( struct Fifo *fifo, const uint8_t *data, uint16_t n )
+{
+    uint16_t segment;
+
+    if( fifo == 0x00 )
+        return 0;
+    if( n > fifo_free( fifo ) )
+        n = fifo_free( fifo );
+    /* rien a copier, m_data peut meme etre nul (fifo non initialisé) */
+    if( n == 0 )
+        return 0;
+
+    segment = fifo->m_size - fifo->m_end;
+    if( segment > n )
+        segment = n;
+    memcpy( fifo->m_data + fifo->m_end, data, segment );
+    memcpy( fifo->m_data, data + segment, n - segment );
+
+    fifo->m_end += n;
+    if( fifo->m_end >= fifo->m_size )
+        fifo->m_end -= fifo->m_size;
+    return n;
+}
+
+/*
+ * fifo_dequeue_n : Retirer jusqu'a n elements d'un coup
+ * Arguments:
+ *      struct Fifo *fifo   - la structure du Fifo initialisé
+ *      uint8_t *data       - ou copier les données retirées
+ *      uint16_t n          - la place dans data
+ * Retourne:
+ *      uint16_t            - le nombre d'octets retires, moins que n si
+ *                            le fifo se vide
+ */
+uint16_t fifo_dequeue_n( struct Fifo *fifo, uint8_t *data, uint16_t n )
+{
+    uint16_t segment;
+
+    if( fifo == 0x00 )
+        return 0;
+    if( n > fifo_count( fifo ) )
+        n = fifo_count( fifo );
+    /* le cas courant de READSER, RxFifo vide */
+    if( n == 0 )
+        return 0;
+
+    segment = fifo->m_size - fifo->m_begin;
+    if( segment > n )
+        segment = n;
+    memcpy( data, fifo->m_data + fifo->m_begin, segment );
+    memcpy( data + segment, fifo->m_data, n - segment );
+
+    fifo->m_begin += n;
+    if( fifo->m_begin >= fifo->m_size )
+        fifo->m_begin -= fifo->m_size;
+    return n;
+}
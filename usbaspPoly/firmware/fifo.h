@@ -30,6 +30,14 @@ uint8_t fifo_empty( const struct Fifo *fifo );
 
 uint8_t fifo_full( const struct Fifo *fifo );
 
+uint16_t fifo_count( const struct Fifo *fifo );
+
+uint16_t fifo_free( const struct Fifo *fifo );
+
+uint16_t fifo_enqueue_n( struct Fifo *fifo, const uint8_t *data, uint16_t n );
+
+uint16_t fifo_dequeue_n( struct Fifo *fifo, uint8_t *data, uint16_t n );
+
 
 #endif /* __fifo_h_included__ */
 
@@ -0,0 +1,27 @@
+/*
+ * avr/interrupt.h - pour compiler le firmware sur le PC (voir hote.h)
+ *
+ * Autor..........: Jerome Collin (jerome.collin@polymtl.ca)
+ * Description....: ISR(vecteur) definit une fonction ordinaire que
+ *                  hote.c appelle entre deux acces aux registres
+ *                  modelises, quand sei() l'a permis, que le bit
+ *                  d'activation est mis et que la condition est vraie.
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ */
+
+#ifndef __hote_avr_interrupt_h_included__
+#define __hote_avr_interrupt_h_included__
+
+#include "hote.h"
+
+#define sei()   hote_sei(1)
+#define cli()   hote_sei(0)
+
+#define ISR(vecteur, ...)   void vecteur( void )
+#define ISR_NAKED
+#define ISR_NOBLOCK
+
+#define USART_RXC_vect      hote_usart_rxc
+#define USART_UDRE_vect     hote_usart_udre
+
+#endif /* __hote_avr_interrupt_h_included__ */
@@ -0,0 +1,117 @@
+/*
+ * avr/io.h - registres de l'ATmega8 pour compiler le firmware sur le PC
+ *
+ * Autor..........: Jerome Collin (jerome.collin@polymtl.ca)
+ * Description....: remplace <avr/io.h> d'avr-libc dans la compilation
+ *                  du firmware pour le PC (voir hote.h).  Les ports
+ *                  sont de simples variables, sauf ceux que hote.c
+ *                  modelise: USART (UCSRA, UDR), SPI (SPSR, SPDR), les
+ *                  broches ISP (PORTB, PINB) et le timer 0 (TCNT0).
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ */
+
+#ifndef __hote_avr_io_h_included__
+#define __hote_avr_io_h_included__
+
+#include <stdint.h>
+#include "hote.h"
+
+/* PORTB et PINB: RST, MOSI, MISO et SCK de isp.h vont a la cible */
+extern volatile uint8_t DDRB;
+#define PORTB   (*hote_portb())
+#define PINB    (*hote_pinb())
+extern volatile uint8_t PORTC, DDRC, PINC;
+extern volatile uint8_t PORTD, DDRD, PIND;
+
+extern volatile uint8_t TCCR0B;
+#define TCNT0   (*hote_tcnt0())
+
+/* SPI: SPDR envoie un octet a la cible quand SPE et MSTR sont dans
+   SPCR, SPIF monte dans SPSR au bout des 8 coups d'horloge */
+extern volatile uint8_t SPCR;
+#define SPSR    (*hote_spsr())
+#define SPDR    (*hote_spdr())
+
+/* USART: UCSRA donne l'etat de la ligne au moment de la lecture, UDR
+   est un seul registre pour l'octet recu et l'octet a envoyer */
+extern volatile uint8_t UCSRB, UCSRC, UBRRL, UBRRH;
+#define UCSRA   (*hote_ucsra())
+#define UDR     (*hote_udr())
+
+/* UCSRA */
+#define RXC     7
+#define TXC     6
+#define UDRE    5
+#define FE      4
+#define DOR     3
+#define PE      2
+#define U2X     1
+#define MPCM    0
+
+/* UCSRB */
+#define RXCIE   7
+#define TXCIE   6
+#define UDRIE   5
+#define RXEN    4
+#define TXEN    3
+#define UCSZ2   2
+#define RXB8    1
+#define TXB8    0
+
+/* UCSRC */
+#define URSEL   7
+#define UMSEL   6
+#define UPM1    5
+#define UPM0    4
+#define USBS    3
+#define UCSZ1   2
+#define UCSZ0   1
+#define UCPOL   0
+
+/* SPCR */
+#define SPIE    7
+#define SPE     6
+#define DORD    5
+#define MSTR    4
+#define CPOL    3
+#define CPHA    2
+#define SPR1    1
+#define SPR0    0
+
+/* SPSR */
+#define SPIF    7
+#define WCOL    6
+#define SPI2X   0
+
+/* TCCR0 */
+#define CS02    2
+#define CS01    1
+#define CS00    0
+
+#define PB0     0
+#define PB1     1
+#define PB2     2
+#define PB3     3
+#define PB4     4
+#define PB5     5
+#define PB6     6
+#define PB7     7
+
+#define PC0     0
+#define PC1     1
+#define PC2     2
+#define PC3     3
+#define PC4     4
+#define PC5     5
+#define PC6     6
+
+#define PD0     0
+#define PD1     1
+#define PD2     2
+#define PD3     3
+#define PD4     4
+#define PD5     5
+#define PD6     6
+#define PD7     7
+
+#endif /* __hote_avr_io_h_included__ */
@@ -0,0 +1,19 @@
+/*
+ * avr/pgmspace.h - pour compiler le firmware sur le PC (voir hote.h)
+ *
+ * Autor..........: Jerome Collin (jerome.collin@polymtl.ca)
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ */
+
+#ifndef __hote_avr_pgmspace_h_included__
+#define __hote_avr_pgmspace_h_included__
+
+#include <stdint.h>
+
+/* une seule memoire sur le PC */
+#define PROGMEM
+#define PSTR(s)             (s)
+#define pgm_read_byte(p)    (*(const uint8_t *)(p))
+#define pgm_read_word(p)    (*(const uint16_t *)(p))
+
+#endif /* __hote_avr_pgmspace_h_included__ */
@@ -0,0 +1,15 @@
+/*
+ * avr/wdt.h - pour compiler le firmware sur le PC (voir hote.h)
+ *
+ * Autor..........: Jerome Collin (jerome.collin@polymtl.ca)
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ */
+
+#ifndef __hote_avr_wdt_h_included__
+#define __hote_avr_wdt_h_included__
+
+#define wdt_reset()
+#define wdt_enable(delai)
+#define wdt_disable()
+
+#endif /* __hote_avr_wdt_h_included__ */
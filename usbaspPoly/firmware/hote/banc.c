@@ -0,0 +1,485 @@
+/*
+ * banc.c - banc d'essai du firmware compile pour le PC
+ *
+ * Autor..........: Jerome Collin (jerome.collin@polymtl.ca)
+ * Description....: en temps virtuel (voir hote.h), programme la flash
+ *                  de la cible modelisee comme avrdude 5.11 et plus (une
+ *                  suite PROG_BLOCKFLAG_FIRST...LAST par page), puis
+ *                  comme avrdude 5.10 (toute l'image en blocs de 200
+ *                  octets), et une image dont trois
+ *                  pages sur quatre sont effacees, la relit et la
+ *                  compare chaque fois, au SCK que le firmware a choisi pour
+ *                  elle (apres un essai de cibles a d'autres horloges),
+ *                  et la verifie aussi par les CRC de pages du firmware,
+ *                  une page alteree en plus a la fin,
+ *                  puis mesure combien de
+ *                  requetes le PC fait passer par seconde: completes
+ *                  avec hote_controle(), et directement par
+ *                  usbFunctionSetup().  Enfin, la cible envoie des
+ *                  octets sur RX a des vitesses croissantes, jusqu'au-
+ *                  dela de la table du firmware (le banc change UBRR
+ *                  lui-meme), et le banc compte les pertes,
+ *                  puis recommence a 115200 baud avec un PC qui cesse de
+ *                  lire un moment, pour chaque partage du tampon serie,
+ *                  puis avec XON/XOFF.  Le banc echoue si des
+ *                  octets se perdent d'un hoquet que RxFifo pouvait
+ *                  tenir, ou malgre XON/XOFF.
+ *                  Les durees "cible" sont celles du modele a 12 MHz,
+ *                  les durees "PC" celles du banc.
+ *                  Usage: banc [pages [requetes [octets]]]
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <avr/io.h>
+
+#include "usbdrv.h"
+#include "usbasp.h"
+#include "usart.h"
+
+/* UBRR en double vitesse (U2X): 115200 baud est dans la table du
+   firmware, le reste seulement ici */
+static const uint16_t ubrrs[] = { 12, 9, 7, 5, 3, 2, 1, 0 };
+#define N_UBRRS     (sizeof(ubrrs) / sizeof(ubrrs[0]))
+
+/* horloges de cible pour la negociation du SCK, la derniere reste */
+static const uint32_t horloges[] = { 128000, 1000000, 2000000, 4000000,
+                                     16000000, HOTE_CIBLE_HORLOGE };
+#define N_HORLOGES  (sizeof(horloges) / sizeof(horloges[0]))
+
+/* USBASP_ISP_SCK_* */
+static const char *vitesses[] = { "auto", "500 Hz", "1 kHz", "2 kHz",
+                                  "4 kHz", "8 kHz", "16 kHz", "32 kHz",
+                                  "93.75 kHz", "187.5 kHz", "375 kHz",
+                                  "750 kHz", "1.5 MHz" };
+
+/* suites de WRITEFLASH, de FIRST a LAST, et leurs blocs:
+   usbasp_spi_paged_write() d'avrdude, appele page par page depuis la
+   version 5.11, pour toute la flash avant (0: toute l'image) */
+static const int suites[] = { HOTE_PAGE, 0 };
+#define N_SUITES    (sizeof(suites) / sizeof(suites[0]))
+#define BLOC        200
+
+/* le PC occupe ailleurs pendant que la carte envoie a 115200 baud:
+   RxFifo doit tout garder d'un hoquet qu'il peut contenir */
+#define HOQUET_COURT_MS 50
+#define HOQUET_MS       60
+#define HOQUET_LONG_MS  500
+
+/* octets par seconde a 115200 baud (UBRR 12, U2X), 8N1 */
+#define OCTETS_115200   ( HOTE_F_CPU / 8 / 13 / 10 )
+
+static uint8_t setup[8];
+
+static double secondes( void )
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static double cible_s( uint64_t cycles )
+{
+    return (double)cycles / HOTE_F_CPU;
+}
+
+static int requete( int entrant, uint8_t fonction, uint16_t valeur,
+                    uint16_t index, uint8_t *donnees, uint16_t longueur )
+{
+    setup[0] = 0x40 | (entrant ? 0x80 : 0);
+    setup[1] = fonction;
+    setup[2] = valeur;
+    setup[3] = valeur >> 8;
+    setup[4] = index;
+    setup[5] = index >> 8;
+    setup[6] = longueur;
+    setup[7] = longueur >> 8;
+    return hote_controle(setup, donnees);
+}
+
+/* instruction ISP brute, retourne le quatrieme octet */
+static uint8_t transmettre( uint8_t a, uint8_t b, uint8_t c, uint8_t d )
+{
+    uint8_t reponse[4];
+
+    requete(1, USBASP_FUNC_TRANSMIT, (b << 8) | a, (d << 8) | c, reponse, 4);
+    return reponse[3];
+}
+
+/* ecrit la flash par suites de blocs, PROG_BLOCKFLAG_FIRST au premier
+   bloc de chaque suite et LAST au dernier comme avrdude, puis attend la
+   derniere page: le firmware charge encore la cible quand la derniere
+   requete se termine */
+static void ecrire( const uint8_t *image, int taille, int suite )
+{
+    uint8_t etat[9];
+    uint64_t c0 = hote_cycles();
+    double t0 = secondes();
+    int s, fin, a, n;
+
+    for (s = 0; s < taille; s = fin)
+    {
+        fin = suite != 0 && taille - s > suite ? s + suite : taille;
+        for (a = s; a < fin; a += n)
+        {
+            n = fin - a < BLOC ? fin - a : BLOC;
+            requete(0, USBASP_FUNC_WRITEFLASH, a,
+                    HOTE_PAGE | (((a == s ? PROG_BLOCKFLAG_FIRST : 0) |
+                                  (a + n == fin ? PROG_BLOCKFLAG_LAST : 0))
+                                 << 8),
+                    (uint8_t *)image + a, n);
+        }
+    }
+    memset(etat, 0, sizeof(etat));
+    do
+        requete(1, USBASP_FUNC_GETPROGSTATUS, 0, 0, etat, sizeof(etat));
+    while (etat[0] & USBASP_PROGSTAT_OCCUPE);
+
+    printf("ecriture %-4s %6d octets  cible %7.3f s  %7.0f octets/s  "
+           "PC %.3f s\n", suite != 0 ? "page" : "tout", taille, cible_s(hote_cycles() - c0),
+           taille / cible_s(hote_cycles() - c0), secondes() - t0);
+    printf("              firmware: %u pages ecrites, %u sautees, "
+           "%u sans fin vue, SCK %s\n", etat[3] | (etat[4] << 8),
+           etat[7] | (etat[8] << 8), etat[5],
+           etat[6] < 13 ? vitesses[etat[6]] : "?");
+}
+
+/* CRC-16 de USBASP_FUNC_CRCFLASH, calculee ici bit a bit */
+static uint16_t crc16( const uint8_t *octets, int n )
+{
+    uint16_t crc = 0xFFFF;
+    int b;
+
+    while (n-- > 0)
+    {
+        crc ^= *octets++ << 8;
+        for (b = 0; b < 8; b++)
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+/* verifie la flash par les CRC de pages du firmware: 2 octets par page
+   sur le USB au lieu de HOTE_PAGE.  Retourne les pages differentes. */
+static int verifier_crc( const uint8_t *source, int pages )
+{
+    uint8_t crcs[2 * HOTE_FLASH / HOTE_PAGE];
+    uint64_t c0 = hote_cycles();
+    double t0 = secondes();
+    int p, e = 0;
+
+    requete(1, USBASP_FUNC_CRCFLASH, 0, HOTE_PAGE, crcs, 2 * pages);
+    for (p = 0; p < pages; p++)
+    {
+        if ((crcs[2 * p] | (crcs[2 * p + 1] << 8)) !=
+            crc16(source + p * HOTE_PAGE, HOTE_PAGE))
+            e++;
+    }
+    printf("crc           %6d octets  cible %7.3f s  %7.0f octets/s  "
+           "PC %.3f s  %d pages differentes\n", pages * HOTE_PAGE,
+           cible_s(hote_cycles() - c0),
+           pages * HOTE_PAGE / cible_s(hote_cycles() - c0), secondes() - t0,
+           e);
+    return e;
+}
+
+/* le SCK que USBASP_FUNC_ENABLEPROG trouve pour une cible a horloge Hz
+   (avrdude sans -B), et la signature lue a cette vitesse */
+static void negocier( struct HoteCible *cible, uint32_t horloge )
+{
+    uint8_t etat[7], reponse[1];
+    uint64_t c0;
+
+    cible->m_horloge = horloge;
+    c0 = hote_cycles();
+    requete(1, USBASP_FUNC_SETISPSCK, USBASP_ISP_SCK_AUTO, 0, reponse, 1);
+    requete(1, USBASP_FUNC_CONNECT, 0, 0, reponse, 0);
+    requete(1, USBASP_FUNC_ENABLEPROG, 0, 0, reponse, 1);
+    requete(1, USBASP_FUNC_GETPROGSTATUS, 0, 0, etat, sizeof(etat));
+    printf("cible %6.3f MHz  SCK %-9s  %.1f ms  %s  signature %02x %02x %02x\n",
+           horloge / 1e6, etat[6] < 13 ? vitesses[etat[6]] : "?",
+           cible_s(hote_cycles() - c0) * 1000,
+           reponse[0] == 0 ? "ok    " : "ERREUR",
+           transmettre(0x30, 0, 0, 0), transmettre(0x30, 0, 1, 0),
+           transmettre(0x30, 0, 2, 0));
+    requete(1, USBASP_FUNC_DISCONNECT, 0, 0, reponse, 0);
+}
+
+/* les compteurs du firmware depuis le dernier SETSERIOS (le DOR du
+   firmware compte les fois ou le USART a perdu au moins un octet) */
+static void compteurs( void )
+{
+    uint8_t c[2 * USBASP_SERSTAT_N];
+    uint16_t v[USBASP_SERSTAT_N];
+    int i;
+
+    requete(1, USBASP_FUNC_GETSERSTATS, 0, 0, c, sizeof(c));
+    for (i = 0; i < USBASP_SERSTAT_N; i++)
+        v[i] = c[2 * i] | (c[2 * i + 1] << 8);
+    printf("       firmware: DOR %u  FE %u  PE %u  fifo %u  RX max %u  "
+           "TX max %u\n",
+           v[USBASP_SERSTAT_DOR], v[USBASP_SERSTAT_FE], v[USBASP_SERSTAT_PE],
+           v[USBASP_SERSTAT_PERTES], v[USBASP_SERSTAT_RXMAX],
+           v[USBASP_SERSTAT_TXMAX]);
+}
+
+/* la cible envoie n octets d'un coup a HOTE_F_CPU / 8 / (ubrr + 1)
+   baud pendant que le PC les lit par READSER aussi vite qu'il peut.
+   Retourne les octets perdus: DOR quand le firmware ne vide pas le
+   tampon de 2 octets du USART a temps, fifo quand RxFifo deborde
+   parce que le USB ne suit pas. */
+static long serie( uint16_t ubrr, long n, long *dor )
+{
+    uint8_t reponse[8], recus[256];
+    uint8_t *donnees = malloc(n);
+    struct HoteStatistiques avant, apres;
+    long lus = 0;
+    int calme = 0;
+    int i, k, r;
+    uint64_t c0;
+
+    for (i = 0; i < n; i++)
+        donnees[i] = i * 7 + 1;
+    requete(1, USBASP_FUNC_SETSERIOS,
+            (USBASP_MODE_UART8BIT << 8) | USBASP_MODE_SETBAUD115200,
+            USBASP_MODE_PARITYN, reponse, 4);
+    UBRRH = ubrr >> 8;
+    UBRRL = ubrr;
+    hote_statistiques(&avant);
+    c0 = hote_cycles();
+    hote_source(donnees, n);
+
+    /* la fin: quelques READSER de suite sans rien */
+    while (calme < 20)
+    {
+        r = requete(1, USBASP_FUNC_READSER, 0, 0, recus, sizeof(recus));
+        calme++;
+        for (k = 0; k < r; k += 8)
+        {
+            if (recus[k] > 0)
+                calme = 0;
+            lus += recus[k];
+        }
+    }
+
+    hote_statistiques(&apres);
+    *dor = apres.m_dor - avant.m_dor;
+    printf("serie %7ld baud %6ld octets %7.0f octets/s  DOR %lu  fifo %lu  "
+           "perdus %ld\n",
+           HOTE_F_CPU / 8 / (ubrr + 1), n, lus / cible_s(hote_cycles() - c0),
+           apres.m_dor - avant.m_dor, apres.m_pertesFifo - avant.m_pertesFifo,
+           n - lus);
+    compteurs();
+    free(donnees);
+    return n - lus;
+}
+
+/* la cible envoie n octets a 115200 baud, mais le PC ne lit rien
+   pendant ms: seul RxFifo retient ce qui arrive, sauf si XON/XOFF
+   arrete la cible.  options est le 4e octet de SETSERIOS (part de la
+   reception, XON/XOFF).  Retourne 1 si des octets sont perdus ou
+   changes alors que RxFifo pouvait tenir tout ce qui arrive pendant ms
+   (ou que XON/XOFF devait arreter la cible), 0 sinon. */
+static int hoquet( uint8_t options, int ms, long n )
+{
+    uint8_t reponse[8], recus[256];
+    uint8_t *donnees = malloc(n);
+    struct HoteStatistiques avant, apres;
+    uint8_t part = options >> USBASP_SERRX_SHIFT;
+    long arrives = (long)OCTETS_115200 * ms / 1000;
+    long lus = 0, faux = 0;
+    int calme = 0, tenu;
+    int i, k, r;
+    uint64_t fin;
+
+    /* une case de RxFifo reste toujours vide (fifo.c) */
+    tenu = (options & USBASP_SERFLAG_XONXOFF) ||
+           (arrives < n ? arrives : n) <= USBASPRXLEN(part) - 1;
+
+    for (i = 0; i < n; i++)
+        donnees[i] = i * 7 + 1;
+    requete(1, USBASP_FUNC_SETSERIOS,
+            (USBASP_MODE_UART8BIT << 8) | USBASP_MODE_SETBAUD115200,
+            (options << 8) | USBASP_MODE_PARITYN, reponse, 4);
+    hote_statistiques(&avant);
+    hote_source(donnees, n);
+
+    fin = hote_cycles() + (uint64_t)HOTE_F_CPU * ms / 1000;
+    while (hote_cycles() < fin)
+        hote_boucle(100);
+
+    while (calme < 20)
+    {
+        r = requete(1, USBASP_FUNC_READSER, 0, 0, recus, sizeof(recus));
+        calme++;
+        for (k = 0; k < r; k += 8)
+        {
+            if (recus[k] > 0)
+                calme = 0;
+            for (i = 1; i <= recus[k] && lus < n; i++)
+                faux += recus[k + i] != donnees[lus++];
+        }
+    }
+
+    hote_statistiques(&apres);
+    printf("hoquet %3d ms  reception %2d/16  %-8s %6ld octets  fifo %lu  "
+           "perdus %ld  %s%s\n",
+           ms, part ? part : 8,
+           (options & USBASP_SERFLAG_XONXOFF) ? "XON/XOFF" : "", n,
+           apres.m_pertesFifo - avant.m_pertesFifo, n - lus,
+           lus == n && faux == 0 ? "identiques" : "differents",
+           !tenu ? "  (RxFifo trop petit)" :
+           lus == n && faux == 0 ? "" : "  ECHEC");
+    compteurs();
+    free(donnees);
+    return tenu && (lus < n || faux != 0);
+}
+
+int main( int argc, char *argv[] )
+{
+    int pages = argc > 1 ? atoi(argv[1]) : 64;
+    long n = argc > 2 ? atol(argv[2]) : 100000;
+    long octets = argc > 3 ? atol(argv[3]) : 4096;
+    long sansPerte = 0, sansDor = 0, dor = 0;
+    int taille = pages * HOTE_PAGE;
+    uint8_t *image, *creuse, *relue;
+    uint8_t reponse[8];
+    struct HoteCible *cible;
+    struct HoteStatistiques s;
+    uint64_t c0;
+    double t0;
+    int p, erreurs, e;
+    unsigned k;
+    long i;
+
+    if (pages <= 0 || taille > HOTE_FLASH || n <= 0 || octets <= 0)
+    {
+        fprintf(stderr, "usage: banc [pages (1 a %d) [requetes [octets]]]\n",
+                HOTE_FLASH / HOTE_PAGE);
+        return 1;
+    }
+
+    image = malloc(taille);
+    creuse = malloc(taille);
+    relue = malloc(taille);
+    srand(1);
+    for (i = 0; i < taille; i++)
+        image[i] = rand();
+    /* trois pages sur quatre effacees, comme un programme qui n'occupe
+       pas toute la flash */
+    for (i = 0; i < taille; i++)
+        creuse[i] = (i / HOTE_PAGE) % 4 == 0 ? image[i] : 0xFF;
+
+    hote_initialiser();
+    hote_boucle(1000);
+    cible = hote_cible();
+
+    for (k = 0; k < N_HORLOGES; k++)
+        negocier(cible, horloges[k]);
+
+    requete(1, USBASP_FUNC_CONNECT, 0, 0, reponse, 0);
+    requete(1, USBASP_FUNC_ENABLEPROG, 0, 0, reponse, 1);
+    if (reponse[0] != 0)
+    {
+        fprintf(stderr, "banc: la cible ne repond pas\n");
+        return 1;
+    }
+    printf("signature    %02x %02x %02x\n", transmettre(0x30, 0, 0, 0),
+           transmettre(0x30, 0, 1, 0), transmettre(0x30, 0, 2, 0));
+
+    erreurs = 0;
+    for (k = 0; k <= N_SUITES; k++)
+    {
+        /* chaque taille de bloc, puis l'image creuse comme avrdude */
+        const uint8_t *source = k < N_SUITES ? image : creuse;
+
+        /* effacement, puis attente de la fin comme avrdude */
+        transmettre(0xAC, 0x80, 0, 0);
+        while (transmettre(0xF0, 0, 0, 0) & 1)
+            ;
+
+        ecrire(source, taille, suites[k < N_SUITES ? k : 0]);
+
+        c0 = hote_cycles();
+        t0 = secondes();
+        for (p = 0; p < pages; p++)
+        {
+            requete(1, USBASP_FUNC_READFLASH, p * HOTE_PAGE, 0,
+                    relue + p * HOTE_PAGE, HOTE_PAGE);
+        }
+        printf("lecture       %6d octets  cible %7.3f s  %7.0f octets/s  "
+               "PC %.3f s\n", taille, cible_s(hote_cycles() - c0),
+               taille / cible_s(hote_cycles() - c0), secondes() - t0);
+
+        e = 0;
+        for (i = 0; i < taille; i++)
+        {
+            if (relue[i] != source[i] || cible->m_flash[i] != source[i])
+                e++;
+        }
+        printf("verification  %6d octets differents, %lu pages ecrites, "
+               "%lu instructions ignorees\n",
+               e, cible->m_pages, cible->m_ignorees);
+        erreurs += e + verifier_crc(source, pages);
+    }
+
+    /* une page alteree dans la cible: une seule CRC doit differer */
+    cible->m_flash[pages / 2 * HOTE_PAGE + 1] ^= 0x10;
+    if (verifier_crc(creuse, pages) != 1)
+        erreurs++;
+    cible->m_flash[pages / 2 * HOTE_PAGE + 1] ^= 0x10;
+
+    requete(1, USBASP_FUNC_DISCONNECT, 0, 0, reponse, 0);
+
+    /* requetes completes, avec les etapes USB et la boucle principale */
+    t0 = secondes();
+    for (i = 0; i < n; i++)
+        requete(1, USBASP_FUNC_GETSERSTATUS, 0, 0, reponse, 6);
+    printf("hote_controle     %9.0f requetes/s (PC)\n", n / (secondes() - t0));
+
+    /* la machine a etats seule */
+    setup[0] = 0xC0;
+    setup[1] = USBASP_FUNC_GETSERSTATUS;
+    setup[6] = 6;
+    t0 = secondes();
+    for (i = 0; i < n * 10; i++)
+        usbFunctionSetup(setup);
+    printf("usbFunctionSetup  %9.0f requetes/s (PC)\n",
+           n * 10 / (secondes() - t0));
+
+    for (i = 0; i < (long)N_UBRRS && dor == 0; i++)
+    {
+        if (serie(ubrrs[i], octets, &dor) == 0)
+            sansPerte = HOTE_F_CPU / 8 / (ubrrs[i] + 1);
+        if (dor == 0)
+            sansDor = HOTE_F_CPU / 8 / (ubrrs[i] + 1);
+    }
+    printf("serie sans perte jusqu'a %ld baud, sans DOR jusqu'a %ld baud\n",
+           sansPerte, sansDor);
+
+    printf("hoquet: RxFifo de %d octets a 15/16, %ld ms a 115200 baud\n",
+           USBASPRXLEN(15) - 1,
+           (USBASPRXLEN(15) - 1) * 1000L / OCTETS_115200);
+    erreurs += hoquet(15 << USBASP_SERRX_SHIFT, HOQUET_COURT_MS, octets);
+    erreurs += hoquet(0, HOQUET_MS, octets);
+    erreurs += hoquet(12 << USBASP_SERRX_SHIFT, HOQUET_MS, octets);
+    erreurs += hoquet(15 << USBASP_SERRX_SHIFT, HOQUET_MS, octets);
+    erreurs += hoquet(0, HOQUET_LONG_MS, octets);
+    erreurs += hoquet(USBASP_SERFLAG_XONXOFF, HOQUET_LONG_MS, octets);
+    erreurs += hoquet(USBASP_SERFLAG_XONXOFF | (1 << USBASP_SERRX_SHIFT),
+                      HOQUET_LONG_MS, octets);
+
+    hote_statistiques(&s);
+    printf("total        %lu requetes  %lu octets SPI  cible %.3f s\n",
+           s.m_requetes, s.m_octetsSpi, cible_s(s.m_cycles));
+
+    free(image);
+    free(creuse);
+    free(relue);
+    return erreurs != 0;
+}
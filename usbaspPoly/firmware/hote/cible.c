@@ -0,0 +1,195 @@
+/*
+ * cible.c - l'AVR branche sur le ISP du firmware compile pour le PC
+ *
+ * Autor..........: Jerome Collin (jerome.collin@polymtl.ca)
+ * Description....: voir cible.h.  Les instructions de programmation
+ *                  serie sont celles de la fiche technique des ATmega:
+ *                  4 octets, le deuxieme et le troisieme renvoyes avec
+ *                  un octet de retard, le resultat d'une lecture dans
+ *                  le quatrieme.
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ */
+
+#include <string.h>
+
+#include "cible.h"
+
+#define CYCLES_US(us)   ((uint64_t)(us) * (HOTE_F_CPU / 1000000))
+
+void cible_initialiser( struct HoteCible *c )
+{
+    memset(c, 0, sizeof(*c));
+    memset(c->m_flash, 0xFF, sizeof(c->m_flash));
+    memset(c->m_eeprom, 0xFF, sizeof(c->m_eeprom));
+    c->m_signature[0] = 0x1E;
+    c->m_signature[1] = 0x95;
+    c->m_signature[2] = 0x11;
+    c->m_fusibles[0] = 0xD7;
+    c->m_fusibles[1] = 0xD9;
+    c->m_fusibles[2] = 0xFD;
+    c->m_fusibles[3] = 0xFF;
+    c->m_horloge = HOTE_CIBLE_HORLOGE;
+    c->m_rst = 1;
+}
+
+void cible_reset( struct HoteCible *c, uint8_t niveau )
+{
+    c->m_rst = niveau;
+    if (niveau)
+    {
+        c->m_programmation = 0;
+        c->m_entree = 0;
+        c->m_sortie = 0;
+        c->m_bits = 0;
+        c->m_position = 0;
+    }
+}
+
+/* octet rendu pendant le quatrieme octet d'une instruction */
+static uint8_t lire( struct HoteCible *c, uint64_t maintenant )
+{
+    const uint8_t *i = c->m_instruction;
+    unsigned long mot = (i[1] << 8) | i[2];
+    uint8_t occupee = maintenant < c->m_occupee;
+
+    switch (i[0])
+    {
+    case 0x20:
+    case 0x28:
+        if (occupee)
+            return 0xFF;
+        return c->m_flash[(mot * 2 + (i[0] >> 3 & 1)) % HOTE_FLASH];
+    case 0xA0:
+        if (occupee)
+            return 0xFF;
+        return c->m_eeprom[mot % HOTE_EEPROM];
+    case 0x30:
+        return (i[2] & 3) < 3 ? c->m_signature[i[2] & 3] : 0xFF;
+    case 0x50:
+        return c->m_fusibles[i[1] == 0x08 ? 2 : 0];
+    case 0x58:
+        return c->m_fusibles[i[1] == 0x08 ? 1 : 3];
+    case 0xF0:
+        return occupee;
+    }
+    return 0;
+}
+
+static void executer( struct HoteCible *c, uint64_t maintenant )
+{
+    const uint8_t *i = c->m_instruction;
+    unsigned long mot = (i[1] << 8) | i[2];
+    unsigned long base;
+    int k;
+
+    if (!c->m_programmation)
+    {
+        /* hors du mode programmation, seul Programming Enable compte */
+        if (i[0] == 0xAC && i[1] == 0x53)
+            c->m_programmation = 1;
+        return;
+    }
+
+    switch (i[0])
+    {
+    case 0x40:
+    case 0x48:
+        /* le tampon de page se charge meme pendant une ecriture */
+        c->m_page[(mot * 2 + (i[0] >> 3 & 1)) % HOTE_PAGE] = i[3];
+        return;
+    case 0x20: case 0x28: case 0xA0: case 0x30:
+    case 0x50: case 0x58: case 0xF0:
+        return;
+    }
+
+    if (maintenant < c->m_occupee)
+    {
+        c->m_ignorees++;
+        return;
+    }
+
+    switch (i[0])
+    {
+    case 0xAC:
+        switch (i[1])
+        {
+        case 0x80:
+            memset(c->m_flash, 0xFF, sizeof(c->m_flash));
+            memset(c->m_eeprom, 0xFF, sizeof(c->m_eeprom));
+            c->m_fusibles[3] = 0xFF;
+            c->m_occupee = maintenant + CYCLES_US(HOTE_EFFACEMENT_US);
+            break;
+        case 0xA0:
+            c->m_fusibles[0] = i[3];
+            break;
+        case 0xA8:
+            c->m_fusibles[1] = i[3];
+            break;
+        case 0xA4:
+            c->m_fusibles[2] = i[3];
+            break;
+        case 0xE0:
+            c->m_fusibles[3] = i[3];
+            break;
+        }
+        break;
+    case 0x4C:
+        /* la flash ne fait que passer des 1 aux 0 sans effacement */
+        base = (mot * 2) % HOTE_FLASH & ~(unsigned long)(HOTE_PAGE - 1);
+        for (k = 0; k < HOTE_PAGE; k++)
+            c->m_flash[base + k] &= c->m_page[k];
+        c->m_pages++;
+        c->m_occupee = maintenant + CYCLES_US(HOTE_ECRITURE_FLASH_US);
+        break;
+    case 0xC0:
+        c->m_eeprom[mot % HOTE_EEPROM] = i[3];
+        c->m_octetsEeprom++;
+        c->m_occupee = maintenant + CYCLES_US(HOTE_ECRITURE_EEPROM_US);
+        break;
+    }
+}
+
+void cible_front_montant( struct HoteCible *c, uint8_t mosi, uint64_t maintenant )
+{
+    if (c->m_rst)
+        return;
+
+    c->m_entree = (c->m_entree << 1) | (mosi & 1);
+    if (++c->m_bits < 8)
+        return;
+
+    c->m_bits = 0;
+    c->m_instruction[c->m_position++] = c->m_entree;
+    switch (c->m_position)
+    {
+    case 1:
+    case 2:
+        /* l'octet suivant renvoie celui qui vient d'arriver */
+        c->m_sortie = c->m_entree;
+        break;
+    case 3:
+        c->m_sortie = lire(c, maintenant);
+        break;
+    default:
+        executer(c, maintenant);
+        c->m_sortie = 0;
+        c->m_position = 0;
+        break;
+    }
+}
+
+/* MISO change au front descendant, sauf entre deux octets: le premier
+   bit de l'octet suivant est deja en place */
+void cible_front_descendant( struct HoteCible *c )
+{
+    if (c->m_rst || c->m_bits == 0)
+        return;
+    c->m_sortie <<= 1;
+}
+
+uint8_t cible_miso( const struct HoteCible *c )
+{
+    if (c->m_rst)
+        return 0;
+    return (c->m_sortie >> 7) & 1;
+}
@@ -0,0 +1,31 @@
+/*
+ * cible.h - l'AVR branche sur le ISP du firmware compile pour le PC
+ *
+ * Autor..........: Jerome Collin (jerome.collin@polymtl.ca)
+ * Description....: interne a hote.c.  La cible ne voit que les niveaux
+ *                  de ses broches: RESET, et chaque front de SCK avec
+ *                  MOSI.  Elle decale comme le SPI esclave d'un AVR
+ *                  (mode 0, bit de poids fort en premier): MOSI est lu
+ *                  au front montant, MISO change au front descendant.
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ */
+
+#ifndef __hote_cible_h_included__
+#define __hote_cible_h_included__
+
+#include <stdint.h>
+#include "hote.h"
+
+/* flash et EEPROM effacees, signature et fusibles d'un ATmega324PA */
+void cible_initialiser( struct HoteCible *c );
+
+/* RESET a 1: la cible tourne et laisse le mode programmation */
+void cible_reset( struct HoteCible *c, uint8_t niveau );
+
+void cible_front_montant( struct HoteCible *c, uint8_t mosi, uint64_t maintenant );
+
+void cible_front_descendant( struct HoteCible *c );
+
+uint8_t cible_miso( const struct HoteCible *c );
+
+#endif /* __hote_cible_h_included__ */
@@ -0,0 +1,414 @@
+/*
+ * fuzz.c - fuzzing des fonctions USB du firmware compile pour le PC
+ *
+ * Autor..........: Jerome Collin (jerome.collin@polymtl.ca)
+ * Description....: LLVMFuzzerTestOneInput() fait passer des requetes
+ *                  de controle a usbFunctionSetup(), puis leurs paquets
+ *                  a usbFunctionRead() ou usbFunctionWrite(), dans
+ *                  l'ordre ou le pilote V-USB les appelle, en temps
+ *                  virtuel (voir hote.h), avec des tours de la boucle
+ *                  principale entre les paquets.  Apres chaque appel,
+ *                  il verifie l'etat de main.c, inclus ici pour voir ses
+ *                  variables: prog_state valide, Read et Write a 0xff
+ *                  hors de leurs etats et IDLE apres le dernier paquet,
+ *                  fifos dans SerData et PageFifo seul quand il y est.
+ *                  Une faute arrete tout (abort).
+ *
+ *                  L'entree est une suite de requetes:
+ *                    8 octets  le paquet SETUP, tel quel (le bit 7 du
+ *                              premier donne le sens des donnees)
+ *                    1 octet   bits 0-3: paquets que l'hote fait passer
+ *                              avant d'abandonner (0: jusqu'a 16),
+ *                              bits 4-6: tours de boucle apres chaque
+ *                              paquet, bit 7: appels egares de
+ *                              usbFunctionRead/Write hors de leur etat
+ *                  et, pour une requete OUT acceptee, ses donnees, par
+ *                  paquets de 8 (des 0 une fois l'entree epuisee).
+ *                  Les SCK logiciels et les blocs de CRC de plus de
+ *                  FUZZ_CRC octets ne font que ralentir le fuzzing: ils
+ *                  sont ramenes a 93.75 kHz et a FUZZ_CRC, sauf les
+ *                  blocs de plus de USBASP_CRC_MAX, que le firmware
+ *                  doit refuser.
+ *
+ *                  Avec clang, c'est une cible de libFuzzer.  Avec gcc
+ *                  (FUZZ_AUTONOME), main() relit les fichiers donnes,
+ *                  ou tire des entrees au hasard, et ecrit celle qui
+ *                  fait une faute dans crash-fuzz.  Voir make fuzz.
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ */
+
+#define main firmware_main
+#include "../main.c"
+#undef main
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hote.h"
+
+#define FUZZ_CRC        16
+#define FUZZ_PAQUETS    16
+
+static unsigned long requetes;
+static uint8_t requeteCourante;
+
+#ifdef FUZZ_AUTONOME
+#include <signal.h>
+#include <unistd.h>
+#include <sanitizer/common_interface_defs.h>
+
+static const uint8_t *entree;
+static size_t tailleEntree;
+
+static void garder_entree( void )
+{
+    FILE *f = fopen("crash-fuzz", "wb");
+
+    if (f == NULL)
+        return;
+    fwrite(entree, 1, tailleEntree, f);
+    fclose(f);
+    fprintf(stderr, "fuzz: entree gardee dans crash-fuzz\n");
+}
+#endif
+
+static void faute( const char *condition, int ligne )
+{
+    fprintf(stderr, "fuzz: faute ligne %d, requete %d, prog_state %d: %s\n",
+            ligne, requeteCourante, prog_state, condition);
+#ifdef FUZZ_AUTONOME
+    garder_entree();
+#endif
+    abort();
+}
+
+#define VERIFIER(condition) \
+    do { if (!(condition)) faute(#condition, __LINE__); } while (0)
+
+static uint8_t en_lecture( uint8_t etat )
+{
+    return etat == PROG_STATE_READFLASH || etat == PROG_STATE_READEEPROM ||
+           etat == PROG_STATE_READSER || etat == PROG_STATE_CRCFLASH;
+}
+
+static uint8_t en_ecriture( uint8_t etat )
+{
+    return etat == PROG_STATE_WRITEFLASH || etat == PROG_STATE_WRITEEEPROM ||
+           etat == PROG_STATE_WRITESER;
+}
+
+static void verifier_fifo( const struct Fifo *f )
+{
+    if (f->m_size == 0)
+    {
+        VERIFIER(f->m_begin == 0 && f->m_end == 0);
+        return;
+    }
+    VERIFIER(f->m_begin < f->m_size && f->m_end < f->m_size);
+    VERIFIER(f->m_data >= SerData &&
+             f->m_data + f->m_size <= SerData + USBASPSERLEN);
+}
+
+static void verifier_etat( void )
+{
+    VERIFIER(prog_state <= PROG_STATE_CRCFLASH);
+    VERIFIER(prog_busy <= 1);
+    /* des 0xFF en attente seulement tant que la page n'a rien d'autre */
+    VERIFIER(prog_ffcount == 0 || prog_pollvalue == 0xFF);
+    verifier_fifo(&TxFifo);
+    verifier_fifo(&RxFifo);
+    verifier_fifo(&PageFifo);
+    /* SerData est a PageFifo ou aux fifos du USART, jamais aux deux */
+    if (PageFifo.m_size != 0)
+        VERIFIER(TxFifo.m_size == 0 && RxFifo.m_size == 0);
+    if (TxFifo.m_size != 0 && RxFifo.m_size != 0)
+        VERIFIER(RxFifo.m_data + RxFifo.m_size <= TxFifo.m_data);
+}
+
+/* l'etat de main.c au demarrage; le modele (cible, USART, temps)
+   continue d'une entree a l'autre */
+static void repartir( void )
+{
+    usart_stop();
+    ser_flags = 0;
+    fifo_init(&TxFifo, 0, 0);
+    fifo_init(&RxFifo, 0, 0);
+    fifo_init(&PageFifo, 0, 0);
+    prog_state = PROG_STATE_IDLE;
+    prog_sck = USBASP_ISP_SCK_AUTO;
+    prog_address_newmode = 0;
+    prog_address = 0;
+    prog_nbytes = 0;
+    prog_pagesize = 0;
+    prog_blockflags = 0;
+    prog_pagecounter = 0;
+    prog_crcsize = 0;
+    prog_loadaddress = 0;
+    prog_busy = 0;
+    prog_pollvalue = 0xFF;
+    prog_ffcount = 0;
+    prog_pages = 0;
+    prog_skipped = 0;
+    prog_errors = 0;
+}
+
+/* un tour de la boucle principale de main.c, sans usbPoll() */
+static void tour( void )
+{
+    uint8_t paquet[8];
+    uchar i;
+
+    pages_avancer();
+    if ((ser_flags & USBASP_SERFLAG_INTRIN) && usbInterruptIsReady())
+    {
+        usart_masquer();
+        i = fifo_dequeue_n(&RxFifo, intrBuffer, sizeof(intrBuffer));
+        usart_demasquer();
+        if (i > 0)
+            usbSetInterrupt(intrBuffer, i);
+    }
+    VERIFIER(hote_interruption(paquet) <= 8);
+}
+
+/* usbFunctionRead et usbFunctionWrite appeles hors de leur etat,
+   comme par un paquet de donnees que V-USB n'attendait pas */
+static void egarer( void )
+{
+    uint8_t paquet[8];
+
+    memset(paquet, 0, sizeof(paquet));
+    if (!en_lecture(prog_state))
+        VERIFIER(usbFunctionRead(paquet, sizeof(paquet)) == 0xff);
+    if (!en_ecriture(prog_state))
+        VERIFIER(usbFunctionWrite(paquet, sizeof(paquet)) == 0xff);
+    verifier_etat();
+}
+
+static void requete( uint8_t setup[8], uint8_t controle,
+                     const uint8_t **donnees, size_t *taille )
+{
+    uint16_t longueur = setup[6] | (setup[7] << 8);
+    uint16_t position = 0;
+    uint8_t paquets = controle & 0x0F;
+    uint8_t tours = (controle >> 4) & 0x07;
+    uint8_t paquet[8];
+    uint8_t avant, n, r, i;
+    uchar len;
+
+    requetes++;
+    requeteCourante = setup[1];
+    avant = prog_state;
+    len = usbFunctionSetup(setup);
+    VERIFIER(usbMsgPtr == replyBuffer);
+    VERIFIER(len == USB_NO_MSG || len <= sizeof(replyBuffer));
+    /* seules les requetes a plusieurs paquets changent d'etat */
+    if (len == USB_NO_MSG)
+        VERIFIER(en_lecture(prog_state) || en_ecriture(prog_state));
+    else
+        VERIFIER(prog_state == avant);
+    if (setup[1] == USBASP_FUNC_CRCFLASH &&
+        (setup[4] | (setup[5] << 8)) > USBASP_CRC_MAX)
+        VERIFIER(len == 0);
+    verifier_etat();
+    if (controle & 0x80)
+        egarer();
+    if (len != USB_NO_MSG)
+        return;
+
+    if (paquets == 0)
+        paquets = FUZZ_PAQUETS;
+    while (position < longueur && paquets-- > 0)
+    {
+        n = longueur - position < 8 ? longueur - position : 8;
+        avant = prog_state;
+        if (setup[0] & 0x80)
+        {
+            r = usbFunctionRead(paquet, n);
+            if (!en_lecture(avant))
+            {
+                VERIFIER(r == 0xff);
+                return;
+            }
+            VERIFIER(r <= n);
+            if (avant == PROG_STATE_READSER)
+                VERIFIER(r >= 1 && paquet[0] == r - 1);
+            /* un paquet court termine le transfert */
+            if (r < 8)
+                VERIFIER(prog_state == PROG_STATE_IDLE);
+            position += r;
+        }
+        else
+        {
+            memset(paquet, 0, sizeof(paquet));
+            i = *taille < n ? *taille : n;
+            memcpy(paquet, *donnees, i);
+            *donnees += i;
+            *taille -= i;
+            r = usbFunctionWrite(paquet, n);
+            if (!en_ecriture(avant))
+            {
+                VERIFIER(r == 0xff);
+                return;
+            }
+            VERIFIER(r == 0 || r == 1);
+            if (r == 1)
+                VERIFIER(prog_state == PROG_STATE_IDLE);
+            position += n;
+        }
+        verifier_etat();
+        for (i = 0; i < tours; i++)
+            tour();
+        verifier_etat();
+        /* le dernier paquet: court en lecture, 1 en ecriture */
+        if ((setup[0] & 0x80) ? r < 8 : r == 1)
+            return;
+    }
+}
+
+int LLVMFuzzerTestOneInput( const uint8_t *donnees, size_t taille )
+{
+    static uint8_t pret;
+    uint8_t setup[8];
+    uint8_t controle;
+    uint16_t crc;
+
+    if (!pret)
+    {
+        /* l'initialisation de firmware_main(), jusqu'a usbPoll() */
+        hote_initialiser();
+        hote_boucle(1);
+        pret = 1;
+    }
+    repartir();
+
+    while (taille >= 9)
+    {
+        memcpy(setup, donnees, 8);
+        controle = donnees[8];
+        donnees += 9;
+        taille -= 9;
+
+        if (setup[1] == USBASP_FUNC_SETISPSCK &&
+            setup[2] != USBASP_ISP_SCK_AUTO &&
+            setup[2] < USBASP_ISP_SCK_93_75)
+            setup[2] = USBASP_ISP_SCK_93_75;
+        crc = setup[4] | (setup[5] << 8);
+        if (setup[1] == USBASP_FUNC_CRCFLASH && crc > FUZZ_CRC &&
+            crc <= USBASP_CRC_MAX)
+        {
+            setup[4] = FUZZ_CRC;
+            setup[5] = 0;
+        }
+        requete(setup, controle, &donnees, &taille);
+    }
+    return 0;
+}
+
+#ifdef FUZZ_AUTONOME
+
+/* sans libFuzzer: les fichiers donnes, sinon des entrees au hasard
+   jusqu'a -max_total_time=<s> ou -runs=<n>, les memes options que
+   libFuzzer.  Les requetes tirees sont surtout celles de usbasp.h.
+   L'entree d'une faute, meme trouvee par ASan ou UBSan, est gardee
+   dans crash-fuzz. */
+
+#define FUZZ_MAX_ENTREE 1024
+
+/* une entree plus longue est une faute, comme -timeout de libFuzzer */
+#define FUZZ_DELAI_S    10
+
+static void trop_long( int signal )
+{
+    (void)signal;
+    fprintf(stderr, "fuzz: une entree a pris plus de %d s\n", FUZZ_DELAI_S);
+    garder_entree();
+    abort();
+}
+
+static double secondes( void )
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static size_t tirer( uint8_t *octets )
+{
+    size_t n = 0;
+    int k, requetes = 1 + lrand48() % 40;
+
+    while (requetes-- > 0 && n + 9 + 64 <= FUZZ_MAX_ENTREE)
+    {
+        for (k = 0; k < 9; k++)
+            octets[n + k] = lrand48();
+        if (lrand48() % 8 != 0)
+            octets[n + 1] = 1 + lrand48() % USBASP_FUNC_CRCFLASH;
+        /* surtout de courtes requetes, sinon elles vont au-dela de
+           FUZZ_PAQUETS paquets */
+        if (lrand48() % 4 != 0)
+            octets[n + 7] = 0;
+        octets[n] = (octets[n] & 0x80) | 0x40;
+        n += 9;
+        for (k = lrand48() % 64; k > 0; k--)
+            octets[n++] = lrand48();
+    }
+    return n;
+}
+
+int main( int argc, char *argv[] )
+{
+    static uint8_t octets[FUZZ_MAX_ENTREE];
+    double debut = secondes(), duree = 60;
+    unsigned long entrees = 0, runs = 0;
+    FILE *f;
+    int k, fichiers = 0;
+
+    for (k = 1; k < argc; k++)
+    {
+        if (strncmp(argv[k], "-max_total_time=", 16) == 0)
+            duree = atof(argv[k] + 16);
+        else if (strncmp(argv[k], "-runs=", 6) == 0)
+            runs = atol(argv[k] + 6);
+        else if (argv[k][0] != '-')
+        {
+            f = fopen(argv[k], "rb");
+            if (f == NULL)
+            {
+                fprintf(stderr, "fuzz: incapable de lire %s\n", argv[k]);
+                return -1;
+            }
+            tailleEntree = fread(octets, 1, sizeof(octets), f);
+            fclose(f);
+            entree = octets;
+            alarm(FUZZ_DELAI_S);
+            LLVMFuzzerTestOneInput(octets, tailleEntree);
+            alarm(0);
+            entrees++;
+            fichiers++;
+        }
+    }
+
+    /* ASan et UBSan s'arretent sans passer par faute() */
+    __sanitizer_set_death_callback(garder_entree);
+    signal(SIGALRM, trop_long);
+    srand48(1);
+    while (fichiers == 0 && (runs == 0 || entrees < runs) &&
+           secondes() - debut < duree)
+    {
+        tailleEntree = tirer(octets);
+        entree = octets;
+        alarm(FUZZ_DELAI_S);
+        LLVMFuzzerTestOneInput(octets, tailleEntree);
+        alarm(0);
+        entrees++;
+    }
+
+    printf("fuzz: %lu entrees, %lu requetes en %.1f s, aucune faute\n",
+           entrees, requetes, secondes() - debut);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,818 @@
+/*
+ * hote.c - le firmware du USBasp compile pour le PC
+ *
+ * Autor..........: Jerome Collin (jerome.collin@polymtl.ca)
+ * Description....: voir hote.h
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <ucontext.h>
+
+#include "usbdrv.h"
+#include "usbconfig.h"
+#include "usart.h"
+#include "cible.h"
+
+#define CYCLES_US       (HOTE_F_CPU / 1000000)
+#define CYCLES_MS       (HOTE_F_CPU / 1000)
+
+/* pile de la coroutine du firmware, en temps virtuel */
+#define TAILLE_PILE     (256 * 1024)
+
+int firmware_main( void );
+
+volatile uint8_t DDRB;
+volatile uint8_t PORTC, DDRC, PINC;
+volatile uint8_t PORTD, DDRD, PIND;
+volatile uint8_t TCCR0B;
+volatile uint8_t SPCR;
+volatile uint8_t UCSRB, UBRRL, UBRRH;
+volatile uint8_t UCSRC = (1 << URSEL) | (1 << UCSZ1) | (1 << UCSZ0);
+
+uchar *usbMsgPtr;
+
+static struct HoteCible cible;
+static uint8_t cibleInitialisee;
+
+/* ---- temps ---- */
+
+static uint8_t virtuel;
+static uint64_t maintenant;         /* temps du modele, en cycles */
+
+static int64_t reelPrecedent;
+static int64_t reelModele;          /* temps reel du modele, en ns */
+static int64_t perdu;
+
+static int64_t horloge( void )
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (int64_t)t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+/* en temps virtuel, le cout de l'instruction; en temps reel, l'horloge
+   sans compter les pauses du fil */
+static void avancer_temps( uint32_t cycles )
+{
+    int64_t reel, pas;
+
+    if (virtuel)
+    {
+        maintenant += cycles;
+        return;
+    }
+    reel = horloge();
+    pas = reel - reelPrecedent;
+    reelPrecedent = reel;
+    if (pas > HOTE_PAS_MAX_NS)
+    {
+        perdu += pas - HOTE_PAS_MAX_NS;
+        pas = HOTE_PAS_MAX_NS;
+    }
+    reelModele += pas;
+    maintenant = reelModele * (HOTE_F_CPU / 1000000) / 1000;
+}
+
+/* ---- registres doubles ----
+   UDR et SPDR servent a la lecture comme a l'ecriture.  La valeur
+   preparee pour une lecture porte le bit 15, qu'une ecriture de 8 bits
+   efface: l'acces suivant a un registre modelise dit lequel c'etait. */
+
+#define ACCES_AUCUN     0
+#define ACCES_LECTURE   1
+#define ACCES_ECRITURE  2
+
+struct RegistreDouble
+{
+    volatile uint16_t m_valeur;
+    uint16_t m_prepare;
+    uint8_t m_acces;
+};
+
+static int terminer_double( struct RegistreDouble *r )
+{
+    if (!r->m_acces)
+        return ACCES_AUCUN;
+    r->m_acces = 0;
+    return r->m_valeur != r->m_prepare ? ACCES_ECRITURE : ACCES_LECTURE;
+}
+
+static volatile uint16_t *preparer_double( struct RegistreDouble *r, uint8_t lu )
+{
+    r->m_prepare = 0x8000 | lu;
+    r->m_valeur = r->m_prepare;
+    r->m_acces = 1;
+    return &r->m_valeur;
+}
+
+/* ---- USART ---- */
+
+static volatile uint8_t ucsra = (1 << UDRE);
+static struct RegistreDouble udr;
+
+static uint8_t txPlein;             /* octet dans UDR, pas encore decale */
+static uint8_t txOctet;
+static uint8_t decalage;            /* registre a decalage occupe */
+static uint8_t decale;
+static uint64_t finDecalage;
+
+static uint8_t rxTampon[2];
+static uint8_t nRx;
+static uint8_t rxDor;
+
+static unsigned long envoyes, recus, dor;
+
+/* hote_source(): la cible envoie sans arret, TX n'est plus relie a RX */
+static const uint8_t *source;
+static long nSource;
+static uint64_t finSource;
+static uint8_t sourceArretee;       /* XOFF recu */
+static uint8_t sursis;              /* octets encore envoyes apres XOFF */
+
+/* duree d'un octet en cycles selon UBRR, U2X et UCSRC */
+static uint64_t duree_octet( void )
+{
+    uint64_t ubrr = ((UBRRH & 0x0F) << 8) | UBRRL;
+    uint64_t diviseur = (ucsra & (1 << U2X)) ? 8 : 16;
+    int bits = 1 + 5 + ((UCSRC >> UCSZ0) & 3) + 1;
+
+    if (UCSRC & (1 << UPM1))
+        bits++;
+    if (UCSRC & (1 << USBS))
+        bits++;
+    return bits * diviseur * (ubrr + 1);
+}
+
+static void recevoir( uint8_t octet )
+{
+    if (!(UCSRB & (1 << RXEN)))
+        return;
+    recus++;
+    if (nRx < sizeof(rxTampon))
+        rxTampon[nRx++] = octet;
+    else
+    {
+        dor++;
+        rxDor = 1;
+    }
+}
+
+/* les octets dont le decalage est termine passent sur la ligne */
+static void avancer_ligne( void )
+{
+    uint64_t t;
+
+    while (decalage && finDecalage <= maintenant)
+    {
+        t = finDecalage;
+        decalage = 0;
+        envoyes++;
+        if (source == NULL)
+            recevoir(decale);
+        else if (decale == USBASP_XOFF && !sourceArretee)
+        {
+            sourceArretee = 1;
+            sursis = HOTE_OCTETS_APRES_XOFF;
+        }
+        else if (decale == USBASP_XON && sourceArretee)
+        {
+            sourceArretee = 0;
+            if (finSource < t + duree_octet())
+                finSource = t + duree_octet();
+        }
+        if (txPlein)
+        {
+            decale = txOctet;
+            txPlein = 0;
+            decalage = 1;
+            finDecalage = t + duree_octet();
+        }
+    }
+    while (source != NULL && finSource <= maintenant &&
+           (!sourceArretee || sursis > 0))
+    {
+        if (sourceArretee)
+            sursis--;
+        recevoir(*source++);
+        finSource += duree_octet();
+        if (--nSource == 0)
+            source = NULL;
+    }
+}
+
+static void ecrire_udr( uint8_t octet )
+{
+    if (!(UCSRB & (1 << TXEN)))
+        return;
+    if (!decalage)
+    {
+        decale = octet;
+        decalage = 1;
+        finDecalage = maintenant + duree_octet();
+    }
+    else if (!txPlein)
+    {
+        txOctet = octet;
+        txPlein = 1;
+    }
+}
+
+/* ---- ISP: broches et SPI ---- */
+
+static volatile uint8_t portb, pinb;
+static uint8_t rstVu = 1, sckVu;
+
+static volatile uint8_t spsr;
+static struct RegistreDouble spdr;
+static uint8_t spiRecu;
+static uint8_t spiActif;            /* transfert lance, SPIF pas encore lu */
+static uint64_t finSpi;
+
+static unsigned long octetsSpi;
+
+static void front_montant( uint8_t mosi )
+{
+    cible_front_montant(&cible, mosi, maintenant);
+    if (!cible.m_rst && cible.m_bits == 0)
+        octetsSpi++;
+}
+
+/* niveau d'une broche de PORTB: en entree, RST a un tirage vers le haut
+   sur la cible, SCK et MOSI flottent a 0 */
+static uint8_t broche( uint8_t bit, uint8_t repos )
+{
+    if (DDRB & (1 << bit))
+        return (portb >> bit) & 1;
+    return repos;
+}
+
+/* fronts de RST et de SCK depuis le dernier acces.  Avec SPE, SCK et
+   MOSI appartiennent au SPI materiel. */
+static void suivre_broches( void )
+{
+    uint8_t rst = broche(PB2, 1);
+    uint8_t sck = (SPCR & (1 << SPE)) ? 0 : broche(PB5, 0);
+
+    if (rst != rstVu)
+    {
+        cible_reset(&cible, rst);
+        rstVu = rst;
+    }
+    if (sck != sckVu)
+    {
+        if (sck)
+            front_montant(broche(PB3, 0));
+        else
+            cible_front_descendant(&cible);
+        sckVu = sck;
+    }
+}
+
+/* SCK = F_CPU / 4, 16, 64 ou 128 selon SPR1:0, deux fois plus vite
+   avec SPI2X */
+static uint32_t diviseur_spi( void )
+{
+    static const uint32_t diviseurs[] = { 4, 16, 64, 128 };
+    uint32_t d = diviseurs[SPCR & 3];
+
+    if (spsr & (1 << SPI2X))
+        d /= 2;
+    return d;
+}
+
+/* les 8 bits passent d'un coup; SPIF ne monte qu'a la fin du temps
+   qu'ils prennent sur la ligne.  Au-dela de m_horloge / 4, la cible ne
+   voit qu'un front de SCK sur deux. */
+static void transfert_spi( uint8_t octet )
+{
+    uint8_t recu = 0;
+    uint8_t tropRapide;
+    int i;
+
+    if ((SPCR & ((1 << SPE) | (1 << MSTR))) != ((1 << SPE) | (1 << MSTR)))
+        return;
+    tropRapide = (uint64_t)diviseur_spi() * cible.m_horloge <
+                 4 * (uint64_t)HOTE_F_CPU;
+    for (i = 0; i < 8; i++)
+    {
+        recu = (recu << 1) | cible_miso(&cible);
+        if (!tropRapide || (i & 1))
+        {
+            front_montant(octet >> 7);
+            cible_front_descendant(&cible);
+        }
+        octet <<= 1;
+    }
+    spiRecu = recu;
+    spiActif = 1;
+    finSpi = maintenant + 8 * diviseur_spi();
+}
+
+/* ---- acces aux registres ---- */
+
+static uint8_t interruptionsPermises;   /* bit I de SREG */
+static uint8_t dansInt0;
+
+/* l'acces precedent a UDR ou SPDR etait une lecture ou une ecriture */
+static void terminer_acces( void )
+{
+    switch (terminer_double(&udr))
+    {
+    case ACCES_ECRITURE:
+        ecrire_udr(udr.m_valeur);
+        break;
+    case ACCES_LECTURE:
+        if (nRx > 0)
+        {
+            rxTampon[0] = rxTampon[1];
+            nRx--;
+            rxDor = 0;
+        }
+        break;
+    }
+    switch (terminer_double(&spdr))
+    {
+    case ACCES_ECRITURE:
+        transfert_spi(spdr.m_valeur);
+        break;
+    case ACCES_LECTURE:
+        spiActif = 0;
+        break;
+    }
+}
+
+/* les interruptions du USART en attente, RXC d'abord comme dans la
+   table des vecteurs.  Le firmware masque la source au debut de la
+   routine: une autre peut s'imbriquer, pas la meme. */
+static void interruptions( void )
+{
+    if (!interruptionsPermises || dansInt0)
+        return;
+    for (;;)
+    {
+        if ((UCSRB & (1 << RXCIE)) && nRx > 0)
+            hote_usart_rxc();
+        else if ((UCSRB & (1 << UDRIE)) && !txPlein)
+            hote_usart_udre();
+        else
+            break;
+        terminer_acces();
+    }
+}
+
+/* avant chaque acces: l'acces precedent, les broches, le temps, la
+   ligne serie et les interruptions */
+static void synchroniser( uint32_t cycles )
+{
+    terminer_acces();
+    suivre_broches();
+    avancer_temps(cycles);
+    avancer_ligne();
+    interruptions();
+}
+
+void hote_sei( uint8_t permises )
+{
+    interruptionsPermises = permises;
+}
+
+volatile uint16_t *hote_udr( void )
+{
+    synchroniser(HOTE_CYCLES_ACCES);
+    return preparer_double(&udr, nRx > 0 ? rxTampon[0] : 0);
+}
+
+volatile uint8_t *hote_ucsra( void )
+{
+    uint8_t etat = ucsra & ((1 << U2X) | (1 << MPCM));
+
+    synchroniser(HOTE_CYCLES_ACCES);
+    if (nRx > 0)
+        etat |= (1 << RXC);
+    if (!txPlein)
+        etat |= (1 << UDRE);
+    if (!decalage && !txPlein)
+        etat |= (1 << TXC);
+    if (rxDor)
+        etat |= (1 << DOR);
+    ucsra = etat;
+    return &ucsra;
+}
+
+volatile uint8_t *hote_portb( void )
+{
+    synchroniser(HOTE_CYCLES_ACCES);
+    return &portb;
+}
+
+volatile uint8_t *hote_pinb( void )
+{
+    synchroniser(HOTE_CYCLES_ACCES);
+    pinb = (pinb & ~(1 << PB4)) | (cible_miso(&cible) << PB4);
+    return &pinb;
+}
+
+volatile uint8_t *hote_spsr( void )
+{
+    synchroniser(HOTE_CYCLES_ACCES);
+    spsr &= ~(1 << SPIF);
+    if (spiActif && maintenant >= finSpi)
+        spsr |= (1 << SPIF);
+    return &spsr;
+}
+
+volatile uint16_t *hote_spdr( void )
+{
+    synchroniser(HOTE_CYCLES_ACCES);
+    return preparer_double(&spdr, spiRecu);
+}
+
+volatile uint8_t *hote_tcnt0( void )
+{
+    static const uint16_t prediviseurs[] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+    static volatile uint8_t tcnt0;
+    uint16_t p = prediviseurs[TCCR0B & 7];
+
+    synchroniser(HOTE_CYCLES_ACCES);
+    if (p != 0)
+        tcnt0 = maintenant / p;
+    return &tcnt0;
+}
+
+/* ---- USB ---- */
+
+#define ETAPE_SETUP     0
+#define ETAPE_DONNEES   1
+#define ETAPE_STATUT    2
+
+static pthread_mutex_t verrou = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changement = PTHREAD_COND_INITIALIZER;
+
+static uint64_t delaiRequete = HOTE_USB_REQUETE_US * CYCLES_US;
+static uint64_t delaiPaquet = HOTE_USB_PAQUET_US * CYCLES_US;
+
+static struct
+{
+    uint8_t active;
+    uint8_t commencee;              /* vue par usbPoll(), debut fixe */
+    uint8_t finie;
+    uint8_t etape;
+    /* main.c lit un unsigned long a &data[2] pour SETLONGADDRESS, soit
+       8 octets sur un PC 64 bits: le reste du tampon est a 0 */
+    uint8_t setup[16];
+    uint8_t *donnees;
+    int longueur;
+    int position;
+    int resultat;
+    uint64_t debut;                 /* temps du modele, comme les echeances */
+    uint64_t echeance;
+} requete;
+
+static uint8_t interruption[8];
+static uint8_t nInterruption;
+static uint8_t interruptionPleine;
+static uint64_t derniereInterruption;
+
+/* maintenant, vu des autres fils */
+static uint64_t maintenantPartage;
+
+static struct HoteStatistiques statistiques;
+
+/* temps virtuel: le firmware tourne dans une coroutine jusqu'a ce
+   que usbPoll() rende la main */
+static ucontext_t contexteFirmware, contexteAppelant;
+static unsigned long tours;         /* hote_boucle(): tours restants */
+static uint8_t attente;             /* hote_controle(): fin de la requete */
+
+/* en temps virtuel, un paquet sur le bus: INT0 bloque tout le reste,
+   puis usbPoll() appelle le firmware */
+static void paquet( void )
+{
+    if (!virtuel)
+        return;
+    uint32_t c;
+
+    dansInt0 = 1;
+    maintenant += HOTE_CYCLES_INT0;
+    avancer_ligne();
+    dansInt0 = 0;
+    /* le code C du firmware n'est compte que par ses acces aux
+       registres: usbPoll() et usbFunction* coutent en plus
+       HOTE_CYCLES_FONCTION, que les interruptions peuvent couper */
+    for (c = 0; c < HOTE_CYCLES_FONCTION; c += HOTE_CYCLES_BOUCLE)
+        synchroniser(HOTE_CYCLES_BOUCLE);
+}
+
+static void terminer( int resultat )
+{
+    requete.resultat = resultat;
+    requete.etape = ETAPE_STATUT;
+    if (requete.echeance < requete.debut + delaiRequete)
+        requete.echeance = requete.debut + delaiRequete;
+}
+
+static void etape_setup( void )
+{
+    usbMsgLen_t n = usbFunctionSetup(requete.setup);
+
+    if (n == USB_NO_MSG)
+    {
+        if (requete.longueur == 0)
+            terminer(0);
+        else
+            requete.etape = ETAPE_DONNEES;
+    }
+    else if (requete.setup[0] & 0x80)
+    {
+        if (n > requete.longueur)
+            n = requete.longueur;
+        memcpy(requete.donnees, usbMsgPtr, n);
+        terminer(n);
+    }
+    else
+        terminer(requete.longueur);
+}
+
+/* un paquet de 8 octets au plus, comme les appels du vrai pilote */
+static void etape_donnees( void )
+{
+    uint8_t paquet[8];
+    uint8_t n = 8;
+    uint8_t r;
+
+    if (n > requete.longueur - requete.position)
+        n = requete.longueur - requete.position;
+
+    if (requete.setup[0] & 0x80)
+    {
+        r = usbFunctionRead(paquet, n);
+        if (r == 0xff)
+        {
+            terminer(HOTE_ERREUR);
+            return;
+        }
+        memcpy(requete.donnees + requete.position, paquet, r);
+        requete.position += r;
+        /* un paquet court termine le transfert */
+        if (r < 8 || requete.position == requete.longueur)
+            terminer(requete.position);
+    }
+    else
+    {
+        memcpy(paquet, requete.donnees + requete.position, n);
+        r = usbFunctionWrite(paquet, n);
+        if (r == 0xff)
+        {
+            terminer(HOTE_ERREUR);
+            return;
+        }
+        requete.position += n;
+        if (r == 1 || requete.position == requete.longueur)
+            terminer(requete.position);
+    }
+}
+
+static void avancer_requete( void )
+{
+    if (!requete.active || requete.finie)
+        return;
+    if (!requete.commencee)
+    {
+        requete.commencee = 1;
+        requete.debut = maintenant;
+        requete.echeance = maintenant + delaiPaquet;
+        return;
+    }
+    if (maintenant < requete.echeance)
+        return;
+
+    switch (requete.etape)
+    {
+    case ETAPE_SETUP:
+        paquet();
+        etape_setup();
+        break;
+    case ETAPE_DONNEES:
+        paquet();
+        etape_donnees();
+        break;
+    case ETAPE_STATUT:
+        requete.finie = 1;
+        statistiques.m_requetes++;
+        pthread_cond_broadcast(&changement);
+        return;
+    }
+    if (requete.echeance < maintenant + delaiPaquet &&
+        requete.etape != ETAPE_STATUT)
+        requete.echeance = maintenant + delaiPaquet;
+}
+
+void usbInit( void )
+{
+}
+
+/* appele par la boucle principale du firmware */
+void usbPoll( void )
+{
+    uint8_t rendre;
+
+    synchroniser(HOTE_CYCLES_BOUCLE);
+
+    pthread_mutex_lock(&verrou);
+    avancer_requete();
+    maintenantPartage = maintenant;
+    statistiques.m_envoyes = envoyes;
+    statistiques.m_recus = recus;
+    statistiques.m_dor = dor;
+    statistiques.m_pertesFifo = usart_compteurs[USBASP_SERSTAT_PERTES];
+    statistiques.m_octetsSpi = octetsSpi;
+    statistiques.m_cycles = maintenant;
+    statistiques.m_tempsPerdu = perdu / 1e9;
+    rendre = attente && requete.finie;
+    pthread_mutex_unlock(&verrou);
+
+    if (!virtuel)
+    {
+        /* un seul processeur suffit: laisser tourner les autres fils */
+        sched_yield();
+        return;
+    }
+    if (tours > 0 && --tours == 0)
+        rendre = 1;
+    if (rendre)
+        swapcontext(&contexteFirmware, &contexteAppelant);
+}
+
+void usbSetInterrupt( uchar *data, uchar len )
+{
+    pthread_mutex_lock(&verrou);
+    memcpy(interruption, data, len);
+    nInterruption = len;
+    interruptionPleine = 1;
+    pthread_mutex_unlock(&verrou);
+}
+
+uint8_t hote_interruption_prete( void )
+{
+    uint8_t prete;
+
+    pthread_mutex_lock(&verrou);
+    prete = !interruptionPleine;
+    pthread_mutex_unlock(&verrou);
+    return prete;
+}
+
+/* ---- cote PC ---- */
+
+struct HoteCible *hote_cible( void )
+{
+    if (!cibleInitialisee)
+    {
+        cible_initialiser(&cible);
+        cibleInitialisee = 1;
+    }
+    return &cible;
+}
+
+static void entree_firmware( void )
+{
+    firmware_main();
+}
+
+void hote_initialiser( void )
+{
+    static char *pile;
+
+    hote_cible();
+    virtuel = 1;
+    if (pile == NULL)
+        pile = malloc(TAILLE_PILE);
+    getcontext(&contexteFirmware);
+    contexteFirmware.uc_stack.ss_sp = pile;
+    contexteFirmware.uc_stack.ss_size = TAILLE_PILE;
+    contexteFirmware.uc_link = &contexteAppelant;
+    makecontext(&contexteFirmware, entree_firmware, 0);
+}
+
+void hote_boucle( unsigned long n )
+{
+    if (n == 0)
+        return;
+    tours = n;
+    swapcontext(&contexteAppelant, &contexteFirmware);
+}
+
+static void *fil_firmware( void *rien )
+{
+    (void)rien;
+    firmware_main();
+    return NULL;
+}
+
+void hote_demarrer( void )
+{
+    pthread_t fil;
+    const char *delai;
+
+    delai = getenv("HOTE_USB_REQUETE_US");
+    if (delai != NULL)
+        delaiRequete = atol(delai) * CYCLES_US;
+    delai = getenv("HOTE_USB_PAQUET_US");
+    if (delai != NULL)
+        delaiPaquet = atol(delai) * CYCLES_US;
+
+    hote_cible();
+    reelPrecedent = horloge();
+    pthread_create(&fil, NULL, fil_firmware, NULL);
+    pthread_detach(fil);
+}
+
+int hote_controle( const uint8_t setup[8], uint8_t *donnees )
+{
+    int resultat;
+
+    pthread_mutex_lock(&verrou);
+    while (requete.active)
+        pthread_cond_wait(&changement, &verrou);
+
+    memset(requete.setup, 0, sizeof(requete.setup));
+    memcpy(requete.setup, setup, 8);
+    requete.donnees = donnees;
+    requete.longueur = setup[6] | (setup[7] << 8);
+    requete.position = 0;
+    requete.etape = ETAPE_SETUP;
+    requete.commencee = 0;
+    requete.finie = 0;
+    requete.active = 1;
+
+    if (virtuel)
+    {
+        pthread_mutex_unlock(&verrou);
+        attente = 1;
+        tours = 0;
+        swapcontext(&contexteAppelant, &contexteFirmware);
+        attente = 0;
+        pthread_mutex_lock(&verrou);
+    }
+    else
+    {
+        while (!requete.finie)
+            pthread_cond_wait(&changement, &verrou);
+    }
+    resultat = requete.resultat;
+    requete.active = 0;
+    pthread_cond_broadcast(&changement);
+    pthread_mutex_unlock(&verrou);
+    return resultat;
+}
+
+int hote_interruption( uint8_t paquet[8] )
+{
+    int n = 0;
+
+    pthread_mutex_lock(&verrou);
+    if (interruptionPleine &&
+        maintenantPartage - derniereInterruption >=
+        (uint64_t)USB_CFG_INTR_POLL_INTERVAL * CYCLES_MS)
+    {
+        n = nInterruption;
+        memcpy(paquet, interruption, n);
+        interruptionPleine = 0;
+        derniereInterruption = maintenantPartage;
+    }
+    pthread_mutex_unlock(&verrou);
+    return n;
+}
+
+void hote_statistiques( struct HoteStatistiques *s )
+{
+    pthread_mutex_lock(&verrou);
+    *s = statistiques;
+    pthread_mutex_unlock(&verrou);
+}
+
+void hote_source( const uint8_t *octets, long n )
+{
+    pthread_mutex_lock(&verrou);
+    source = n > 0 ? octets : NULL;
+    nSource = n;
+    sourceArretee = 0;
+    finSource = maintenant + duree_octet();
+    pthread_mutex_unlock(&verrou);
+}
+
+uint64_t hote_cycles( void )
+{
+    uint64_t t;
+
+    pthread_mutex_lock(&verrou);
+    t = maintenantPartage;
+    pthread_mutex_unlock(&verrou);
+    return t;
+}
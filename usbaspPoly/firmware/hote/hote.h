@@ -0,0 +1,195 @@
+/*
+ * hote.h - le firmware du USBasp compile pour le PC
+ *
+ * Autor..........: Jerome Collin (jerome.collin@polymtl.ca)
+ * Description....: main.c, fifo.c, usart.c, isp.c et clock.c se
+ *                  compilent tels quels avec gcc si ce repertoire passe
+ *                  avant les autres (-I hote): avr/io.h, usbdrv.h, etc.
+ *                  y sont remplaces par des modeles.  main() est renomme
+ *                  firmware_main() (-Dmain=firmware_main) et tourne,
+ *                  boucle principale comprise, dans son propre fil ou
+ *                  dans une coroutine.
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ *
+ * Modeles:
+ *   - USART: la vitesse, les bits et la parite viennent de UBRR, U2X et
+ *     UCSRC.  Emission avec UDR et registre a decalage, reception avec
+ *     le tampon de 2 octets du materiel (DOR quand il deborde).  TX est
+ *     relie a RX, comme un cavalier sur la carte, sauf quand
+ *     hote_source() fait parler la cible; elle obeit alors a XON et
+ *     XOFF, avec HOTE_OCTETS_APRES_XOFF octets de retard.  Les
+ *     interruptions RXC et UDRE passent entre deux acces aux registres
+ *     modelises.
+ *   - SPI et ISP: le SPI materiel (SPCR, SPSR, SPDR) et le SPI logiciel
+ *     de isp.c (PORTB, PINB) font passer les bits un a un a une cible
+ *     AVR modelisee (HoteCible): mode programmation, lecture et
+ *     ecriture de la flash par pages, de l'EEPROM, signature et
+ *     fusibles, avec la duree des ecritures.  Comme un vrai AVR, elle
+ *     ne suit pas un SCK materiel au-dela du quart de son horloge: un
+ *     front sur deux lui echappe et elle perd le fil des instructions
+ *     jusqu'au prochain reset.
+ *   - Timer 0: TCNT0 selon le prediviseur de TCCR0B (clockWait,
+ *     ispDelay).
+ *   - USB: chaque requete de controle passe par usbPoll(), une etape a
+ *     la fois (SETUP, puis chaque paquet de 8 octets), avec entre
+ *     deux etapes HOTE_USB_PAQUET_US, et au moins HOTE_USB_REQUETE_US
+ *     pour toute la requete.  En temps virtuel, chaque paquet coute
+ *     aussi l'interruption INT0 de V-USB, pendant laquelle aucune
+ *     autre interruption ne passe.  Le point d'acces interrupt-in est
+ *     interroge aux USB_CFG_INTR_POLL_INTERVAL ms de usbconfig.h.
+ * Les delais USB sont des ordres de grandeur pour un peripherique basse
+ * vitesse, a ajuster par l'environnement (voir hote_demarrer).
+ *
+ * Le temps se compte en cycles de l'horloge de 12 MHz, de deux facons:
+ *   - hote_initialiser(): temps virtuel.  Chaque acces a un registre
+ *     modelise coute HOTE_CYCLES_ACCES cycles et chaque tour de la
+ *     boucle principale HOTE_CYCLES_BOUCLE.  Les attentes actives
+ *     (SPIF, TCNT0) durent donc a peu pres le bon nombre de cycles,
+ *     sans attendre vraiment.  Tout se passe dans le fil de l'appelant:
+ *     hote_boucle() et hote_controle() font tourner le firmware le
+ *     temps qu'il faut.  C'est le mode des essais, des bancs et du
+ *     fuzzing; les fonctions usbFunction* de main.c peuvent aussi
+ *     s'appeler directement.
+ *   - hote_demarrer(): temps reel, le firmware dans son propre fil,
+ *     pour brancher serieViaUSB (transportFirmware.cc).  Quand le fil
+ *     n'a pas tourne depuis plus de HOTE_PAS_MAX_NS, le PC l'a mis de
+ *     cote, ce que le vrai firmware ne subit pas: le temps du modele
+ *     n'avance que de HOTE_PAS_MAX_NS et le reste est compte dans les
+ *     statistiques.
+ */
+
+#ifndef __hote_h_included__
+#define __hote_h_included__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HOTE_F_CPU              12000000L
+
+#define HOTE_USB_REQUETE_US     1000
+#define HOTE_USB_PAQUET_US      100
+#define HOTE_PAS_MAX_NS         20000
+
+#define HOTE_CYCLES_ACCES       4
+#define HOTE_CYCLES_BOUCLE      40
+/* par paquet USB: l'interruption INT0 de V-USB (usbdrv.h en donne
+   jusqu'a 1200 cycles), puis usbFunctionRead/Write dans usbPoll() */
+#define HOTE_CYCLES_INT0        1200
+#define HOTE_CYCLES_FONCTION    200
+
+/* octets que la cible envoie encore apres avoir recu XOFF */
+#define HOTE_OCTETS_APRES_XOFF  2
+
+/* requete refusee par le firmware (STALL) */
+#define HOTE_ERREUR             -1
+
+/* la cible: un ATmega324PA, avec le quartz des cartes du cours */
+#define HOTE_CIBLE_HORLOGE      8000000L
+#define HOTE_FLASH              32768
+#define HOTE_PAGE               128
+#define HOTE_EEPROM             1024
+
+/* duree des ecritures de la cible, en us */
+#define HOTE_ECRITURE_FLASH_US  4500
+#define HOTE_ECRITURE_EEPROM_US 9000
+#define HOTE_EFFACEMENT_US      9000
+
+struct HoteCible
+{
+    uint8_t m_flash[HOTE_FLASH];
+    uint8_t m_eeprom[HOTE_EEPROM];
+    uint8_t m_page[HOTE_PAGE];      /* tampon de page, charge par 0x40/0x48;
+                                       garde son contenu (0 au depart):
+                                       le firmware doit tout y charger */
+    uint8_t m_signature[3];
+    uint8_t m_fusibles[4];          /* bas, haut, etendu, verrou */
+
+    uint32_t m_horloge;             /* Hz, SCK au plus m_horloge / 4 */
+    uint8_t m_rst;                  /* niveau de RESET, 1 au repos */
+    uint8_t m_programmation;        /* Programming Enable recu */
+    uint64_t m_occupee;             /* fin de l'ecriture en cours (cycles) */
+
+    /* decalage bit a bit, comme le SPI de la cible */
+    uint8_t m_entree;
+    uint8_t m_sortie;
+    uint8_t m_bits;
+    uint8_t m_instruction[4];
+    uint8_t m_position;
+
+    /* statistiques */
+    unsigned long m_pages;
+    unsigned long m_octetsEeprom;
+    unsigned long m_ignorees;       /* instructions recues pendant une ecriture */
+};
+
+struct HoteStatistiques
+{
+    unsigned long m_envoyes;        /* octets sortis par TX */
+    unsigned long m_recus;          /* octets arrives sur RX */
+    unsigned long m_dor;            /* octets perdus, tampon de RX plein */
+    unsigned long m_pertesFifo;     /* USBASP_SERSTAT_PERTES du firmware */
+    unsigned long m_requetes;
+    unsigned long m_octetsSpi;
+    uint64_t m_cycles;
+    double m_tempsPerdu;            /* s sans que le fil du firmware tourne */
+};
+
+/* cote firmware: registres modelises (voir avr/io.h) */
+volatile uint8_t *hote_ucsra( void );
+volatile uint16_t *hote_udr( void );
+volatile uint8_t *hote_portb( void );
+volatile uint8_t *hote_pinb( void );
+volatile uint8_t *hote_spsr( void );
+volatile uint16_t *hote_spdr( void );
+volatile uint8_t *hote_tcnt0( void );
+
+/* cote firmware: point d'acces interrupt-in (voir usbdrv.h) */
+uint8_t hote_interruption_prete( void );
+
+/* cote firmware: sei() et cli(), et les vecteurs du USART que le
+   firmware definit avec ISR() (voir avr/interrupt.h) */
+void hote_sei( uint8_t permises );
+void hote_usart_rxc( void );
+void hote_usart_udre( void );
+
+/* temps virtuel: prepare le firmware sans le lancer */
+void hote_initialiser( void );
+
+/* temps virtuel: n tours de la boucle principale du firmware */
+void hote_boucle( unsigned long n );
+
+/* temps reel: lance firmware_main() dans son fil.  Les variables
+   d'environnement HOTE_USB_REQUETE_US et HOTE_USB_PAQUET_US remplacent
+   les delais par defaut. */
+void hote_demarrer( void );
+
+/* requete de controle complete.  setup est le paquet SETUP
+   (bmRequestType, bRequest, wValue, wIndex, wLength) et donnees les
+   wLength octets a envoyer ou a recevoir.  Retourne le nombre d'octets
+   transferes ou HOTE_ERREUR. */
+int hote_controle( const uint8_t setup[8], uint8_t *donnees );
+
+/* le paquet interrupt-in en attente, s'il y en a un et que
+   l'intervalle d'interrogation est passe.  Retourne sa longueur. */
+int hote_interruption( uint8_t paquet[8] );
+
+void hote_statistiques( struct HoteStatistiques *s );
+
+/* la cible branchee sur le ISP, pour la preparer ou la verifier */
+struct HoteCible *hote_cible( void );
+
+uint64_t hote_cycles( void );
+
+/* la cible envoie les n octets sur RX, dos a dos a la vitesse du
+   USART (UBRR au moment de l'appel), au lieu de renvoyer TX.  octets
+   doit rester valide jusqu'a la fin. */
+void hote_source( const uint8_t *octets, long n );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __hote_h_included__ */
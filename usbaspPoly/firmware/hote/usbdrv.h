@@ -0,0 +1,43 @@
+/*
+ * usbdrv.h - le pilote V-USB vu du firmware compile sur le PC
+ *
+ * Autor..........: Jerome Collin (jerome.collin@polymtl.ca)
+ * Description....: remplace usbdrv/usbdrv.h (voir hote.h).  Les
+ *                  requetes de l'hote arrivent par usbPoll(), comme avec
+ *                  le vrai pilote, et appellent usbFunctionSetup(),
+ *                  usbFunctionRead() et usbFunctionWrite() du firmware.
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ */
+
+#ifndef __hote_usbdrv_h_included__
+#define __hote_usbdrv_h_included__
+
+#include <stdint.h>
+#include "hote.h"
+
+#ifndef uchar
+#define uchar   unsigned char
+#endif
+
+#define usbMsgLen_t     uchar
+#define USB_NO_MSG      ((usbMsgLen_t)-1)
+
+extern uchar *usbMsgPtr;
+
+void usbInit(void);
+
+void usbPoll(void);
+
+usbMsgLen_t usbFunctionSetup(uchar data[8]);
+
+uchar usbFunctionRead(uchar *data, uchar len);
+
+uchar usbFunctionWrite(uchar *data, uchar len);
+
+/* point d'acces interrupt-in: un paquet de 8 octets au plus attend
+   que l'hote le prenne */
+void usbSetInterrupt(uchar *data, uchar len);
+
+#define usbInterruptIsReady()   hote_interruption_prete()
+
+#endif /* __hote_usbdrv_h_included__ */
@@ -0,0 +1,31 @@
+/*
+ * util/crc16.h - pour compiler le firmware sur le PC (voir hote.h)
+ *
+ * Autor..........: Jerome Collin (jerome.collin@polymtl.ca)
+ * Description....: le code C equivalent que donne la documentation de
+ *                  avr-libc pour ses versions en assembleur.
+ * Licence........: GNU GPL v2 (see Readme.txt)
+ */
+
+#ifndef __hote_util_crc16_h_included__
+#define __hote_util_crc16_h_included__
+
+#include <stdint.h>
+
+/* polynome 0x1021, bit de poids fort en premier */
+static inline uint16_t _crc_xmodem_update( uint16_t crc, uint8_t data )
+{
+    int i;
+
+    crc = crc ^ ((uint16_t)data << 8);
+    for (i = 0; i < 8; i++)
+    {
+        if (crc & 0x8000)
+            crc = (crc << 1) ^ 0x1021;
+        else
+            crc <<= 1;
+    }
+    return crc;
+}
+
+#endif /* __hote_util_crc16_h_included__ */
@@ -10,15 +10,23 @@
  */
 
 #include <avr/io.h>
+#include <util/crc16.h>
 #include "isp.h"
 #include "clock.h"
 #include "usbasp.h"
 
 #define spiHWdisable() SPCR = 0
 
+/* SPDR cannot be written again before SPIF: wait for the end */
+#define spiHWwait() while (!(SPSR & (1 << SPIF)))
+
+#define spiHWtransmit(b) \
+	do { SPDR = (b); spiHWwait(); } while (0)
+
 uchar sck_sw_delay;
 uchar sck_spcr;
 uchar sck_spsr;
+uchar sck_option;
 
 void spiHWenable() {
 	SPCR = sck_spcr;
@@ -30,6 +38,8 @@ void ispSetSCKOption(uchar option) {
 	if (option == USBASP_ISP_SCK_AUTO)
 		option = USBASP_ISP_SCK_375;
 
+	sck_option = option;
+
 	if (option >= USBASP_ISP_SCK_93_75) {
 		ispTransmit = ispTransmit_hw;
 		sck_spsr = 0;
@@ -40,6 +50,7 @@ void ispSetSCKOption(uchar option) {
 			/* enable SPI, master, 1.5MHz, XTAL/8 */
 			sck_spcr = (1 << SPE) | (1 << MSTR) | (1 << SPR0);
 			sck_spsr = (1 << SPI2X);
+			break;
 		case USBASP_ISP_SCK_750:
 			/* enable SPI, master, 750kHz, XTAL/16 */
 			sck_spcr = (1 << SPE) | (1 << MSTR) | (1 << SPR0);
@@ -133,6 +144,10 @@ void ispDisconnect() {
 
 	/* disable hardware SPI */
 	spiHWdisable();
+
+	/* without SPE, ispTransmit_hw would wait for SPIF forever: until
+	   the next connect, ISP requests use the software SPI on input pins */
+	ispTransmit = ispTransmit_sw;
 }
 
 uchar ispTransmit_sw(uchar send_byte) {
@@ -205,6 +220,78 @@ uchar ispEnterProgrammingMode() {
 	return 1; /* error: device dosn't answer */
 }
 
+uchar ispGetSCKOption() {
+	return sck_option;
+}
+
+/* reset the target and enter programming mode again at the given speed */
+static uchar ispReconnect(uchar option) {
+	spiHWdisable();
+	ispSetSCKOption(option);
+	ispConnect();
+	return ispEnterProgrammingMode();
+}
+
+static void ispReadSignature(uchar *signature) {
+	uchar i;
+
+	for (i = 0; i < 3; i++) {
+		ispTransmit(0x30);
+		ispTransmit(0);
+		ispTransmit(i);
+		signature[i] = ispTransmit(0);
+	}
+}
+
+/* signature read twice at the current speed, same as the reference */
+static uchar ispSignatureMatches(uchar *reference) {
+	uchar signature[3];
+	uchar n;
+
+	for (n = 0; n < 2; n++) {
+		ispReadSignature(signature);
+		if (signature[0] != reference[0] || signature[1] != reference[1]
+				|| signature[2] != reference[2])
+			return 0;
+	}
+	return 1;
+}
+
+uchar ispEnterProgrammingModeAuto() {
+	uchar reference[3];
+	uchar option = USBASP_ISP_SCK_187_5;
+
+	/* slower and slower until the target answers, down to 8 kHz */
+	if (ispEnterProgrammingMode()) {
+		do {
+			if (option == USBASP_ISP_SCK_8)
+				return 1; /* error: device dosn't answer */
+			option--;
+		} while (ispReconnect(option));
+		return 0;
+	}
+
+	/* then faster while the signature reads the same.  Only an Atmel
+	   signature is trusted to tell good reads from bad ones */
+	ispReadSignature(reference);
+	if (reference[0] != 0x1E)
+		return 0;
+
+	while (option < USBASP_ISP_SCK_1500) {
+		ispSetSCKOption(option + 1);
+		spiHWenable();
+		if (!ispSignatureMatches(reference)) {
+			/* the target may have lost a bit: start over at the last
+			   speed that worked, or at 187.5 kHz */
+			if (ispReconnect(option) == 0)
+				return 0;
+			return ispReconnect(USBASP_ISP_SCK_187_5);
+		}
+		option++;
+	}
+	return 0;
+}
+
 uchar ispReadFlash(unsigned long address) {
 	ispTransmit(0x20 | ((address & 1) << 3));
 	ispTransmit(address >> 9);
@@ -252,11 +339,15 @@ uchar ispWriteFlash(unsigned long address, uchar data, uchar pollmode) {
 
 }
 
-uchar ispFlushPage(unsigned long address, uchar pollvalue) {
+void ispWritePage(unsigned long address) {
 	ispTransmit(0x4C);
 	ispTransmit(address >> 9);
 	ispTransmit(address >> 1);
 	ispTransmit(0);
+}
+
+uchar ispFlushPage(unsigned long address, uchar pollvalue) {
+	ispWritePage(address);
 
 	if (pollvalue == 0xFF) {
 		clockWait(15);
@@ -284,6 +375,54 @@ uchar ispFlushPage(unsigned long address, uchar pollvalue) {
 
 }
 
+void ispReadFlashBlock(unsigned long address, uchar *data, uchar len) {
+	uchar cmd, hi, lo;
+
+	if (ispTransmit != ispTransmit_hw) {
+		while (len--)
+			*data++ = ispReadFlash(address++);
+		return;
+	}
+
+	cmd = 0x20 | ((address & 1) << 3);
+	hi = address >> 9;
+	lo = address >> 1;
+
+	while (len--) {
+		spiHWtransmit(cmd);
+		spiHWtransmit(hi);
+		spiHWtransmit(lo);
+		SPDR = 0;
+
+		/* next address while the data byte shifts in */
+		if (cmd & 0x08) {
+			if (++lo == 0)
+				hi++;
+		}
+		cmd ^= 0x08;
+
+		spiHWwait();
+		*data++ = SPDR;
+	}
+}
+
+unsigned int ispCrcFlash(unsigned long address, unsigned int len) {
+	uchar buffer[8];
+	uchar n, i;
+	unsigned int crc = 0xFFFF;
+
+	while (len != 0) {
+		n = (len < sizeof(buffer)) ? len : sizeof(buffer);
+		ispReadFlashBlock(address, buffer, n);
+		for (i = 0; i < n; i++)
+			crc = _crc_xmodem_update(crc, buffer[i]);
+		address += n;
+		len -= n;
+	}
+
+	return crc;
+}
+
 uchar ispReadEEPROM(unsigned int address) {
 	ispTransmit(0xA0);
 	ispTransmit(address >> 8);
@@ -291,6 +430,32 @@ uchar ispReadEEPROM(unsigned int address) {
 	return ispTransmit(0);
 }
 
+void ispReadEEPROMBlock(unsigned int address, uchar *data, uchar len) {
+	uchar hi, lo;
+
+	if (ispTransmit != ispTransmit_hw) {
+		while (len--)
+			*data++ = ispReadEEPROM(address++);
+		return;
+	}
+
+	hi = address >> 8;
+	lo = address;
+
+	while (len--) {
+		spiHWtransmit(0xA0);
+		spiHWtransmit(hi);
+		spiHWtransmit(lo);
+		SPDR = 0;
+
+		if (++lo == 0)
+			hi++;
+
+		spiHWwait();
+		*data++ = SPDR;
+	}
+}
+
 uchar ispWriteEEPROM(unsigned int address, uchar data) {
 
 	ispTransmit(0xC0);
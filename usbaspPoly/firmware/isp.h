@@ -39,6 +39,15 @@ uchar ispTransmit_hw(uchar send_byte);
 /* enter programming mode */
 uchar ispEnterProgrammingMode();
 
+/* enter programming mode at 187.5 kHz, slower if the target does not
+   answer.  Then go up to 375 kHz, 750 kHz and 1.5 MHz as long as the
+   signature reads the same, and come back to the last good speed with
+   a new reset otherwise.  ispGetSCKOption() tells the speed found. */
+uchar ispEnterProgrammingModeAuto();
+
+/* USBASP_ISP_SCK_* in use */
+uchar ispGetSCKOption();
+
 /* read byte from eeprom at given address */
 uchar ispReadEEPROM(unsigned int address);
 
@@ -47,9 +56,25 @@ uchar ispWriteFlash(unsigned long address, uchar data, uchar pollmode);
 
 uchar ispFlushPage(unsigned long address, uchar pollvalue);
 
+/* start programming of the loaded page and return at once.  Send
+   nothing but polling reads to the target until the write is done */
+void ispWritePage(unsigned long address);
+
 /* read byte from flash at given address */
 uchar ispReadFlash(unsigned long address);
 
+/* read len bytes from flash, or eeprom, starting at address.  With the
+   hardware SPI, the four transfers of each read follow each other
+   without a call, and the next address is computed while the data
+   byte shifts in */
+void ispReadFlashBlock(unsigned long address, uchar *data, uchar len);
+
+void ispReadEEPROMBlock(unsigned int address, uchar *data, uchar len);
+
+/* CRC-16 (polynomial 0x1021, initial value 0xFFFF) of len bytes of
+   flash starting at address */
+unsigned int ispCrcFlash(unsigned long address, unsigned int len);
+
 /* write byte to eeprom at given address */
 uchar ispWriteEEPROM(unsigned int address, uchar data);
 
@@ -26,7 +26,7 @@
 #include "clock.h"
 #include "usart.h"
 
-static uchar replyBuffer[8];
+static uchar replyBuffer[2 * USBASP_SERSTAT_N];
 
 static uchar prog_state = PROG_STATE_IDLE;
 static uchar prog_sck = USBASP_ISP_SCK_AUTO;
@@ -36,17 +36,127 @@ static unsigned long prog_address;
 static unsigned int prog_nbytes = 0;
 static unsigned int prog_pagesize;
 static uchar prog_blockflags;
-static uchar prog_pagecounter;
+static unsigned int prog_pagecounter;
+static unsigned int prog_crcsize;       /* octets par CRC */
 
 static struct Fifo TxFifo;
 static struct Fifo RxFifo;
 
-static uchar TxData[USBASPTXLEN];
-static uchar RxData[USBASPRXLEN];
+/*
+ * Ecriture de la flash par pages en pipeline: usbFunctionWrite ne fait
+ * que ranger les octets dans PageFifo, et la boucle principale les
+ * charge dans la cible un a la fois entre deux usbPoll(), pendant que
+ * le USB amene la suite.  Pendant qu'une page s'ecrit (0x4C), la
+ * suivante s'accumule en RAM.
+ */
+static struct Fifo PageFifo;
+static unsigned long prog_loadaddress;  /* prochain octet a charger */
+static uchar prog_busy;                 /* une page s'ecrit */
+static unsigned long prog_polladdress;  /* dernier octet charge sauf 0xFF */
+static uchar prog_pollvalue;            /* 0xFF: rien de charge */
+static unsigned int prog_ffcount;       /* 0xFF du debut de page en attente */
+static uchar prog_polltime;
+static uchar prog_pollretries;
+static unsigned int prog_pages;         /* depuis USBASP_FUNC_CONNECT */
+static unsigned int prog_skipped;
+static uchar prog_errors;
+
+/* RxFifo au debut, TxFifo apres (voir USBASPRXLEN).  Tout entier a
+   PageFifo des la premiere ecriture de la flash par pages: la cible est
+   en reset et le pont serie reste arrete jusqu'au prochain
+   USBASP_FUNC_SETSERIOS. */
+static uchar SerData[USBASPSERLEN];
+
+/* options serie choisies par l'hote (USBASP_SERFLAG_*) */
+static uchar ser_flags = 0;
+static uchar intrBuffer[8];
+
+/* une etape du pipeline, 4 octets SPI au plus: la fin de l'ecriture en
+   cours, sinon un octet de PageFifo vers le tampon de page de la cible,
+   puis 0x4C quand la page est complete ou que le dernier octet du
+   dernier bloc (PROG_BLOCKFLAG_LAST) y est passe.
+   Une page qui n'a que des 0xFF ne se charge pas et ne s'ecrit pas: la
+   flash effacee n'y changerait pas.  Rien ne dit ce que le tampon de
+   page contient avant un chargement: une page qui s'ecrit y recoit
+   tous ses octets, 0xFF compris.  Ceux du debut de la page attendent
+   (prog_ffcount) le premier autre octet, qui reste en tete de PageFifo
+   jusqu'a ce qu'ils soient tous charges. */
+static void pages_avancer(void) {
+    uchar octet;
+
+    if (prog_busy) {
+        /* comme ispFlushPage(): 0xFF dans la page tant qu'elle s'ecrit */
+        if (ispReadFlash(prog_polladdress) != 0xFF) {
+            prog_busy = 0;
+        } else if ((uint8_t) (TIMERVALUE - prog_polltime) > CLOCK_T_320us) {
+            prog_polltime = TIMERVALUE;
+            if (--prog_pollretries == 0) {
+                prog_busy = 0;
+                if (prog_errors != 0xFF)
+                    prog_errors++;
+            }
+        }
+        return;
+    }
+    if (fifo_empty(&PageFifo))
+        return;
+
+    octet = PageFifo.m_data[PageFifo.m_begin];
+    if (octet != 0xFF && prog_ffcount != 0) {
+        ispWriteFlash(prog_loadaddress - prog_ffcount, 0xFF, 0);
+        prog_ffcount--;
+        return;
+    }
+    fifo_dequeue(&PageFifo);
+    if (octet != 0xFF || prog_pollvalue != 0xFF) {
+        ispWriteFlash(prog_loadaddress, octet, 0);
+        if (octet != 0xFF) {
+            prog_polladdress = prog_loadaddress;
+            prog_pollvalue = octet;
+        }
+    } else {
+        prog_ffcount++;
+    }
+    prog_loadaddress++;
+    prog_pagecounter--;
+    if (prog_pagecounter == 0 ||
+        (fifo_empty(&PageFifo) && prog_nbytes == 0 &&
+         (prog_blockflags & PROG_BLOCKFLAG_LAST))) {
+        if (prog_pollvalue != 0xFF) {
+            ispWritePage(prog_loadaddress - 1);
+            prog_pollretries = 30;
+            prog_polltime = TIMERVALUE;
+            prog_busy = 1;
+            if (prog_pages != 0xFFFF)
+                prog_pages++;
+        } else if (prog_skipped != 0xFFFF) {
+            prog_skipped++;
+        }
+        prog_pagecounter = prog_pagesize;
+        prog_pollvalue = 0xFF;
+        prog_ffcount = 0;
+    }
+}
+
+/* jusqu'a ce que la derniere page soit ecrite */
+static void pages_vider(void) {
+    while (prog_busy || !fifo_empty(&PageFifo))
+        pages_avancer();
+}
 
 uchar usbFunctionSetup(uchar data[8]) {
 
     uchar len = 0;
+    uchar i;
+    uint16_t tmpCount;
+
+    /* le pipeline se vide avant toute autre commande: avrdude relit la
+       flash sitot ecrite, sans rien savoir de USBASP_FUNC_GETPROGSTATUS */
+    if (data[1] != USBASP_FUNC_WRITEFLASH &&
+        data[1] != USBASP_FUNC_SETLONGADDRESS &&
+        data[1] != USBASP_FUNC_GETPROGSTATUS) {
+        pages_vider();
+    }
 
     switch (data[1]) {
     case USBASP_FUNC_CONNECT:
@@ -72,10 +182,21 @@ uchar usbFunctionSetup(uchar data[8]) {
 
            Jerome Collin - aout 2010
         */
-        ispSetSCKOption(USBASP_ISP_SCK_187_5);
+        /* Avec USBASP_ISP_SCK_AUTO (avrdude sans -B), on part toujours
+           de 187.5 kHz, mais USBASP_FUNC_ENABLEPROG monte ensuite aussi
+           vite que la cible le permet (ispEnterProgrammingModeAuto).
+           Une vitesse demandee par l'hote est prise telle quelle. */
+        if (prog_sck == USBASP_ISP_SCK_AUTO) {
+            ispSetSCKOption(USBASP_ISP_SCK_187_5);
+        } else {
+            ispSetSCKOption(prog_sck);
+        }
 
         /* set compatibility mode of address delivering */
         prog_address_newmode = 0;
+        prog_pages = 0;
+        prog_skipped = 0;
+        prog_errors = 0;
 
         ledGreenOff();
         ledRedOn();
@@ -116,8 +237,26 @@ uchar usbFunctionSetup(uchar data[8]) {
         len = 0xff; /* multiple in */
         break;
 
+    case USBASP_FUNC_CRCFLASH:
+
+        if (!prog_address_newmode)
+            prog_address = (data[3] << 8) | data[2];
+
+        prog_crcsize = (data[5] << 8) | data[4];
+        if (prog_crcsize == 0 || prog_crcsize > USBASP_CRC_MAX)
+            break;
+
+        prog_nbytes = (data[7] << 8) | data[6];
+        prog_state = PROG_STATE_CRCFLASH;
+        len = 0xff; /* multiple in */
+        break;
+
     case USBASP_FUNC_ENABLEPROG:
-        replyBuffer[0] = ispEnterProgrammingMode();
+        if (prog_sck == USBASP_ISP_SCK_AUTO) {
+            replyBuffer[0] = ispEnterProgrammingModeAuto();
+        } else {
+            replyBuffer[0] = ispEnterProgrammingMode();
+        }
         len = 1;
         break;
 
@@ -126,11 +265,46 @@ uchar usbFunctionSetup(uchar data[8]) {
         if (!prog_address_newmode)
             prog_address = (data[3] << 8) | data[2];
 
-        prog_pagesize = data[4];
+        tmpCount = data[4];
+        tmpCount += (((unsigned int) data[5] & 0xF0) << 4);
+
+        /* PageFifo suit les blocs consecutifs, meme d'une suite a
+           l'autre: avrdude 5.11 et plus en envoie une par page, de
+           PROG_BLOCKFLAG_FIRST a LAST.  Une nouvelle suite s'ajoute a la
+           file si elle commence juste apres la precedente, a la limite
+           d'une page; sinon, la precedente finit d'abord. */
+        if ((prog_busy || !fifo_empty(&PageFifo)) &&
+            (tmpCount != prog_pagesize ||
+             prog_address != prog_loadaddress + fifo_count(&PageFifo) ||
+             ((data[5] & PROG_BLOCKFLAG_FIRST) ?
+              (prog_pagesize - prog_pagecounter + fifo_count(&PageFifo)) %
+                  prog_pagesize != 0 :
+              (prog_blockflags & PROG_BLOCKFLAG_LAST) != 0))) {
+            pages_vider();
+        }
+        if (fifo_empty(&PageFifo) && prog_loadaddress != prog_address) {
+            /* les 0xFF en attente etaient d'une autre page */
+            prog_loadaddress = prog_address;
+            prog_ffcount = 0;
+        }
+
+        /* le compteur de page ne repart que sur un pipeline arrete: sinon
+           il tombe de lui-meme a 0 a la fin de la page en cours */
+        if ((data[5] & PROG_BLOCKFLAG_FIRST) &&
+            fifo_empty(&PageFifo) && !prog_busy) {
+            prog_pagecounter = tmpCount;
+            prog_pollvalue = 0xFF;
+            prog_ffcount = 0;
+        }
+        prog_pagesize = tmpCount;
         prog_blockflags = data[5] & 0x0F;
-        prog_pagesize += (((unsigned int) data[5] & 0xF0) << 4);
-        if (prog_blockflags & PROG_BLOCKFLAG_FIRST) {
-            prog_pagecounter = prog_pagesize;
+        if (prog_pagesize != 0 && PageFifo.m_size == 0) {
+            /* le tampon serie passe a PageFifo */
+            usart_stop();
+            ser_flags = 0;
+            fifo_init(&TxFifo, 0, 0);
+            fifo_init(&RxFifo, 0, 0);
+            fifo_init(&PageFifo, SerData, USBASPSERLEN);
         }
         prog_nbytes = (data[7] << 8) | data[6];
         prog_state = PROG_STATE_WRITEFLASH;
@@ -170,10 +344,17 @@ uchar usbFunctionSetup(uchar data[8]) {
         replyBuffer[0] = usart_setbaud(data[2]);
         replyBuffer[1] = usart_setbits(data[3]);
         replyBuffer[2] = usart_setparity(data[4]);
-        replyBuffer[3] = 0x00;
-        
-        usart_init( &TxFifo, TxData, USBASPTXLEN, 
-                    &RxFifo, RxData, USBASPRXLEN);
+        ser_flags = data[5] & USBASP_SERFLAG_INTRIN;
+        replyBuffer[3] = data[5] & (USBASP_SERRX_MASK | USBASP_SERFLOW_MASK |
+                                    USBASP_SERFLAG_XONXOFF |
+                                    USBASP_SERFLAG_INTRIN);
+
+        tmpCount = USBASPRXLEN(data[5] >> USBASP_SERRX_SHIFT);
+        fifo_init(&PageFifo, 0, 0);
+        usart_init( &TxFifo, SerData + tmpCount, USBASPSERLEN - tmpCount,
+                    &RxFifo, SerData, tmpCount,
+                    (data[5] & USBASP_SERFLAG_XONXOFF) ?
+                        USBASP_SERMARGE(data[5]) : 0 );
         len = 4;
         break;
 
@@ -196,6 +377,57 @@ uchar usbFunctionSetup(uchar data[8]) {
         prog_state = PROG_STATE_WRITESER;
         len = 0xff; /* multiple out */
         break;
+
+    case USBASP_FUNC_GETSERSTATUS:
+
+        /* place libre dans TxFifo et octets en attente dans RxFifo,
+           l'hote s'en sert pour rythmer ses envois sans debordement,
+           puis le nombre d'octets de la cible perdus (RxFifo plein) */
+        usart_masquer();
+        tmpCount = fifo_free(&TxFifo);
+        replyBuffer[0] = tmpCount;
+        replyBuffer[1] = tmpCount >> 8;
+        tmpCount = fifo_count(&RxFifo);
+        replyBuffer[2] = tmpCount;
+        replyBuffer[3] = tmpCount >> 8;
+        replyBuffer[4] = usart_compteurs[USBASP_SERSTAT_PERTES];
+        replyBuffer[5] = usart_compteurs[USBASP_SERSTAT_PERTES] >> 8;
+        usart_demasquer();
+        len = 6;
+        break;
+
+    case USBASP_FUNC_GETSERSTATS:
+
+        /* les compteurs de la ligne serie (USBASP_SERSTAT_*), pour
+           choisir la vitesse et le rythme des lectures sur des mesures */
+        usart_masquer();
+        for (i = 0; i < USBASP_SERSTAT_N; i++)
+        {
+            replyBuffer[2 * i] = usart_compteurs[i];
+            replyBuffer[2 * i + 1] = usart_compteurs[i] >> 8;
+        }
+        if (data[2] & USBASP_SERSTAT_RAZ)
+            usart_raz_compteurs();
+        usart_demasquer();
+        len = 2 * USBASP_SERSTAT_N;
+        break;
+
+    case USBASP_FUNC_GETPROGSTATUS:
+
+        /* l'hote sait quand la derniere page est ecrite (usbasp.h) */
+        tmpCount = fifo_count(&PageFifo);
+        replyBuffer[0] = (prog_busy || tmpCount != 0) ?
+                         USBASP_PROGSTAT_OCCUPE : 0;
+        replyBuffer[1] = tmpCount;
+        replyBuffer[2] = tmpCount >> 8;
+        replyBuffer[3] = prog_pages;
+        replyBuffer[4] = prog_pages >> 8;
+        replyBuffer[5] = prog_errors;
+        replyBuffer[6] = ispGetSCKOption();
+        replyBuffer[7] = prog_skipped;
+        replyBuffer[8] = prog_skipped >> 8;
+        len = 9;
+        break;
         
     default: 
         // do nothing
@@ -210,14 +442,13 @@ uchar usbFunctionSetup(uchar data[8]) {
 uchar usbFunctionRead(uchar *data, uchar len) {
 
   uchar i;
-  uint16_t tmpData;
-  uchar tmpLen = len - 1;
-  uchar done = 0;
+  unsigned int crc;
 
   /* check if programmer is in correct read state */
   if ((prog_state != PROG_STATE_READFLASH) &&
       (prog_state != PROG_STATE_READEEPROM) &&
-      (prog_state != PROG_STATE_READSER))
+      (prog_state != PROG_STATE_READSER) &&
+      (prog_state != PROG_STATE_CRCFLASH))
   {
     return 0xff;
   }
@@ -226,32 +457,36 @@ uchar usbFunctionRead(uchar *data, uchar len) {
   switch(prog_state)
   {
     case PROG_STATE_READFLASH:
-        for (i = 0; i < len; i++)
-        {
-            data[i] = ispReadFlash(prog_address);
-            prog_address++;
-        }
+        ispReadFlashBlock(prog_address, data, len);
+        prog_address += len;
         break;
     case PROG_STATE_READEEPROM:
-        for (i = 0; i < len; i++)
-        {
-            data[i] = ispReadEEPROM(prog_address);
-            prog_address++;
-        }
+        ispReadEEPROMBlock(prog_address, data, len);
+        prog_address += len;
         break;
     case PROG_STATE_READSER:
-        data[0] = tmpLen;
-        prog_address++;
-        for (i = 1; i < tmpLen; i++)
-        {
-            tmpData = fifo_dequeue(&RxFifo);
-            data[i] = tmpData;
-            prog_address++;
-            if ( done == 0 && (tmpData & 0xFF00) > 0 ) {
-                done = 1;
-                data[0] = i - 1;
-            }
+        /* data[0] donne le nombre d'octets utiles qui suivent (7 au plus).
+           Des que RxFifo est vide, un paquet court termine le transfert:
+           l'hote peut demander plusieurs paquets par READSER sans payer
+           pour des paquets vides. */
+        usart_masquer();
+        i = 1 + fifo_dequeue_n(&RxFifo, data + 1, len - 1);
+        usart_demasquer();
+        data[0] = i - 1;
+        prog_address += i;
+        len = i;
+        break;
+    case PROG_STATE_CRCFLASH:
+        /* 4 blocs par paquet, lus ici: seules leurs CRC passent sur le
+           USB.  Comme pour l'EEPROM, le paquet attend la fin des
+           lectures. */
+        for (i = 0; i + 2 <= len; i += 2) {
+            crc = ispCrcFlash(prog_address, prog_crcsize);
+            data[i] = crc;
+            data[i + 1] = crc >> 8;
+            prog_address += prog_crcsize;
         }
+        len = i;
         break;
     default:
         // do nothing
@@ -270,7 +505,7 @@ uchar usbFunctionWrite(uchar *data, uchar len) {
 
     uchar retVal = 0;
     uchar i;
-    uchar serLen = 0;
+    uchar serie = 0;
 
     /* check if programmer is in correct write state */
     if ((prog_state != PROG_STATE_WRITEFLASH) &&
@@ -280,6 +515,13 @@ uchar usbFunctionWrite(uchar *data, uchar len) {
         return 0xff;
     }
   
+    /* TxFifo est partage avec l'interruption UDRE */
+    if (prog_state == PROG_STATE_WRITESER)
+    {
+        serie = 1;
+        usart_masquer();
+    }
+
 
     for (i = 0; i < len; i++) 
     {
@@ -295,13 +537,14 @@ uchar usbFunctionWrite(uchar *data, uchar len) {
             } 
             else 
             {
-                /* paged */
-                ispWriteFlash(prog_address, data[i], 0);
-                prog_pagecounter --;
-                if (prog_pagecounter == 0) 
+                /* paged: le paquet entier dans PageFifo, la boucle
+                   principale le charge dans la cible.  Faute de place,
+                   le pipeline avance ici, le temps d'un paquet. */
+                if ( i == 0 )
                 {
-                    ispFlushPage(prog_address, data[i]);
-                    prog_pagecounter = prog_pagesize;
+                    while (fifo_free(&PageFifo) < len)
+                        pages_avancer();
+                    fifo_enqueue_n(&PageFifo, data, len);
                 }
             }
             break;
@@ -312,14 +555,11 @@ uchar usbFunctionWrite(uchar *data, uchar len) {
             break;
 
         case PROG_STATE_WRITESER:
-            /* serial */
+            /* serial: data[0] octets utiles, tous copies au premier */
             if ( i == 0 )
             {
-               serLen = data[0] + 1;
-            }
-            else if ( i < serLen )
-            {
-               fifo_enqueue(&TxFifo, data[i]);
+               fifo_enqueue_n(&TxFifo, data + 1,
+                              data[0] < len - 1 ? data[0] : len - 1);
             }
             break;
         
@@ -333,20 +573,18 @@ uchar usbFunctionWrite(uchar *data, uchar len) {
     if (prog_nbytes == 0) 
     {
         prog_state = PROG_STATE_IDLE;
-        if ((prog_blockflags & PROG_BLOCKFLAG_LAST) && 
-            (prog_pagecounter != prog_pagesize)) 
-        {
-
-            /* last block and page flush pending, so flush it now */
-            ispFlushPage(prog_address, data[i]);
-        }
-      
+        /* avec PROG_BLOCKFLAG_LAST, pages_avancer() ecrit la derniere
+           page, meme incomplete, quand elle a quitte PageFifo */
         retVal = 1; // Need to return 1 when no more data is to be received
     }
 
     prog_address ++;
   }
 
+  /* et UDRE envoie ce qui vient d'arriver */
+  if (serie)
+      usart_demasquer();
+
   return retVal;
 }
 
@@ -382,18 +620,29 @@ int main(void) {
     clockInit();
     ledGreenOn();
 
+    /* deconnecte comme apres USBASP_FUNC_DISCONNECT: sans cela,
+       ispTransmit resterait nul et une requete ISP avant
+       USBASP_FUNC_CONNECT sauterait a l'adresse 0 */
+    ispDisconnect();
+
     /* main event loop */
     usbInit();
     sei();
     for (;;) {
+        /* le USART se sert lui-meme par ses interruptions (usart.c) */
         usbPoll();
-        if((UCSRA & (1<< UDRE)) != 0 )
-        {
-            usart_tx( &TxFifo);
-        }
-        if((UCSRA & (1<< RXC)) != 0)
+        /* un octet vers la cible, ou la fin d'une page qui s'ecrit */
+        pages_avancer();
+        /* octets de la carte vers l'hote par le point d'acces
+           interrupt-in: jusqu'a 8 octets bruts par paquet, sans
+           la requete de controle de USBASP_FUNC_READSER */
+        if ((ser_flags & USBASP_SERFLAG_INTRIN) && usbInterruptIsReady())
         {
-            usart_rx( &RxFifo);
+            usart_masquer();
+            i = fifo_dequeue_n(&RxFifo, intrBuffer, sizeof(intrBuffer));
+            usart_demasquer();
+            if (i > 0)
+                usbSetInterrupt(intrBuffer, i);
         }
     }
     return 0;
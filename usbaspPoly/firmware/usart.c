@@ -8,9 +8,67 @@
  * Last change....: 2010-06-20
  */
  
+#include <avr/interrupt.h>
+
 #include "usart.h"
 #include "usbasp.h"
 
+uint16_t usart_compteurs[USBASP_SERSTAT_N];
+
+/* les fifos servis par les interruptions */
+static struct Fifo *usart_txq = 0;
+static struct Fifo *usart_rxq = 0;
+
+/* XON/XOFF: RXC demande XOFF au-dessus de usart_haut, la boucle
+   principale le retire sous usart_bas (usart_demasquer) et UDRE envoie
+   a la carte le caractere quand la demande change.
+   usart_xoff s'ecrit a trois endroits: RXC, usart_init et
+   usart_demasquer.  Les deux derniers ne l'ecrivent que pendant que
+   RXCIE et UDRIE sont masques (apres usart_masquer, avant de remettre
+   les bits): RXC ne peut pas couper leur lecture-ecriture.  Toute
+   nouvelle ecriture hors de RXC doit se faire sous ce masque.
+   usart_envoye n'est ecrit que par UDRE, usart_haut et usart_bas que
+   par usart_init, sous le masque. */
+static uint16_t usart_haut = 0;     /* 0: pas de controle de flux */
+static uint16_t usart_bas;
+static volatile uint8_t usart_xoff = 0;
+static volatile uint8_t usart_envoye = 0;
+
+/*
+ * V-USB ne tolere pas plus de 25 cycles sans INT0 (usbdrv.h, "Interrupt
+ * latency"): une routine d'interruption doit commencer par sei.  Avec
+ * ISR_NOBLOCK, RXC et UDRE, qui restent actives tant que UDR n'est pas
+ * lu ou ecrit, reentreraient aussitot sans fin.  L'entree est donc en
+ * assembleur: cbi masque la source dans UCSRB (I/O 0x0A), sei, puis la
+ * suite en C, une routine d'interruption ordinaire (le prefixe
+ * __vector evite l'avertissement d'avr-gcc).  La suite remet le bit de
+ * UCSRB avant de sortir; la meme interruption peut alors s'imbriquer
+ * une fois de plus, au plus autant que le USART a d'octets en attente.
+ * Sur le PC (hote/avr/interrupt.h), la meme chose en C.
+ */
+#ifdef __AVR__
+#define USART_ISR(vecteur, bit, suite)                          \
+    void suite( void ) __attribute__((signal, used));           \
+    ISR(vecteur, ISR_NAKED)                                     \
+    {                                                           \
+        asm volatile ( "cbi %0, %1" "\n\t"                      \
+                       "sei" "\n\t"                             \
+                       "rjmp " #suite                           \
+                       :: "I" (_SFR_IO_ADDR(UCSRB)),            \
+                          "I" (bit) );                          \
+    }                                                           \
+    void suite( void )
+#else
+#define USART_ISR(vecteur, bit, suite)                          \
+    static void suite( void );                                  \
+    ISR(vecteur)                                                \
+    {                                                           \
+        UCSRB &= ~( 1 << (bit) );                               \
+        suite();                                                \
+    }                                                           \
+    static void suite( void )
+#endif
+
 /*
  *  To ajuste the baud rate of the programmer
  */
@@ -18,11 +76,17 @@
 uint8_t usart_setbaud( uint8_t speed)
 {
     if( speed < (_N_BAUD_+ USBASP_MODE_SETBAUD300) && 
-            (speed > USBASP_MODE_SETBAUD300) )
+            (speed >= USBASP_MODE_SETBAUD300) )
     {
         /* set baudrate */
-        UBRRL = (baud[speed-0x10]) & 0x00FF;
-        UBRRH = (baud[speed-0x10]) >> 8;
+        uint16_t ubrr = pgm_read_word( &baud[speed-0x10] );
+
+        UBRRL = ubrr & 0x00FF;
+        UBRRH = ubrr >> 8;
+        if( speed >= _BAUD_U2X_ )
+            UCSRA |= ( 1 << U2X );
+        else
+            UCSRA &= ~( 1 << U2X );
         return speed;
     }
     return 0xFE;
@@ -114,15 +178,31 @@ uint8_t usart_setparity(uint8_t bits)
  */
 
 uint8_t usart_init(struct Fifo *TxQueue, uint8_t *TxData, uint16_t TxLen,
-        struct Fifo *RxQueue, uint8_t *RxData, uint16_t RxLen  )
+        struct Fifo *RxQueue, uint8_t *RxData, uint16_t RxLen,
+        uint16_t marge )
 {
     /* activate the queues */
+    usart_masquer();
     fifo_init(TxQueue, TxData, TxLen);
     fifo_init(RxQueue, RxData, RxLen);
+    usart_txq = TxQueue;
+    usart_rxq = RxQueue;
+    usart_raz_compteurs();
+    /* une carte arretee par XOFF recoit XON (usart_envoye reste),
+       meme si le nouveau reglage se passe de controle de flux */
+    usart_xoff = 0;
+    usart_haut = 0;
+    if( marge != 0 )
+    {
+        usart_haut = ( RxLen - 1 > 2 * marge ) ? RxLen - 1 - marge
+                                               : ( RxLen - 1 ) / 2;
+        usart_bas = usart_haut / 2;
+    }
     /* active usart */
     DDRD |= ( 1 << PD1 );
     PORTD |= ( 1 << 3); 
     UCSRB |= ( 1 << TXEN ) | ( 1 << RXEN );
+    usart_demasquer();
     return 0;
 }
 
@@ -131,11 +211,66 @@ void usart_stop()
     UCSRB = 0;
 }
 
+void usart_raz_compteurs( void )
+{
+    uint8_t i;
+
+    for( i = 0; i < USBASP_SERSTAT_N; i++ )
+        usart_compteurs[i] = 0;
+}
+
+/*
+ *  Les compteurs saturent plutot que de revenir a 0
+ */
+
+static void usart_compter( uint8_t i )
+{
+    if( usart_compteurs[i] != 0xFFFF )
+        usart_compteurs[i]++;
+}
+
+static void usart_niveau( uint8_t i, uint16_t n )
+{
+    if( n > usart_compteurs[i] )
+        usart_compteurs[i] = n;
+}
+
+/*
+ *  Masquer et demasquer les interruptions du USART.  Un bit a la fois:
+ *  cbi et sbi ne peuvent pas etre coupes par une interruption qui
+ *  changerait UCSRB entre la lecture et l'ecriture.
+ */
+
+void usart_masquer( void )
+{
+    UCSRB &= ~( 1 << RXCIE );
+    UCSRB &= ~( 1 << UDRIE );
+}
+
+void usart_demasquer( void )
+{
+    /* RxFifo ne se vide qu'entre masquer et demasquer: la carte peut
+       reprendre des qu'il est redescendu */
+    if( usart_xoff && fifo_count( usart_rxq ) <= usart_bas )
+        usart_xoff = 0;
+    if( UCSRB & ( 1 << RXEN ) )
+        UCSRB |= ( 1 << RXCIE );
+    /* TxFifo ne se remplit qu'entre masquer et demasquer: son plus
+       haut niveau se voit ici */
+    if( usart_txq != 0 && !fifo_empty( usart_txq ) )
+    {
+        usart_niveau( USBASP_SERSTAT_TXMAX, fifo_count( usart_txq ) );
+        UCSRB |= ( 1 << UDRIE );
+    }
+    if( usart_xoff != usart_envoye )
+        UCSRB |= ( 1 << UDRIE );
+}
+
 /*
  *  Function to call to send a byte from programmer to target
  */
 
-void usart_tx(struct Fifo *TxQueue)
+static void usart_tx(struct Fifo *TxQueue)
  {
     if( !fifo_empty( TxQueue ) )
     {
@@ -147,10 +282,73 @@ void usart_tx(struct Fifo *TxQueue)
  *  Function to call to send a byte from target to programmer
  */
  
-void usart_rx(struct Fifo *RxQueue)
+static void usart_rx(struct Fifo *RxQueue)
  {
+    /* FE, DOR et PE se lisent avant UDR, qui les efface.  Toujours
+       lire UDR pour liberer le registre, meme s'il faut jeter l'octet.
+       Un octet en erreur de trame ou de parite passe quand meme: seul
+       le compteur le signale. */
+    uint8_t etat = UCSRA;
+    uint8_t data = UDR;
+
+    if( etat & ( ( 1 << FE ) | ( 1 << DOR ) | ( 1 << PE ) ) )
+    {
+        if( etat & ( 1 << DOR ) )
+            usart_compter( USBASP_SERSTAT_DOR );
+        if( etat & ( 1 << FE ) )
+            usart_compter( USBASP_SERSTAT_FE );
+        if( etat & ( 1 << PE ) )
+            usart_compter( USBASP_SERSTAT_PE );
+    }
     if(!fifo_full(RxQueue))
     {
-        fifo_enqueue( RxQueue, UDR );
+        uint16_t n;
+
+        fifo_enqueue( RxQueue, data );
+        n = fifo_count( RxQueue );
+        usart_niveau( USBASP_SERSTAT_RXMAX, n );
+        if( usart_haut != 0 && n >= usart_haut && !usart_xoff )
+        {
+            usart_xoff = 1;
+            UCSRB |= ( 1 << UDRIE );
+        }
+    }
+    else
+    {
+        usart_compter( USBASP_SERSTAT_PERTES );
     }
  }
+
+/*
+ *  UDR vide: XON ou XOFF d'abord s'il a change, sinon l'octet suivant
+ *  de TxFifo.  UDRIE reste masque quand il n'y a rien a envoyer,
+ *  jusqu'au prochain usart_demasquer() ou XOFF.  La demande est lue
+ *  une fois: si RXC la change entre-temps, elle repart au tour suivant.
+ */
+
+USART_ISR(USART_UDRE_vect, UDRIE, __vector_usart_udre)
+{
+    uint8_t voulu = usart_xoff;
+
+    if( voulu != usart_envoye )
+    {
+        UDR = voulu ? USBASP_XOFF : USBASP_XON;
+        usart_envoye = voulu;
+    }
+    else
+    {
+        usart_tx( usart_txq );
+    }
+    if( !fifo_empty( usart_txq ) || usart_xoff != usart_envoye )
+        UCSRB |= ( 1 << UDRIE );
+}
+
+/*
+ *  Octet recu: dans RxFifo
+ */
+
+USART_ISR(USART_RXC_vect, RXCIE, __vector_usart_rxc)
+{
+    usart_rx( usart_rxq );
+    UCSRB |= ( 1 << RXCIE );
+}
@@ -12,25 +12,48 @@
 #define __usart_h_included__
 
 #include <avr/io.h>
+#include <avr/pgmspace.h>
 
 #include "fifo.h"
+#include "usbasp.h"
 
 /* 
  * take 512 bytes for both fifos. 
  *  Jerome: modification: 256 only
+ *
+ * Un seul tampon pour les deux fifos, partage a chaque
+ * USBASP_FUNC_SETSERIOS selon la part de la reception demandee par
+ * l'hote, en 16e (USBASP_SERRX_*, usbasp.h): 15/16 laissent 645 octets
+ * a RX pour une carte qui envoie beaucoup, 55 ms a 115200 baud sans que
+ * l'hote lise.  Le reste de la RAM de l'ATmega8 (1 Ko) va aux variables
+ * et a V-USB, environ 165 octets, et a la pile: un peu plus de 100
+ * octets pour les interruptions imbriquees (RXC et UDRE chacune deux
+ * fois, puis INT0), et les appels de la boucle principale par-dessus.
+ * 688 est le plus grand multiple de 16 qui lui laisse les 160 octets
+ * que make taille exige de main.bin.  Les 752 octets qu'il faudrait
+ * pour 60 ms n'en laisseraient que 109: au-dela de 55 ms, XON/XOFF.
  */
 
-#ifndef USBASPTXLEN
-    #define USBASPTXLEN             (1 << 7)
+#ifndef USBASPSERLEN
+    #define USBASPSERLEN            688
 #endif
 
-#ifndef USBASPRXLEN
-    #define USBASPRXLEN             (1 << 7)
-#endif
+/* taille de RxFifo pour une part de 1 a 15 (0: moitie-moitie) */
+#define USBASPRXLEN(part) \
+    ( ( USBASPSERLEN / 16 ) * ( (part) ? (part) : 8 ) )
 
 #define _N_BAUD_ 10
 
-const static uint16_t baud[_N_BAUD_] = {
+/*
+ * A 12 MHz, UBRR = 18 (38400), 12 (57600) et 6 (115200) donnent des
+ * erreurs de 2.8 %, 0.2 % et 7 %: 115200 ne passait jamais.  A partir
+ * de 38400, on double la vitesse (U2X) et l'erreur tombe a 0.2 %.
+ * Plus bas, UBRR depasserait 12 bits pour 300 baud en double vitesse.
+ */
+#define _BAUD_U2X_ USBASP_MODE_SETBAUD38400
+
+/* en flash: 20 octets de plus pour les fifos */
+const static uint16_t baud[_N_BAUD_] PROGMEM = {
      2499   /* 300 */
     ,1249   /* 600 */
     ,624    /* 1200 */
@@ -38,9 +61,9 @@ const static uint16_t baud[_N_BAUD_] = {
     ,155    /* 4800 */
     ,77     /* 9600 */
     ,38     /* 19200 */
-    ,18     /* 38400 */
-    ,12     /* 57600 */
-    ,6      /* 115200 */
+    ,38     /* 38400, U2X */
+    ,25     /* 57600, U2X */
+    ,12     /* 115200, U2X */
 };
 
 uint8_t usart_setbaud( uint8_t speed);
@@ -51,13 +74,33 @@ uint8_t usart_setbits( uint8_t bits);
 
 uint8_t usart_setparity(uint8_t bits);
 
+/*
+ * marge: 0, ou controle de flux XON/XOFF vers la carte.  XOFF part
+ * quand il ne reste plus que marge octets libres dans RxFifo (au plus
+ * la moitie), XON quand la boucle principale l'a vide de moitie.
+ */
 uint8_t usart_init(struct Fifo *TxQueue, uint8_t *TxData, uint16_t TxLen, 
-                   struct Fifo *RxQueue, uint8_t *RxData, uint16_t RxLen);
+                   struct Fifo *RxQueue, uint8_t *RxData, uint16_t RxLen,
+                   uint16_t marge);
 
 void usart_stop( void );
 
-void usart_tx(struct Fifo *fifo );
+/*
+ * Les interruptions RXC et UDRE remplissent RxFifo et vident TxFifo
+ * (ceux passes a usart_init).  Cote boucle principale, tout acces a ces
+ * fifos se fait entre usart_masquer() et usart_demasquer(): seules les
+ * interruptions du USART attendent, INT0 du USB reste permise.
+ * usart_demasquer() relance aussi l'envoi de ce qui attend dans TxFifo.
+ */
+void usart_masquer( void );
+
+void usart_demasquer( void );
+
+/* compteurs de la ligne serie, indices USBASP_SERSTAT_* (usbasp.h).
+   Les interruptions les tiennent a jour: a lire entre usart_masquer()
+   et usart_demasquer(). */
+extern uint16_t usart_compteurs[USBASP_SERSTAT_N];
 
-void usart_rx(struct Fifo *fifo );
+void usart_raz_compteurs( void );
 
 #endif /* __usart_h_included__ */
@@ -25,6 +25,10 @@
 #define USBASP_FUNC_SETSERIOS  11
 #define USBASP_FUNC_READSER    12
 #define USBASP_FUNC_WRITESER   13
+#define USBASP_FUNC_GETSERSTATUS 14
+#define USBASP_FUNC_GETSERSTATS 15
+#define USBASP_FUNC_GETPROGSTATUS 16
+#define USBASP_FUNC_CRCFLASH   17
 
 /* programming state */
 #define PROG_STATE_IDLE         0
@@ -34,6 +38,7 @@
 #define PROG_STATE_WRITEEEPROM  4
 #define PROG_STATE_READSER      5
 #define PROG_STATE_WRITESER     6
+#define PROG_STATE_CRCFLASH     7
 
 /* Block mode flags */
 #define PROG_BLOCKFLAG_FIRST    1
@@ -75,6 +80,55 @@
 #define USBASP_MODE_PARITYE         0x02
 #define USBASP_MODE_PARITYO         0x03
 
+/* options serie, 4e octet de USBASP_FUNC_SETSERIOS */
+#define USBASP_SERFLAG_INTRIN       0x01  /* carte -> PC par interrupt-in */
+#define USBASP_SERFLAG_XONXOFF      0x02  /* XON/XOFF vers la carte */
+/* bits 3..2: avec XON/XOFF, place qui reste dans RxFifo quand XOFF
+   part, 16 << n octets; XON quand RxFifo est redescendu a moitie */
+#define USBASP_SERFLOW_MASK         0x0C
+#define USBASP_SERFLOW_SHIFT        2
+#define USBASP_SERMARGE(options) \
+    ( 16 << ( ( (options) & USBASP_SERFLOW_MASK ) >> USBASP_SERFLOW_SHIFT ) )
+#define USBASP_XON                  0x11
+#define USBASP_XOFF                 0x13
+/* bits 7..4: part du tampon serie pour la reception, en 16e (1 a 15),
+   0 pour moitie-moitie; renvoyee dans l'echo */
+#define USBASP_SERRX_MASK           0xF0
+#define USBASP_SERRX_SHIFT          4
+
+/* compteurs de USBASP_FUNC_GETSERSTATS, 2 octets chacun (poids faible
+   d'abord) dans cet ordre.  Ils saturent a 0xFFFF et repartent de 0 a
+   chaque USBASP_FUNC_SETSERIOS, ou apres la lecture si le bit 0 de
+   wValue est a 1. */
+#define USBASP_SERSTAT_DOR          0   /* DOR: octets ecrases dans le USART */
+#define USBASP_SERSTAT_FE           1   /* erreurs de trame (bit d'arret) */
+#define USBASP_SERSTAT_PE           2   /* erreurs de parite */
+#define USBASP_SERSTAT_PERTES       3   /* octets jetes, RxFifo plein */
+#define USBASP_SERSTAT_RXMAX        4   /* plus haut niveau de RxFifo */
+#define USBASP_SERSTAT_TXMAX        5   /* plus haut niveau de TxFifo */
+#define USBASP_SERSTAT_N            6
+#define USBASP_SERSTAT_RAZ          0x01
+
+/* reponse de USBASP_FUNC_GETPROGSTATUS, 9 octets: l'etat, les octets
+   de flash recus mais pas encore charges dans la cible (2 octets), les
+   pages ecrites depuis USBASP_FUNC_CONNECT (2 octets), les pages dont
+   la fin d'ecriture ne s'est pas vue a temps, le SCK en service
+   (USBASP_ISP_SCK_*, celui trouve par USBASP_FUNC_ENABLEPROG en mode
+   automatique), puis les pages sautees parce qu'elles n'avaient que des
+   0xFF (2 octets).  Les 16 bits sont poids faible d'abord. */
+#define USBASP_PROGSTAT_OCCUPE      0x01  /* ecriture de la flash en cours */
+
+/* USBASP_FUNC_CRCFLASH: wValue donne l'adresse comme pour
+   USBASP_FUNC_READFLASH, wIndex la taille des blocs (la page, en
+   general) et wLength 2 octets par bloc.  Le firmware lit la flash et
+   ne renvoie que la CRC-16 de chaque bloc (polynome 0x1021, 0xFFFF au
+   depart, celle de _crc_xmodem_update), poids faible d'abord.
+   Chaque paquet de 8 octets lit 4 blocs dans usbFunctionRead(): des
+   blocs de plus de USBASP_CRC_MAX octets (la plus grande page) sont
+   refuses, aucune CRC ne revient.  Au SCK le plus lent, il reste a
+   l'hote de demander peu de blocs a la fois. */
+#define USBASP_CRC_MAX              256
+
 /* macros for gpio functions */
 #define ledRedOn()    PORTC &= ~(1<< PC0);PORTC |= (1 << PC1)
 #define ledRedOff()   PORTC |= (1 << PC0) | (1 << PC1)